@@ -0,0 +1,195 @@
+// ----------------------------------------------------------------------------------------------------------------------------
+// 
+// Copyright 2019 Khoi Nguyen
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+//    The above copyright notice and this permission notice shall be included in all copies or substantial
+//    portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+// 
+// ----------------------------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "Vec4.h"
+#include "Quat.h"
+#include "AABB.h"
+#include "Util.h"
+
+namespace Core
+{
+    // ----------------------------------------------------------------------------------------------------------------------------
+
+    // Row major 3x4 affine transform, applied to column vectors. The last column is the translation.
+    class AffineTransform
+    {
+    public:
+
+        inline AffineTransform()
+        {
+            for (int row = 0; row < 3; row++)
+            {
+                for (int col = 0; col < 4; col++)
+                {
+                    M[row][col] = (row == col) ? 1.f : 0.f;
+                }
+            }
+        }
+
+        // ----------------------------------------------------------------------------
+
+        static inline AffineTransform Translation(const Vec4& offset)
+        {
+            AffineTransform ret;
+            ret.M[0][3] = offset.X();
+            ret.M[1][3] = offset.Y();
+            ret.M[2][3] = offset.Z();
+
+            return ret;
+        }
+
+        static inline AffineTransform Scale(float x, float y, float z)
+        {
+            AffineTransform ret;
+            ret.M[0][0] = x;
+            ret.M[1][1] = y;
+            ret.M[2][2] = z;
+
+            return ret;
+        }
+
+        static inline AffineTransform Rotation(const Quat& unitQuat)
+        {
+            const float w = unitQuat.GetScalar();
+            const float x = unitQuat.GetVector().X();
+            const float y = unitQuat.GetVector().Y();
+            const float z = unitQuat.GetVector().Z();
+
+            AffineTransform ret;
+            ret.M[0][0] = 1.f - 2.f * (y * y + z * z);
+            ret.M[0][1] = 2.f * (x * y - w * z);
+            ret.M[0][2] = 2.f * (x * z + w * y);
+            ret.M[1][0] = 2.f * (x * y + w * z);
+            ret.M[1][1] = 1.f - 2.f * (x * x + z * z);
+            ret.M[1][2] = 2.f * (y * z - w * x);
+            ret.M[2][0] = 2.f * (x * z - w * y);
+            ret.M[2][1] = 2.f * (y * z + w * x);
+            ret.M[2][2] = 1.f - 2.f * (x * x + y * y);
+
+            return ret;
+        }
+
+        static inline AffineTransform Rotation(const Vec4& axis, float angleDegrees)
+        {
+            Quat q(angleDegrees, Vec4(axis).MakeUnitVector());
+            return Rotation(q.ToUnitNormQuaternion());
+        }
+
+        // ----------------------------------------------------------------------------
+
+        // Applies other first, then this
+        inline AffineTransform operator*(const AffineTransform& other) const
+        {
+            AffineTransform ret;
+            for (int row = 0; row < 3; row++)
+            {
+                for (int col = 0; col < 4; col++)
+                {
+                    ret.M[row][col] = (M[row][0] * other.M[0][col]) + (M[row][1] * other.M[1][col]) + (M[row][2] * other.M[2][col]);
+                }
+                ret.M[row][3] += M[row][3];
+            }
+
+            return ret;
+        }
+
+        inline AffineTransform Inverse() const
+        {
+            // Invert the 3x3 part by cofactors, then move the translation through it
+            const float c00 = M[1][1] * M[2][2] - M[1][2] * M[2][1];
+            const float c01 = M[1][2] * M[2][0] - M[1][0] * M[2][2];
+            const float c02 = M[1][0] * M[2][1] - M[1][1] * M[2][0];
+            const float det = M[0][0] * c00 + M[0][1] * c01 + M[0][2] * c02;
+            RTL_ASSERT(det != 0.f);
+
+            const float invDet = 1.f / det;
+
+            AffineTransform ret;
+            ret.M[0][0] = c00 * invDet;
+            ret.M[0][1] = (M[0][2] * M[2][1] - M[0][1] * M[2][2]) * invDet;
+            ret.M[0][2] = (M[0][1] * M[1][2] - M[0][2] * M[1][1]) * invDet;
+            ret.M[1][0] = c01 * invDet;
+            ret.M[1][1] = (M[0][0] * M[2][2] - M[0][2] * M[2][0]) * invDet;
+            ret.M[1][2] = (M[0][2] * M[1][0] - M[0][0] * M[1][2]) * invDet;
+            ret.M[2][0] = c02 * invDet;
+            ret.M[2][1] = (M[0][1] * M[2][0] - M[0][0] * M[2][1]) * invDet;
+            ret.M[2][2] = (M[0][0] * M[1][1] - M[0][1] * M[1][0]) * invDet;
+
+            for (int row = 0; row < 3; row++)
+            {
+                ret.M[row][3] = -((ret.M[row][0] * M[0][3]) + (ret.M[row][1] * M[1][3]) + (ret.M[row][2] * M[2][3]));
+            }
+
+            return ret;
+        }
+
+        // ----------------------------------------------------------------------------
+
+        inline Vec4 TransformPoint(const Vec4& p) const
+        {
+            return Vec4(
+                M[0][0] * p.X() + M[0][1] * p.Y() + M[0][2] * p.Z() + M[0][3],
+                M[1][0] * p.X() + M[1][1] * p.Y() + M[1][2] * p.Z() + M[1][3],
+                M[2][0] * p.X() + M[2][1] * p.Y() + M[2][2] * p.Z() + M[2][3]);
+        }
+
+        inline Vec4 TransformVector(const Vec4& v) const
+        {
+            return Vec4(
+                M[0][0] * v.X() + M[0][1] * v.Y() + M[0][2] * v.Z(),
+                M[1][0] * v.X() + M[1][1] * v.Y() + M[1][2] * v.Z(),
+                M[2][0] * v.X() + M[2][1] * v.Y() + M[2][2] * v.Z());
+        }
+
+        // Call on the inverse transform to carry normals across
+        inline Vec4 TransformVectorTransposed(const Vec4& v) const
+        {
+            return Vec4(
+                M[0][0] * v.X() + M[1][0] * v.Y() + M[2][0] * v.Z(),
+                M[0][1] * v.X() + M[1][1] * v.Y() + M[2][1] * v.Z(),
+                M[0][2] * v.X() + M[1][2] * v.Y() + M[2][2] * v.Z());
+        }
+
+        inline AABB TransformBox(const AABB& box) const
+        {
+            // Center and extent form, so the result stays tight for any rotation
+            const Vec4 center = TransformPoint((box.Min() + box.Max()) * 0.5f);
+            const Vec4 half   = (box.Max() - box.Min()) * 0.5f;
+
+            Vec4 extent;
+            for (int row = 0; row < 3; row++)
+            {
+                extent[row] = fabsf(M[row][0]) * half.X() + fabsf(M[row][1]) * half.Y() + fabsf(M[row][2]) * half.Z();
+            }
+
+            return AABB(center - extent, center + extent);
+        }
+
+        inline float Get(int row, int col) const
+        {
+            return M[row][col];
+        }
+
+    private:
+
+        float M[3][4];
+    };
+}
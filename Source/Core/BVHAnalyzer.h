@@ -0,0 +1,114 @@
+// ----------------------------------------------------------------------------------------------------------------------------
+// 
+// Copyright 2019 Khoi Nguyen
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+//    The above copyright notice and this permission notice shall be included in all copies or substantial
+//    portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+// 
+// ----------------------------------------------------------------------------------------------------------------------------
+
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "BVHNode.h"
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+namespace Core
+{
+    class TriMesh;
+    class WorldScene;
+
+    // ----------------------------------------------------------------------------------------------------------------------------
+
+    // Measures how good the BVHs in a scene are, so builder changes can be judged by numbers. Everything is taken from
+    // the binary BVHNode trees the builders produce, except memory, which also covers the compiled copy. Trees are
+    // released once compiled unless BVHNode::SetReleaseTrees(false) was called before the scene was built.
+    class BVHAnalyzer
+    {
+    public:
+
+        static const int NumDepthBuckets    = 64;
+        static const int NumLeafSizeBuckets = BVHNode::MaxLeafPrimitives + 2;     // The last one counts bigger leaves
+
+        // Mesh BVHs are also refitted after turning a copy of the mesh this far
+        static constexpr float RefitTestAngle = 30.f;
+
+        struct Report
+        {
+            BVHNode*    Root;
+            bool        Transformed;            // Reached through a transform, so camera rays don't apply
+
+            // Shape
+            int         NumNodes;
+            int         NumLeaves;
+            int         NumReferences;          // Leaf entries, a primitive in several leaves counts each time
+            int         MaxDepth;
+            float       SAHCost;
+            float       AverageLeafDepth;
+            float       AverageOverlap;         // Area the two children share, relative to their parent
+            int         LeafDepths[NumDepthBuckets];
+            int         LeafSizes[NumLeafSizeBuckets];
+
+            // Memory
+            size_t      TreeBytes;
+            int         NumCompiledNodes;
+            size_t      CompiledBytes;
+
+            // Measured per ray, closest hit
+            int         NumCameraRays;
+            float       CameraNodeVisits;
+            float       CameraPrimitiveTests;
+            int         NumRandomRays;
+            float       RandomNodeVisits;
+            float       RandomPrimitiveTests;
+
+            // Meshes only, SAH cost of the turned copy refitted and rebuilt
+            bool        RefitMeasured;
+            float       RefitSAHCost;
+            float       RebuiltSAHCost;
+        };
+
+    public:
+
+        // Every distinct BVH in the scene, outermost first. Nested ones are found through lists, transforms, meshes
+        // and BVH leaves.
+        static void        FindBVHs(IHitable* head, std::vector<BVHNode*>& roots, std::vector<bool>& transformed);
+
+        // Traces numRays camera rays and numRays random rays through each BVH
+        static void        Analyze(WorldScene* scene, int numRays, std::vector<Report>& reports);
+        static std::string Format(const Report& report);
+
+        // Writes every node as text, one per line, for diffing builds offline
+        static bool        Dump(WorldScene* scene, const char* filePath);
+
+    private:
+
+        struct TraversalCounts
+        {
+            int64_t NodeVisits;
+            int64_t PrimitiveTests;
+        };
+
+        static void findBVHs(IHitable* head, bool underTransform, std::vector<BVHNode*>& roots, std::vector<bool>& transformed,
+                             std::vector<TriMesh*>& meshes);
+        static void findInLeaves(BVHNode* node, bool underTransform, std::vector<BVHNode*>& roots, std::vector<bool>& transformed,
+                                 std::vector<TriMesh*>& meshes);
+        static void analyzeNode(BVHNode* node, int depth, Report& report);
+        static void analyzeRefit(TriMesh* mesh, Report& report);
+        static void traceRay(BVHNode* node, const Ray& ray, float tMin, float& tMax, TraversalCounts& counts);
+        static void dumpNode(BVHNode* node, int depth, FILE* file);
+    };
+}
@@ -0,0 +1,413 @@
+// ----------------------------------------------------------------------------------------------------------------------------
+// 
+// Copyright 2019 Khoi Nguyen
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+//    The above copyright notice and this permission notice shall be included in all copies or substantial
+//    portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+// 
+// ----------------------------------------------------------------------------------------------------------------------------
+
+#include "BVHAnalyzer.h"
+#include "FlipNormals.h"
+#include "HitableList.h"
+#include "HitableTransform.h"
+#include "TriMesh.h"
+#include "WorldScene.h"
+#include <algorithm>
+#include <cfloat>
+#include <typeinfo>
+
+using namespace Core;
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+static inline float boxSurfaceArea(const Vec4& minP, const Vec4& maxP)
+{
+    const Vec4 d = maxP - minP;
+    return 2.f * ((d.X() * d.Y()) + (d.Y() * d.Z()) + (d.Z() * d.X()));
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void BVHAnalyzer::FindBVHs(IHitable* head, std::vector<BVHNode*>& roots, std::vector<bool>& transformed)
+{
+    std::vector<TriMesh*> meshes;
+    roots.clear();
+    transformed.clear();
+    findBVHs(head, false, roots, transformed, meshes);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void BVHAnalyzer::findBVHs(IHitable* head, bool underTransform, std::vector<BVHNode*>& roots, std::vector<bool>& transformed,
+                           std::vector<TriMesh*>& meshes)
+{
+    if (head == nullptr)
+    {
+        return;
+    }
+
+    const std::type_info& tid = typeid(*head);
+    if (tid == typeid(HitableList))
+    {
+        HitableList* list = (HitableList*)head;
+        for (int i = 0; i < list->GetListSize(); i++)
+        {
+            findBVHs(list->GetList()[i], underTransform, roots, transformed, meshes);
+        }
+    }
+    else if (tid == typeid(BVHNode))
+    {
+        // Instances share their BVH, report it once
+        BVHNode* root = (BVHNode*)head;
+        if (std::find(roots.begin(), roots.end(), root) != roots.end())
+        {
+            return;
+        }
+
+        roots.push_back(root);
+        transformed.push_back(underTransform);
+        meshes.push_back(nullptr);
+        findInLeaves(root, underTransform, roots, transformed, meshes);
+    }
+    else if (tid == typeid(TriMesh))
+    {
+        // The mesh's BVH is the first one found under it, if it wasn't reported already
+        const size_t numRoots = roots.size();
+        findBVHs(((TriMesh*)head)->GetBVH(), underTransform, roots, transformed, meshes);
+        if (roots.size() > numRoots)
+        {
+            meshes[numRoots] = (TriMesh*)head;
+        }
+    }
+    else if (tid == typeid(FlipNormals))
+    {
+        findBVHs(((FlipNormals*)head)->GetHitObject(), underTransform, roots, transformed, meshes);
+    }
+    else if (tid == typeid(HitableTranslate))
+    {
+        findBVHs(((HitableTranslate*)head)->GetHitObject(), true, roots, transformed, meshes);
+    }
+    else if (tid == typeid(HitableRotateY))
+    {
+        findBVHs(((HitableRotateY*)head)->GetHitObject(), true, roots, transformed, meshes);
+    }
+    else if (tid == typeid(HitableInstance))
+    {
+        findBVHs(((HitableInstance*)head)->GetHitObject(), true, roots, transformed, meshes);
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void BVHAnalyzer::findInLeaves(BVHNode* node, bool underTransform, std::vector<BVHNode*>& roots, std::vector<bool>& transformed,
+                               std::vector<TriMesh*>& meshes)
+{
+    if (!node->IsLeaf())
+    {
+        findInLeaves(node->GetLeft(), underTransform, roots, transformed, meshes);
+        findInLeaves(node->GetRight(), underTransform, roots, transformed, meshes);
+        return;
+    }
+
+    for (int i = 0; i < node->GetNumPrimitives(); i++)
+    {
+        findBVHs(node->GetPrimitive(i), underTransform, roots, transformed, meshes);
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void BVHAnalyzer::Analyze(WorldScene* scene, int numRays, std::vector<Report>& reports)
+{
+    std::vector<BVHNode*> roots;
+    std::vector<bool>     transformed;
+    std::vector<TriMesh*> meshes;
+    findBVHs(scene->GetWorld(), false, roots, transformed, meshes);
+
+    reports.clear();
+    for (size_t r = 0; r < roots.size(); r++)
+    {
+        BVHNode* root   = roots[r];
+        Report   report = {};
+        report.Root        = root;
+        report.Transformed = transformed[r];
+
+        // Shape
+        analyzeNode(root, 0, report);
+        const int numInterior = report.NumNodes - report.NumLeaves;
+        report.SAHCost          = root->GetSAHCost();
+        report.AverageOverlap   = (numInterior > 0) ? (report.AverageOverlap / float(numInterior)) : 0.f;
+        report.AverageLeafDepth = (report.NumLeaves > 0) ? (report.AverageLeafDepth / float(report.NumLeaves)) : 0.f;
+
+        // Memory
+        report.TreeBytes        = root->GetTreeMemoryUsage();
+        report.NumCompiledNodes = root->GetNumCompiledNodes();
+        report.CompiledBytes    = root->GetCompiledMemoryUsage();
+
+        // Camera rays only mean something for BVHs in world space
+        TraversalCounts counts = {};
+        if (!report.Transformed)
+        {
+            for (int i = 0; i < numRays; i++)
+            {
+                float tMax = FLT_MAX;
+                traceRay(root, scene->GetCamera().GetRay(RandomFloat(), RandomFloat()), 0.001f, tMax, counts);
+            }
+
+            report.NumCameraRays        = numRays;
+            report.CameraNodeVisits     = float(double(counts.NodeVisits) / double(GetMax(numRays, 1)));
+            report.CameraPrimitiveTests = float(double(counts.PrimitiveTests) / double(GetMax(numRays, 1)));
+        }
+
+        // Random rays start anywhere in the BVH's box and head anywhere
+        const AABB& box   = root->GetBox();
+        const Vec4  size  = box.Max() - box.Min();
+        const float time0 = root->GetTime0();
+        const float time1 = root->GetTime1();
+        counts = {};
+        for (int i = 0; i < numRays; i++)
+        {
+            const Vec4  origin    = box.Min() + Vec4(RandomFloat() * size.X(), RandomFloat() * size.Y(), RandomFloat() * size.Z());
+            const Vec4  direction = UnitVector(RandomInUnitSphere());
+            const float time      = time0 + RandomFloat() * (time1 - time0);
+            float       tMax      = FLT_MAX;
+            traceRay(root, Ray(origin, direction, time), 0.001f, tMax, counts);
+        }
+
+        report.NumRandomRays        = numRays;
+        report.RandomNodeVisits     = float(double(counts.NodeVisits) / double(GetMax(numRays, 1)));
+        report.RandomPrimitiveTests = float(double(counts.PrimitiveTests) / double(GetMax(numRays, 1)));
+
+        if (meshes[r] != nullptr)
+        {
+            analyzeRefit(meshes[r], report);
+        }
+
+        reports.push_back(report);
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void BVHAnalyzer::analyzeNode(BVHNode* node, int depth, Report& report)
+{
+    report.NumNodes++;
+    report.MaxDepth = GetMax(report.MaxDepth, depth);
+
+    if (node->IsLeaf())
+    {
+        report.NumLeaves++;
+        report.NumReferences    += node->GetNumPrimitives();
+        report.AverageLeafDepth += float(depth);
+        report.LeafDepths[GetMin(depth, NumDepthBuckets - 1)]++;
+        report.LeafSizes[GetMin(node->GetNumPrimitives(), NumLeafSizeBuckets - 1)]++;
+        return;
+    }
+
+    // Summed here, averaged over interior nodes once the walk is done
+    const AABB& box        = node->GetBox();
+    const AABB& leftBox    = node->GetLeft()->GetBox();
+    const AABB& rightBox   = node->GetRight()->GetBox();
+    const float parentArea = boxSurfaceArea(box.Min(), box.Max());
+    const Vec4  overlapMin = Vec4(GetMax(leftBox.Min().X(), rightBox.Min().X()), GetMax(leftBox.Min().Y(), rightBox.Min().Y()), GetMax(leftBox.Min().Z(), rightBox.Min().Z()));
+    const Vec4  overlapMax = Vec4(GetMin(leftBox.Max().X(), rightBox.Max().X()), GetMin(leftBox.Max().Y(), rightBox.Max().Y()), GetMin(leftBox.Max().Z(), rightBox.Max().Z()));
+    const bool  overlaps   = (overlapMin.X() <= overlapMax.X()) && (overlapMin.Y() <= overlapMax.Y()) && (overlapMin.Z() <= overlapMax.Z());
+    if (overlaps && parentArea > 0.f)
+    {
+        report.AverageOverlap += boxSurfaceArea(overlapMin, overlapMax) / parentArea;
+    }
+
+    analyzeNode(node->GetLeft(), depth + 1, report);
+    analyzeNode(node->GetRight(), depth + 1, report);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void BVHAnalyzer::analyzeRefit(TriMesh* mesh, Report& report)
+{
+    // Work on a copy, the scene's mesh may be about to render
+    IHitable** triArray;
+    int        numTriangles;
+    mesh->GetTriArray(triArray, numTriangles);
+
+    std::vector<Triangle*> triangles(numTriangles);
+    for (int i = 0; i < numTriangles; i++)
+    {
+        triangles[i] = new Triangle(*(Triangle*)triArray[i]);
+    }
+    TriMesh* copy = TriMesh::CreateFromTriangles(triangles);
+
+    // Turn it about its center, which leaves the refitted boxes loose around their rotated contents
+    AABB box;
+    mesh->BoundingBox(0, 0, box);
+    const Vec4            center = 0.5f * (box.Min() + box.Max());
+    const AffineTransform turn   = AffineTransform::Translation(center) * AffineTransform::Rotation(Vec4(0, 1, 0), RefitTestAngle) *
+                                   AffineTransform::Translation(-center);
+
+    // No threshold can be reached refitting, and a zero one always rebuilds
+    copy->Transform(turn, FLT_MAX);
+    report.RefitSAHCost = copy->GetBVH()->GetSAHCost();
+
+    copy->GetBVH()->RefitOrRebuild(0, 0, 0.f);
+    report.RebuiltSAHCost = copy->GetBVH()->GetSAHCost();
+    report.RefitMeasured  = true;
+
+    IHitable* copyHitable = copy;
+    delete copyHitable;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void BVHAnalyzer::traceRay(BVHNode* node, const Ray& ray, float tMin, float& tMax, TraversalCounts& counts)
+{
+    // Same walk as BVHNode::Hit does without a compiled copy, counting as it goes
+    counts.NodeVisits++;
+
+    AABB box;
+    node->BoundingBox(ray.Time(), ray.Time(), box);
+    if (!box.Hit(ray, tMin, tMax))
+    {
+        return;
+    }
+
+    if (node->IsLeaf())
+    {
+        HitRecord rec;
+        for (int i = 0; i < node->GetNumPrimitives(); i++)
+        {
+            counts.PrimitiveTests++;
+            if (node->GetPrimitive(i)->Hit(ray, tMin, tMax, rec))
+            {
+                tMax = rec.T;
+            }
+        }
+        return;
+    }
+
+    const bool farIsLeft = ray.InverseDirectionArray()[node->GetSplitAxis()] < 0.f;
+    traceRay(farIsLeft ? node->GetRight() : node->GetLeft(), ray, tMin, tMax, counts);
+    traceRay(farIsLeft ? node->GetLeft() : node->GetRight(), ray, tMin, tMax, counts);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+std::string BVHAnalyzer::Format(const Report& report)
+{
+    char        line[256];
+    std::string out;
+
+    snprintf(line, sizeof(line), "BVH%s: %d nodes, %d leaves, %d references, depth %d (leaves average %.1f)\n",
+        report.Transformed ? " (transformed)" : "", report.NumNodes, report.NumLeaves, report.NumReferences, report.MaxDepth, report.AverageLeafDepth);
+    out += line;
+
+    snprintf(line, sizeof(line), "\tSAH cost %.2f, children overlap by %.1f%% of their parent's area on average\n",
+        report.SAHCost, 100.f * report.AverageOverlap);
+    out += line;
+
+    snprintf(line, sizeof(line), "\tMemory: tree %s%.1f bytes/node (%.1fKB), compiled %d nodes at %.1f bytes/node (%.1fKB)\n",
+        report.Root->IsTreeReleased() ? "released, " : "",
+        double(report.TreeBytes) / double(GetMax(report.NumNodes, 1)), double(report.TreeBytes) / 1024.0,
+        report.NumCompiledNodes, double(report.CompiledBytes) / double(GetMax(report.NumCompiledNodes, 1)), double(report.CompiledBytes) / 1024.0);
+    out += line;
+
+    out += "\tLeaf depths:";
+    for (int i = 0; i < NumDepthBuckets; i++)
+    {
+        if (report.LeafDepths[i] > 0)
+        {
+            snprintf(line, sizeof(line), " %d%s:%d", i, (i == NumDepthBuckets - 1) ? "+" : "", report.LeafDepths[i]);
+            out += line;
+        }
+    }
+
+    out += "\n\tLeaf sizes:";
+    for (int i = 0; i < NumLeafSizeBuckets; i++)
+    {
+        if (report.LeafSizes[i] > 0)
+        {
+            snprintf(line, sizeof(line), " %d%s:%d", i, (i == NumLeafSizeBuckets - 1) ? "+" : "", report.LeafSizes[i]);
+            out += line;
+        }
+    }
+    out += "\n";
+
+    if (report.NumCameraRays > 0)
+    {
+        snprintf(line, sizeof(line), "\tCamera rays (%d): %.1f node visits, %.1f primitive tests per ray\n",
+            report.NumCameraRays, report.CameraNodeVisits, report.CameraPrimitiveTests);
+        out += line;
+    }
+
+    snprintf(line, sizeof(line), "\tRandom rays (%d): %.1f node visits, %.1f primitive tests per ray\n",
+        report.NumRandomRays, report.RandomNodeVisits, report.RandomPrimitiveTests);
+    out += line;
+
+    if (report.RefitMeasured)
+    {
+        snprintf(line, sizeof(line), "\tTurned %.0f degrees: SAH cost %.2f refitted, %.2f rebuilt\n",
+            RefitTestAngle, report.RefitSAHCost, report.RebuiltSAHCost);
+        out += line;
+    }
+
+    return out;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+bool BVHAnalyzer::Dump(WorldScene* scene, const char* filePath)
+{
+    FILE* file = fopen(filePath, "w");
+    if (file == nullptr)
+    {
+        DEBUG_PRINTF("BVHAnalyzer: couldn't open %s\n", filePath);
+        return false;
+    }
+
+    std::vector<BVHNode*> roots;
+    std::vector<bool>     transformed;
+    FindBVHs(scene->GetWorld(), roots, transformed);
+
+    // Only what the build decides goes in, so two builds of the same scene diff cleanly
+    for (size_t r = 0; r < roots.size(); r++)
+    {
+        fprintf(file, "bvh %d%s sah %.6g\n", int(r), transformed[r] ? " transformed" : "", roots[r]->GetSAHCost());
+        dumpNode(roots[r], 1, file);
+    }
+
+    fclose(file);
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void BVHAnalyzer::dumpNode(BVHNode* node, int depth, FILE* file)
+{
+    const AABB& box = node->GetBox();
+    fprintf(file, "%*s", depth * 2, "");
+    if (node->IsLeaf())
+    {
+        fprintf(file, "leaf %d", node->GetNumPrimitives());
+    }
+    else
+    {
+        fprintf(file, "node axis %d", node->GetSplitAxis());
+    }
+    fprintf(file, " [%.6g %.6g %.6g] [%.6g %.6g %.6g]\n", box.Min().X(), box.Min().Y(), box.Min().Z(), box.Max().X(), box.Max().Y(), box.Max().Z());
+
+    if (!node->IsLeaf())
+    {
+        dumpNode(node->GetLeft(), depth + 1, file);
+        dumpNode(node->GetRight(), depth + 1, file);
+    }
+}
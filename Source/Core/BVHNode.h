@@ -18,6 +18,10 @@
 // ----------------------------------------------------------------------------------------------------------------------------
 
 #pragma once
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <vector>
 #include "IHitable.h"
 #include "AABB.h"
 #include "Ray.h"
@@ -27,35 +31,315 @@
 
 namespace Core
 {
+    class LinearBVH;
+    template <int Width> class WideBVH;
+
+    // ----------------------------------------------------------------------------------------------------------------------------
+
     class BVHNode : public IHitable
     {
     public:
 
-        BVHNode(IHitable** list, int n, float time0, float time1);
+        // Compiled form the root traverses with. The quantized layouts are the wide ones with 8-bit child bounds,
+        // at under half the size per node.
+        enum Layout
+        {
+            LayoutBinary     = 2,
+            LayoutWide4      = 4,
+            LayoutWide8      = 8,
+            LayoutQuantized4 = 0x100 | LayoutWide4,
+            LayoutQuantized8 = 0x100 | LayoutWide8,
+        };
+
+        enum BuildMethod
+        {
+            BuildSAH = 0,
+            BuildMorton,
+            BuildSpatialSAH,    // SAH plus spatial splits (SBVH), primitives straddling a split go in both children
+        };
+
+        struct BuildStats
+        {
+            int         NumBuilds;
+            int64_t     NumNodes;
+            int64_t     NumPrimitives;
+            int64_t     NumDuplicates;      // Extra leaf references made by spatial splits
+            double      BuildTimeMs;
+        };
+
+        // Plain float bounds, for builds and for refitting the compiled copies
+        struct BuildBounds
+        {
+            float Min[3];
+            float Max[3];
+
+            inline void  Reset();
+            inline void  Grow(const float* minP, const float* maxP);
+            inline void  Grow(const BuildBounds& other);
+            inline float SurfaceArea() const;
+            inline float OverlapArea(const BuildBounds& other) const;
+            inline bool  IsEmpty() const;
+        };
+
+        // Primitives a ray tested most recently. With spatial splits a primitive can sit in several leaves, and a
+        // traversal skips the ones it has already tested.
+        struct Mailbox
+        {
+            static const int Size = 8;
+
+            const IHitable*  Entries[Size] = {};
+            int              Next          = 0;
+
+            // False if the hitable was already in the mailbox
+            inline bool Insert(const IHitable* hitable)
+            {
+                for (int i = 0; i < Size; i++)
+                {
+                    if (Entries[i] == hitable)
+                    {
+                        return false;
+                    }
+                }
+
+                Entries[Next] = hitable;
+                Next          = (Next + 1) % Size;
+                return true;
+            }
+        };
+
+    public:
+
+        // Primitives that will be packed into SIMD groups of groupSize (see PackLeaves) are costed per group,
+        // so leaves come out full
+        BVHNode(IHitable** list, int n, float time0, float time1, int groupSize = 1, BuildMethod method = GetDefaultBuildMethod());
         virtual ~BVHNode();
 
         virtual bool Hit(const Ray& ray, float tMin, float tMax, HitRecord& rec) const;
         virtual bool BoundingBox(float t0, float t1, AABB& box) const;
+        virtual bool Occluded(const Ray& ray, float tMin, float tMax) const;
+        virtual void HitPacket(const Ray* rays, int numRays, float tMin, float* tMax, HitRecord* recs, bool* hits) const;
+        virtual void HitStream(const Ray* rays, int numRays, float tMin, float* tMax, HitRecord* recs, bool* hits) const;
+
+        inline BVHNode*   GetLeft()                   { return Left; }
+        inline BVHNode*   GetRight()                  { return Right; }
+        inline bool       IsLeaf() const              { return Left == nullptr; }
+        inline int        GetNumPrimitives() const    { return NumPrimitives; }
+        inline IHitable*  GetPrimitive(int i)         { return Primitives[i]; }
+        inline int        GetSplitAxis() const        { return SplitAxis; }
+
+        // Bounds over the whole time range, and at either end of it. Primitives are assumed to move linearly
+        // in between, so a ray's bounds are a lerp of the two.
+        inline const AABB& GetBox() const             { return Box; }
+        inline const AABB& GetBoxAtTime0() const      { return (Motion != nullptr) ? Motion->Box0 : Box; }
+        inline const AABB& GetBoxAtTime1() const      { return (Motion != nullptr) ? Motion->Box1 : Box; }
+        inline bool        HasMotion() const          { return Motion != nullptr; }
+
+        // Root only. Time range the tree was built or last refitted over.
+        inline float       GetTime0() const           { return (Root != nullptr) ? Root->Time0 : 0.f; }
+        inline float       GetTime1() const           { return (Root != nullptr) ? Root->Time1 : 0.f; }
+
+        // Root only. True when spatial splits put some primitives in more than one leaf.
+        inline bool        HasDuplicates() const      { return (Root != nullptr) && (Root->UniquePrimitives != nullptr); }
+
+        // Only meaningful on a root node
+        void              SetLayout(Layout layout);
+        inline Layout     GetLayout() const           { return (Root != nullptr) ? Root->CurrentLayout : LayoutBinary; }
+
+        // Root only. Deletes the binary tree below the root once it's compiled, leaving the compiled copy to render,
+        // refit and cost with. The root turns into a single leaf holding every primitive, so anything walking the tree
+        // still finds them all, but the layout can't change from then on. Returns false if there's no compiled copy.
+        bool              ReleaseTree();
+        inline bool       IsTreeReleased() const      { return (Root != nullptr) && Root->Released; }
+
+        // Root only. Bytes held by the tree and its root info, not counting the compiled copy or the primitives.
+        size_t            GetTreeMemoryUsage() const;
 
-        IHitable* GetLeft() { return Left; }
-        IHitable* GetRight(){ return Right; }
+        // Root only. Size of the compiled copy rendering goes through, zero if it's walking the tree.
+        int               GetNumCompiledNodes() const;
+        size_t            GetCompiledMemoryUsage() const;
+
+        // Layout for BVHs built from here on
+        static void       SetDefaultLayout(Layout layout);
+        static Layout     GetDefaultLayout();
+
+        // Build method for BVHs built from here on
+        static void        SetDefaultBuildMethod(BuildMethod method);
+        static BuildMethod GetDefaultBuildMethod();
+
+        // Spatial split builds duplicate at most this fraction of the primitive count
+        static void        SetSpatialSplitBudget(float budget);
+        static float       GetSpatialSplitBudget();
+
+        // Whether meshes and top level BVHs release their trees once compiled (see ReleaseTree). Tools that walk
+        // the trees turn it off before building.
+        static void        SetReleaseTrees(bool release);
+        static bool        GetReleaseTrees();
+
+        // Build stats, summed over every root built since the last reset
+        static BuildStats GetBuildStats();
+        static void       ResetBuildStats();
+        inline double     GetBuildTimeMs() const      { return (Root != nullptr) ? Root->BuildTimeMs : 0.0; }
+
+        // Surface area heuristic cost of the tree, relative to the root's area. Released trees are costed from their
+        // compiled copy, and their build cost is rebased to it when they're released.
+        float             GetSAHCost() const;
+        inline float      GetBuildSAHCost() const     { return (Root != nullptr) ? Root->BuildSAHCost : 0.f; }
+
+        // Root only. Refit recomputes bounds bottom up for primitives that moved, keeping the topology. The
+        // primitives are refreshed first, and the compiled copy is refitted in place. RefitOrRebuild does the
+        // same, but rebuilds from scratch once the SAH cost has degraded past threshold times the cost the tree
+        // was built with. Returns true if it rebuilt.
+        void              Refit(float time0, float time1);
+        bool              RefitOrRebuild(float time0, float time1, float threshold = DefaultRebuildThreshold);
+
+        // Root only. Replaces the primitives of every leaf with the single hitable pack() makes from them, such
+        // as a SIMD triangle block. The tree owns the packed hitables from then on, and no longer owns the originals.
+        // unpack() hands back the originals a packed hitable was made from, so a rebuild can split them again.
+        typedef std::function<IHitable*(IHitable* const* primitives, int numPrimitives)> LeafPacker;
+        typedef std::function<void(IHitable* packed, std::vector<IHitable*>& primitives)> LeafUnpacker;
+        void              PackLeaves(const LeafPacker& pack, const LeafUnpacker& unpack);
+
+        // Bounds of a run of primitives over the whole time range, and at either end of it
+        static void       GetPrimitiveBounds(IHitable* const* primitives, int n, float time0, float time1,
+                                             BuildBounds& bounds, BuildBounds& bounds0, BuildBounds& bounds1);
+
+    public:
+
+        // Binned SAH build settings
+        static const int       NumSAHBins        = 16;
+        static const int       MaxLeafPrimitives = 8;
+        static constexpr float TraversalCost     = 1.f;
+        static constexpr float IntersectCost     = 1.f;
+
+        // Spatial split settings. Splits are only tried where the object split's children overlap by more than
+        // this fraction of the root's area.
+        static const int       NumSpatialBins            = 16;
+        static constexpr float SpatialSplitOverlap       = 1e-5f;
+        static constexpr float DefaultSpatialSplitBudget = 0.3f;
+
+        // Subtrees with at least this many primitives are built as separate tasks
+        static const int       ParallelBuildThreshold = 4096;
+
+        // Refitted trees get rebuilt once their SAH cost grows past this factor
+        static constexpr float DefaultRebuildThreshold = 1.5f;
 
     private:
 
-        enum ECompareMode
+        // Everything only the root needs, allocated with it
+        struct RootInfo
         {
-            CompareX, CompareY, CompareZ
+            IHitable**   PrimitiveStorage;      // Every leaf's primitives, in tree order
+            IHitable**   UniquePrimitives;      // Each primitive once, when spatial splits duplicated some
+            int          NumUniquePrimitives;
+            LinearBVH*   Flat;
+            WideBVH<4>*  Wide4;
+            WideBVH<8>*  Wide8;
+            Layout       CurrentLayout;
+            double       BuildTimeMs;
+            float        BuildSAHCost;
+            int          GroupSize;
+            BuildMethod  Method;
+            LeafPacker   Packer;
+            LeafUnpacker Unpacker;
+            float        Time0;
+            float        Time1;
+            bool         Released;
         };
 
-        static int boxCompare(const void* a, const void* b, ECompareMode mode);
-        static int boxXCompare(const void* a, const void* b);
-        static int boxYCompare(const void* a, const void* b);
-        static int boxZCompare(const void* a, const void* b);
+        // Bounds at either end of the time range, only allocated for nodes whose bounds move
+        struct MotionBounds
+        {
+            AABB         Box0;
+            AABB         Box1;
+            float        Time0;
+            float        Time1;
+        };
+
+        struct BuildPrimitive
+        {
+            BuildBounds Bounds;
+            BuildBounds Bounds0;
+            BuildBounds Bounds1;
+            float       Centroid[3];
+            uint32_t    MortonCode;
+            IHitable*   Hitable;
+        };
+
+        struct BuildContext
+        {
+            BuildPrimitive*    Prims;
+            IHitable**         OrderedPrims;
+            BuildMethod        Method;
+            float              Time0;
+            float              Time1;
+            int                GroupSize;
+            std::atomic<int>*  NumNodes;
+
+            // Spatial split builds only
+            std::atomic<int>*  NumReferences;
+            std::atomic<int>*  SplitBudget;
+            int                MaxReferences;
+            float              MinOverlapArea;
+
+            inline float       NumGroups(int count) const;
+        };
+
+        struct SplitCandidate
+        {
+            float              Cost;
+            int                Axis;
+            int                Bin;
+            float              Position;    // Split plane, spatial splits only
+            BuildBounds        LeftBounds;
+            BuildBounds        RightBounds;
+            int                LeftCount;
+            int                RightCount;
+        };
+
+        BVHNode(const BuildContext& ctx, int begin, int end, int taskDepth);
+        BVHNode(const BuildContext& ctx, std::vector<BuildPrimitive>& refs, int taskDepth);
+        void        buildRoot(IHitable** list, int n, float time0, float time1, int groupSize, BuildMethod method, Layout layout);
+        void        build(const BuildContext& ctx, int begin, int end, int taskDepth);
+        void        buildSpatial(const BuildContext& ctx, std::vector<BuildPrimitive>& refs, int taskDepth);
+        int         splitSAH(const BuildContext& ctx, int begin, int end, const BuildBounds& bounds, const BuildBounds& centroidBounds);
+        int         splitMorton(const BuildContext& ctx, int begin, int end);
+        void        splitReferences(const BuildContext& ctx, const std::vector<BuildPrimitive>& refs, const SplitCandidate& split,
+                                    std::vector<BuildPrimitive>& leftRefs, std::vector<BuildPrimitive>& rightRefs);
+        void        makeLeaf(const BuildContext& ctx, int begin, int end);
+        void        makeLeaf(const BuildContext& ctx, const std::vector<BuildPrimitive>& refs);
+        void        relayoutLeaf(IHitable** storage, int& storageOffset);
+        void        releaseCompiled();
+        void        setBounds(const BuildBounds& bounds, const BuildBounds& bounds0, const BuildBounds& bounds1, float time0, float time1);
+        void        refit(float time0, float time1);
+        void        refitNode(float time0, float time1, BuildBounds& bounds, BuildBounds& bounds0, BuildBounds& bounds1);
+        float       sahCost(float invRootArea) const;
+        float       compiledSAHCost() const;
+        size_t      nodeMemoryUsage() const;
+        int         countPrimitives() const;
+        void        packLeaf(const LeafPacker& pack, IHitable** storage, int& storageOffset);
+        void        rebuild(float time0, float time1);
+        AABB        boxAtTime(float time) const;
+
+        static void gatherBounds(IHitable* hitable, float time0, float time1, BuildPrimitive& prim);
+        static bool findObjectSplit(const BuildContext& ctx, const BuildPrimitive* prims, int begin, int end, const BuildBounds& centroidBounds,
+                                    float invArea, SplitCandidate& split);
+        static bool findSpatialSplit(const BuildContext& ctx, const BuildPrimitive* refs, int numRefs, const BuildBounds& bounds,
+                                     float invArea, SplitCandidate& split);
+        static bool consumeSplitBudget(const BuildContext& ctx);
+        static void clipReference(const BuildPrimitive& ref, int axis, float slabMin, float slabMax, BuildPrimitive& clipped);
+        static void deleteNodes(BVHNode* node);
+        static void computeMortonCodes(BuildPrimitive* prims, int n);
+        static void sortByMortonCode(BuildPrimitive* prims, int n);
 
     private:
 
-        IHitable* Left;
-        IHitable* Right;
-        AABB      Box;
+        BVHNode*      Left;
+        BVHNode*      Right;
+        IHitable**    Primitives;
+        RootInfo*     Root;         // Root only
+        MotionBounds* Motion;       // Moving nodes only
+        int           NumPrimitives;
+        int           SplitAxis;
+        AABB          Box;
     };
 }
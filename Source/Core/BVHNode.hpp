@@ -18,146 +18,1700 @@
 // ----------------------------------------------------------------------------------------------------------------------------
 
 #include "BVHNode.h"
+#include "LinearBVH.h"
+#include "WideBVH.h"
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <thread>
+#include <unordered_set>
+#include <vector>
 
 using namespace Core;
 
 // ----------------------------------------------------------------------------------------------------------------------------
 
-int BVHNode::boxCompare(const void* a, const void* b, ECompareMode mode)
+static BVHNode::Layout       sDefaultLayout      = BVHNode::LayoutWide8;
+static BVHNode::BuildMethod  sDefaultBuildMethod = BVHNode::BuildSAH;
+static float                 sSpatialSplitBudget = BVHNode::DefaultSpatialSplitBudget;
+static bool                  sReleaseTrees       = true;
+
+// Accumulated over every root built since the last reset
+static std::atomic<int>      sStatsNumBuilds(0);
+static std::atomic<int64_t>  sStatsNumNodes(0);
+static std::atomic<int64_t>  sStatsNumPrimitives(0);
+static std::atomic<int64_t>  sStatsNumDuplicates(0);
+static std::atomic<int64_t>  sStatsBuildTimeUs(0);
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+static void parallelFor(int count, const std::function<void(int begin, int end)>& func)
+{
+    // Small inputs aren't worth the threads
+    const int numThreads = GetMax(1, int(std::thread::hardware_concurrency()));
+    if (count < BVHNode::ParallelBuildThreshold || numThreads == 1)
+    {
+        func(0, count);
+        return;
+    }
+
+    std::vector<std::thread> threads;
+    const int chunkSize = (count + numThreads - 1) / numThreads;
+    for (int begin = chunkSize; begin < count; begin += chunkSize)
+    {
+        threads.push_back(std::thread(func, begin, GetMin(begin + chunkSize, count)));
+    }
+
+    func(0, GetMin(chunkSize, count));
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+inline void BVHNode::BuildBounds::Reset()
+{
+    for (int axis = 0; axis < 3; axis++)
+    {
+        Min[axis] = FLT_MAX;
+        Max[axis] = -FLT_MAX;
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+inline void BVHNode::BuildBounds::Grow(const float* minP, const float* maxP)
+{
+    for (int axis = 0; axis < 3; axis++)
+    {
+        Min[axis] = GetMin(Min[axis], minP[axis]);
+        Max[axis] = GetMax(Max[axis], maxP[axis]);
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+inline void BVHNode::BuildBounds::Grow(const BuildBounds& other)
+{
+    Grow(other.Min, other.Max);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+inline float BVHNode::BuildBounds::SurfaceArea() const
+{
+    const float dx = Max[0] - Min[0];
+    const float dy = Max[1] - Min[1];
+    const float dz = Max[2] - Min[2];
+
+    return 2.f * ((dx * dy) + (dy * dz) + (dz * dx));
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+inline float BVHNode::BuildBounds::OverlapArea(const BuildBounds& other) const
+{
+    BuildBounds overlap;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        overlap.Min[axis] = GetMax(Min[axis], other.Min[axis]);
+        overlap.Max[axis] = GetMin(Max[axis], other.Max[axis]);
+    }
+
+    return overlap.IsEmpty() ? 0.f : overlap.SurfaceArea();
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+inline bool BVHNode::BuildBounds::IsEmpty() const
+{
+    return (Min[0] > Max[0]) || (Min[1] > Max[1]) || (Min[2] > Max[2]);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+inline float BVHNode::BuildContext::NumGroups(int count) const
+{
+    return float((count + GroupSize - 1) / GroupSize);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+BVHNode::BVHNode(IHitable** list, int n, float time0, float time1, int groupSize, BuildMethod method)
+    : Left(nullptr)
+    , Right(nullptr)
+    , Primitives(nullptr)
+    , Root(new RootInfo())
+    , Motion(nullptr)
+    , NumPrimitives(0)
+    , SplitAxis(0)
+{
+    Root->PrimitiveStorage    = nullptr;
+    Root->UniquePrimitives    = nullptr;
+    Root->NumUniquePrimitives = 0;
+    Root->Flat                = nullptr;
+    Root->Wide4               = nullptr;
+    Root->Wide8               = nullptr;
+    Root->CurrentLayout       = LayoutBinary;
+    Root->BuildTimeMs         = 0;
+    Root->BuildSAHCost        = 0;
+    Root->GroupSize           = GetMax(groupSize, 1);
+    Root->Method              = method;
+    Root->Time0               = time0;
+    Root->Time1               = time1;
+    Root->Released            = false;
+
+    buildRoot(list, n, time0, time1, Root->GroupSize, Root->Method, sDefaultLayout);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void BVHNode::buildRoot(IHitable** list, int n, float time0, float time1, int groupSize, BuildMethod requestedMethod, Layout layout)
+{
+    const auto startTime = std::chrono::high_resolution_clock::now();
+
+    // Gather bounds and centroids once, so the build never calls back into the hitables
+    BuildPrimitive* prims = new BuildPrimitive[GetMax(n, 1)];
+    parallelFor(n, [list, prims, time0, time1](int begin, int end)
+    {
+        for (int i = begin; i < end; i++)
+        {
+            gatherBounds(list[i], time0, time1, prims[i]);
+
+            BuildPrimitive& prim = prims[i];
+            for (int axis = 0; axis < 3; axis++)
+            {
+                prim.Centroid[axis] = 0.5f * (prim.Bounds.Min[axis] + prim.Bounds.Max[axis]);
+            }
+            prim.MortonCode = 0;
+            prim.Hitable    = list[i];
+        }
+    });
+
+    // Clipping only works on static bounds, moving primitives get a plain SAH build
+    BuildMethod method = requestedMethod;
+    if (method == BuildSpatialSAH && time1 > time0)
+    {
+        for (int i = 0; i < n && method == BuildSpatialSAH; i++)
+        {
+            for (int axis = 0; axis < 3; axis++)
+            {
+                if ((prims[i].Bounds0.Min[axis] != prims[i].Bounds1.Min[axis]) || (prims[i].Bounds0.Max[axis] != prims[i].Bounds1.Max[axis]))
+                {
+                    DEBUG_PRINTF("BVHNode: primitives move, building without spatial splits\n");
+                    method = BuildSAH;
+                    break;
+                }
+            }
+        }
+    }
+
+    // Morton builds split on the code bits, so sort by them up front
+    if (method == BuildMorton && n > 1)
+    {
+        computeMortonCodes(prims, n);
+        sortByMortonCode(prims, n);
+    }
+
+    // Subtrees go wide until every core has one
+    int taskDepth = 0;
+    for (unsigned int numTasks = 1; numTasks < std::thread::hardware_concurrency(); numTasks *= 2)
+    {
+        taskDepth++;
+    }
+
+    std::atomic<int> numNodes(1);
+    int              numReferences = n;
+    if (method == BuildSpatialSAH)
+    {
+        // Leaves claim slots as they finish, with room for every duplicate the budget allows
+        const int        budget        = int(float(n) * sSpatialSplitBudget);
+        const int        maxReferences = n + budget;
+        std::atomic<int> nextReference(0);
+        std::atomic<int> splitBudget(budget);
+
+        BuildBounds rootBounds;
+        rootBounds.Reset();
+        for (int i = 0; i < n; i++)
+        {
+            rootBounds.Grow(prims[i].Bounds);
+        }
+
+        IHitable** unordered = new IHitable*[GetMax(maxReferences, 1)];
+
+        std::vector<BuildPrimitive> refs(prims, prims + n);
+        BuildContext ctx = { nullptr, unordered, method, time0, time1, groupSize, &numNodes,
+                             &nextReference, &splitBudget, maxReferences, SpatialSplitOverlap * rootBounds.SurfaceArea() };
+        buildSpatial(ctx, refs, taskDepth);
+
+        // Put the leaves back in tree order, PackLeaves and the compiled layouts rely on it
+        numReferences = nextReference.load();
+        IHitable** storage       = new IHitable*[GetMax(numReferences, 1)];
+        int        storageOffset = 0;
+        relayoutLeaf(storage, storageOffset);
+        delete[] unordered;
+        Root->PrimitiveStorage = storage;
+
+        // Primitives in several leaves can't be owned by them, the root keeps the list
+        if (numReferences > n)
+        {
+            Root->UniquePrimitives    = new IHitable*[n];
+            Root->NumUniquePrimitives = n;
+            for (int i = 0; i < n; i++)
+            {
+                Root->UniquePrimitives[i] = list[i];
+            }
+        }
+    }
+    else
+    {
+        // Leaves point into this array, in tree order
+        Root->PrimitiveStorage = new IHitable*[GetMax(n, 1)];
+
+        BuildContext ctx = { prims, Root->PrimitiveStorage, method, time0, time1, groupSize, &numNodes, nullptr, nullptr, n, 0.f };
+        build(ctx, 0, n, taskDepth);
+    }
+
+    delete[] prims;
+
+    // Rendering goes through a compiled copy, the tree stays around until someone releases it
+    SetLayout(layout);
+
+    // Record stats
+    const int64_t buildTimeUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - startTime).count();
+    Root->BuildTimeMs  = double(buildTimeUs) / 1000.0;
+    Root->BuildSAHCost = GetSAHCost();
+    sStatsNumBuilds++;
+    sStatsNumNodes      += numNodes.load();
+    sStatsNumPrimitives += n;
+    sStatsNumDuplicates += numReferences - n;
+    sStatsBuildTimeUs   += buildTimeUs;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void BVHNode::gatherBounds(IHitable* hitable, float time0, float time1, BuildPrimitive& prim)
+{
+    AABB box;
+    if (!hitable->BoundingBox(time0, time1, box))
+    {
+        std::cerr << "No bounding box in bvh_node constructor\n";
+    }
+
+    // Bounds at either end of the time range, for motion-aware traversal
+    AABB box0 = box, box1 = box;
+    if (time1 > time0)
+    {
+        hitable->BoundingBox(time0, time0, box0);
+        hitable->BoundingBox(time1, time1, box1);
+    }
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        prim.Bounds.Min[axis]  = box.Min()[axis];
+        prim.Bounds.Max[axis]  = box.Max()[axis];
+        prim.Bounds0.Min[axis] = box0.Min()[axis];
+        prim.Bounds0.Max[axis] = box0.Max()[axis];
+        prim.Bounds1.Min[axis] = box1.Min()[axis];
+        prim.Bounds1.Max[axis] = box1.Max()[axis];
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void BVHNode::SetDefaultBuildMethod(BuildMethod method)
+{
+    sDefaultBuildMethod = method;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+BVHNode::BuildMethod BVHNode::GetDefaultBuildMethod()
+{
+    return sDefaultBuildMethod;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void BVHNode::SetSpatialSplitBudget(float budget)
+{
+    sSpatialSplitBudget = GetMax(budget, 0.f);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+float BVHNode::GetSpatialSplitBudget()
+{
+    return sSpatialSplitBudget;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void BVHNode::SetReleaseTrees(bool release)
+{
+    sReleaseTrees = release;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+bool BVHNode::GetReleaseTrees()
+{
+    return sReleaseTrees;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+BVHNode::BuildStats BVHNode::GetBuildStats()
+{
+    BuildStats stats;
+    stats.NumBuilds     = sStatsNumBuilds.load();
+    stats.NumNodes      = sStatsNumNodes.load();
+    stats.NumPrimitives = sStatsNumPrimitives.load();
+    stats.NumDuplicates = sStatsNumDuplicates.load();
+    stats.BuildTimeMs   = double(sStatsBuildTimeUs.load()) / 1000.0;
+
+    return stats;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void BVHNode::ResetBuildStats()
+{
+    sStatsNumBuilds     = 0;
+    sStatsNumNodes      = 0;
+    sStatsNumPrimitives = 0;
+    sStatsNumDuplicates = 0;
+    sStatsBuildTimeUs   = 0;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void BVHNode::computeMortonCodes(BuildPrimitive* prims, int n)
+{
+    // Quantize centroids to 10 bits per axis within the centroid bounds
+    BuildBounds centroidBounds;
+    centroidBounds.Reset();
+    for (int i = 0; i < n; i++)
+    {
+        centroidBounds.Grow(prims[i].Centroid, prims[i].Centroid);
+    }
+
+    float scale[3];
+    for (int axis = 0; axis < 3; axis++)
+    {
+        const float extent = centroidBounds.Max[axis] - centroidBounds.Min[axis];
+        scale[axis] = (extent > 0.f) ? (1023.f / extent) : 0.f;
+    }
+
+    parallelFor(n, [prims, &centroidBounds, &scale](int begin, int end)
+    {
+        for (int i = begin; i < end; i++)
+        {
+            uint32_t cell[3];
+            for (int axis = 0; axis < 3; axis++)
+            {
+                cell[axis] = uint32_t(Clamp((prims[i].Centroid[axis] - centroidBounds.Min[axis]) * scale[axis], 0.f, 1023.f));
+            }
+
+            prims[i].MortonCode = (ExpandMortonBits(cell[0]) << 2) | (ExpandMortonBits(cell[1]) << 1) | ExpandMortonBits(cell[2]);
+        }
+    });
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void BVHNode::sortByMortonCode(BuildPrimitive* prims, int n)
+{
+    // LSD radix sort, three passes of 10 bits
+    static const int BitsPerPass = 10;
+    static const int NumBuckets  = 1 << BitsPerPass;
+
+    BuildPrimitive* temp    = new BuildPrimitive[n];
+    BuildPrimitive* source  = prims;
+    BuildPrimitive* dest    = temp;
+    int*            offsets = new int[NumBuckets];
+
+    for (int pass = 0; pass < 3; pass++)
+    {
+        const int shift = pass * BitsPerPass;
+        for (int b = 0; b < NumBuckets; b++)
+        {
+            offsets[b] = 0;
+        }
+
+        for (int i = 0; i < n; i++)
+        {
+            offsets[(source[i].MortonCode >> shift) & (NumBuckets - 1)]++;
+        }
+
+        int sum = 0;
+        for (int b = 0; b < NumBuckets; b++)
+        {
+            const int count = offsets[b];
+            offsets[b] = sum;
+            sum += count;
+        }
+
+        for (int i = 0; i < n; i++)
+        {
+            dest[offsets[(source[i].MortonCode >> shift) & (NumBuckets - 1)]++] = source[i];
+        }
+
+        std::swap(source, dest);
+    }
+
+    // Odd number of passes, the result is in temp
+    for (int i = 0; i < n; i++)
+    {
+        prims[i] = source[i];
+    }
+
+    delete[] offsets;
+    delete[] temp;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void BVHNode::SetDefaultLayout(Layout layout)
+{
+    sDefaultLayout = layout;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+BVHNode::Layout BVHNode::GetDefaultLayout()
+{
+    return sDefaultLayout;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void BVHNode::SetLayout(Layout layout)
+{
+    // Subtrees are traversed through their root's compiled copy, and a released tree has nothing left to compile
+    if (Root == nullptr || Root->Released)
+    {
+        return;
+    }
+
+    releaseCompiled();
+
+    bool compiled = false;
+    switch (layout)
+    {
+    case LayoutWide8:
+        Root->Wide8 = new WideBVH<8>();
+        compiled    = Root->Wide8->Build(this);
+        break;
+
+    case LayoutWide4:
+        Root->Wide4 = new WideBVH<4>();
+        compiled    = Root->Wide4->Build(this);
+        break;
+
+    case LayoutQuantized8:
+        Root->Wide8 = new WideBVH<8>();
+        compiled    = Root->Wide8->Build(this, true);
+        break;
+
+    case LayoutQuantized4:
+        Root->Wide4 = new WideBVH<4>();
+        compiled    = Root->Wide4->Build(this, true);
+        break;
+
+    default:
+        Root->Flat  = new LinearBVH();
+        compiled    = Root->Flat->Build(this);
+        break;
+    }
+
+    // Failing that, Hit() falls back to walking the tree
+    if (!compiled)
+    {
+        releaseCompiled();
+    }
+    Root->CurrentLayout = layout;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+int BVHNode::GetNumCompiledNodes() const
+{
+    if (Root == nullptr)
+    {
+        return 0;
+    }
+    else if (Root->Wide8 != nullptr)
+    {
+        return Root->Wide8->GetNumNodes();
+    }
+    else if (Root->Wide4 != nullptr)
+    {
+        return Root->Wide4->GetNumNodes();
+    }
+    else if (Root->Flat != nullptr)
+    {
+        return Root->Flat->GetNumNodes();
+    }
+
+    return 0;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+size_t BVHNode::GetCompiledMemoryUsage() const
+{
+    if (Root == nullptr)
+    {
+        return 0;
+    }
+    else if (Root->Wide8 != nullptr)
+    {
+        return Root->Wide8->GetMemoryUsage();
+    }
+    else if (Root->Wide4 != nullptr)
+    {
+        return Root->Wide4->GetMemoryUsage();
+    }
+    else if (Root->Flat != nullptr)
+    {
+        return Root->Flat->GetMemoryUsage();
+    }
+
+    return 0;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void BVHNode::releaseCompiled()
+{
+    delete Root->Flat;
+    delete Root->Wide4;
+    delete Root->Wide8;
+
+    Root->Flat  = nullptr;
+    Root->Wide4 = nullptr;
+    Root->Wide8 = nullptr;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+bool BVHNode::ReleaseTree()
+{
+    if (Root == nullptr || GetNumCompiledNodes() == 0)
+    {
+        return false;
+    }
+
+    // The storage has every leaf's primitives in tree order, so the root takes it over as one big leaf. Leaves
+    // owned their primitives, and now the root does, unless it already kept a list of the duplicated ones.
+    if (!IsLeaf())
+    {
+        const int numStored = countPrimitives();
+        deleteNodes(Left);
+        deleteNodes(Right);
+
+        Left          = nullptr;
+        Right         = nullptr;
+        Primitives    = Root->PrimitiveStorage;
+        NumPrimitives = numStored;
+    }
+
+    Root->Released     = true;
+    Root->BuildSAHCost = GetSAHCost();
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+size_t BVHNode::GetTreeMemoryUsage() const
+{
+    if (Root == nullptr)
+    {
+        return 0;
+    }
+
+    return nodeMemoryUsage() + sizeof(RootInfo) + (countPrimitives() * sizeof(IHitable*)) +
+        (Root->NumUniquePrimitives * sizeof(IHitable*));
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+size_t BVHNode::nodeMemoryUsage() const
+{
+    const size_t size = sizeof(BVHNode) + ((Motion != nullptr) ? sizeof(MotionBounds) : 0);
+    return IsLeaf() ? size : (size + Left->nodeMemoryUsage() + Right->nodeMemoryUsage());
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+BVHNode::BVHNode(const BuildContext& ctx, int begin, int end, int taskDepth)
+    : Left(nullptr)
+    , Right(nullptr)
+    , Primitives(nullptr)
+    , Root(nullptr)
+    , Motion(nullptr)
+    , NumPrimitives(0)
+    , SplitAxis(0)
+{
+    (*ctx.NumNodes)++;
+    build(ctx, begin, end, taskDepth);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void BVHNode::build(const BuildContext& ctx, int begin, int end, int taskDepth)
+{
+    const BuildPrimitive* prims    = ctx.Prims;
+    const int             numPrims = end - begin;
+
+    // Compute node and centroid bounds
+    BuildBounds bounds, bounds0, bounds1, centroidBounds;
+    bounds.Reset();
+    bounds0.Reset();
+    bounds1.Reset();
+    centroidBounds.Reset();
+    for (int i = begin; i < end; i++)
+    {
+        bounds.Grow(prims[i].Bounds);
+        bounds0.Grow(prims[i].Bounds0);
+        bounds1.Grow(prims[i].Bounds1);
+        centroidBounds.Grow(prims[i].Centroid, prims[i].Centroid);
+    }
+    setBounds(bounds, bounds0, bounds1, ctx.Time0, ctx.Time1);
+
+    if (numPrims <= 1)
+    {
+        makeLeaf(ctx, begin, end);
+        return;
+    }
+
+    const int mid = (ctx.Method == BuildMorton) ? splitMorton(ctx, begin, end) : splitSAH(ctx, begin, end, bounds, centroidBounds);
+    if (mid < 0)
+    {
+        makeLeaf(ctx, begin, end);
+        return;
+    }
+
+    // Big subtrees are built as tasks, the other half stays on this thread
+    if (taskDepth > 0 && numPrims >= ParallelBuildThreshold)
+    {
+        std::future<void> leftTask = std::async(std::launch::async, [this, &ctx, begin, mid, taskDepth]()
+        {
+            Left = new BVHNode(ctx, begin, mid, taskDepth - 1);
+        });
+
+        Right = new BVHNode(ctx, mid, end, taskDepth - 1);
+        leftTask.wait();
+    }
+    else
+    {
+        Left  = new BVHNode(ctx, begin, mid, 0);
+        Right = new BVHNode(ctx, mid, end, 0);
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+BVHNode::BVHNode(const BuildContext& ctx, std::vector<BuildPrimitive>& refs, int taskDepth)
+    : Left(nullptr)
+    , Right(nullptr)
+    , Primitives(nullptr)
+    , Root(nullptr)
+    , Motion(nullptr)
+    , NumPrimitives(0)
+    , SplitAxis(0)
+{
+    (*ctx.NumNodes)++;
+    buildSpatial(ctx, refs, taskDepth);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void BVHNode::buildSpatial(const BuildContext& ctx, std::vector<BuildPrimitive>& refs, int taskDepth)
+{
+    // Each node gets its own references, since splits can clip and duplicate them
+    const int numRefs = int(refs.size());
+
+    BuildBounds bounds, centroidBounds;
+    bounds.Reset();
+    centroidBounds.Reset();
+    for (const BuildPrimitive& ref : refs)
+    {
+        bounds.Grow(ref.Bounds);
+        centroidBounds.Grow(ref.Centroid, ref.Centroid);
+    }
+    setBounds(bounds, bounds, bounds, ctx.Time0, ctx.Time1);
+
+    if (numRefs <= 1)
+    {
+        makeLeaf(ctx, refs);
+        return;
+    }
+
+    const float    parentArea = bounds.SurfaceArea();
+    const float    invArea    = (parentArea > 0.f) ? (1.f / parentArea) : 0.f;
+    SplitCandidate objectSplit, spatialSplit;
+    const bool     hasObjectSplit = findObjectSplit(ctx, refs.data(), 0, numRefs, centroidBounds, invArea, objectSplit);
+
+    // Spatial splits only pay off where the object split leaves the children overlapping
+    bool useSpatialSplit = false;
+    if (ctx.SplitBudget->load() > 0)
+    {
+        const float overlapArea = hasObjectSplit ? objectSplit.LeftBounds.OverlapArea(objectSplit.RightBounds) : parentArea;
+        if (overlapArea > ctx.MinOverlapArea && findSpatialSplit(ctx, refs.data(), numRefs, bounds, invArea, spatialSplit))
+        {
+            useSpatialSplit = !hasObjectSplit || (spatialSplit.Cost < objectSplit.Cost);
+        }
+    }
+
+    // Pick between a leaf and the split
+    std::vector<BuildPrimitive> leftRefs, rightRefs;
+    if (!hasObjectSplit && !useSpatialSplit)
+    {
+        // Centroids all sit on one point, halve the list if it's too big for a leaf
+        if (numRefs <= MaxLeafPrimitives)
+        {
+            makeLeaf(ctx, refs);
+            return;
+        }
+
+        const float extentX = bounds.Max[0] - bounds.Min[0];
+        const float extentY = bounds.Max[1] - bounds.Min[1];
+        const float extentZ = bounds.Max[2] - bounds.Min[2];
+        SplitAxis = (extentX >= extentY && extentX >= extentZ) ? 0 : ((extentY >= extentZ) ? 1 : 2);
+
+        leftRefs.assign(refs.begin(), refs.begin() + (numRefs / 2));
+        rightRefs.assign(refs.begin() + (numRefs / 2), refs.end());
+    }
+    else
+    {
+        const float leafCost = IntersectCost * ctx.NumGroups(numRefs);
+        const float bestCost = useSpatialSplit ? spatialSplit.Cost : objectSplit.Cost;
+        if (numRefs <= MaxLeafPrimitives && leafCost <= bestCost)
+        {
+            makeLeaf(ctx, refs);
+            return;
+        }
+
+        if (useSpatialSplit)
+        {
+            SplitAxis = spatialSplit.Axis;
+            splitReferences(ctx, refs, spatialSplit, leftRefs, rightRefs);
+        }
+        else
+        {
+            SplitAxis = objectSplit.Axis;
+
+            const int   axis   = objectSplit.Axis;
+            const float binMin = centroidBounds.Min[axis];
+            const float scale  = float(NumSAHBins) / (centroidBounds.Max[axis] - binMin);
+            for (const BuildPrimitive& ref : refs)
+            {
+                const bool isLeft = GetMin(int((ref.Centroid[axis] - binMin) * scale), NumSAHBins - 1) <= objectSplit.Bin;
+                (isLeft ? leftRefs : rightRefs).push_back(ref);
+            }
+        }
+    }
+
+    // Unsplitting can empty a side, which makes no progress. Halve the list instead.
+    if (leftRefs.empty() || rightRefs.empty())
+    {
+        std::vector<BuildPrimitive> all;
+        all.swap(leftRefs.empty() ? rightRefs : leftRefs);
+        if (int(all.size()) <= MaxLeafPrimitives)
+        {
+            makeLeaf(ctx, all);
+            return;
+        }
+
+        const size_t half = all.size() / 2;
+        leftRefs.assign(all.begin(), all.begin() + half);
+        rightRefs.assign(all.begin() + half, all.end());
+    }
+
+    // Children copy what they need, free this level before going deeper
+    refs.clear();
+    refs.shrink_to_fit();
+
+    if (taskDepth > 0 && numRefs >= ParallelBuildThreshold)
+    {
+        std::future<void> leftTask = std::async(std::launch::async, [this, &ctx, &leftRefs, taskDepth]()
+        {
+            Left = new BVHNode(ctx, leftRefs, taskDepth - 1);
+        });
+
+        Right = new BVHNode(ctx, rightRefs, taskDepth - 1);
+        leftTask.wait();
+    }
+    else
+    {
+        Left  = new BVHNode(ctx, leftRefs, 0);
+        Right = new BVHNode(ctx, rightRefs, 0);
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+bool BVHNode::findSpatialSplit(const BuildContext& ctx, const BuildPrimitive* refs, int numRefs, const BuildBounds& bounds,
+                               float invArea, SplitCandidate& split)
+{
+    // Bin chopped references between evenly spaced planes. Each one is counted entering its first bin and
+    // leaving its last, so a split's children count the references straddling it on both sides.
+    split.Cost = FLT_MAX;
+    split.Axis = -1;
+    split.Bin  = -1;
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        const float extent = bounds.Max[axis] - bounds.Min[axis];
+        if (extent <= 0.f)
+        {
+            continue;
+        }
+
+        BuildBounds binBounds[NumSpatialBins];
+        int         binEntries[NumSpatialBins];
+        int         binExits[NumSpatialBins];
+        for (int b = 0; b < NumSpatialBins; b++)
+        {
+            binBounds[b].Reset();
+            binEntries[b] = 0;
+            binExits[b]   = 0;
+        }
+
+        const float binWidth = extent / float(NumSpatialBins);
+        const float scale    = float(NumSpatialBins) / extent;
+        for (int i = 0; i < numRefs; i++)
+        {
+            const BuildPrimitive& ref = refs[i];
+            const int firstBin = Clamp(int((ref.Bounds.Min[axis] - bounds.Min[axis]) * scale), 0, NumSpatialBins - 1);
+            const int lastBin  = Clamp(int((ref.Bounds.Max[axis] - bounds.Min[axis]) * scale), firstBin, NumSpatialBins - 1);
+
+            if (firstBin == lastBin)
+            {
+                binBounds[firstBin].Grow(ref.Bounds);
+            }
+            else
+            {
+                for (int b = firstBin; b <= lastBin; b++)
+                {
+                    const float slabMin = bounds.Min[axis] + (float(b) * binWidth);
+                    const float slabMax = (b == NumSpatialBins - 1) ? bounds.Max[axis] : (slabMin + binWidth);
+
+                    BuildPrimitive clipped;
+                    clipReference(ref, axis, slabMin, slabMax, clipped);
+                    binBounds[b].Grow(clipped.Bounds);
+                }
+            }
+
+            binEntries[firstBin]++;
+            binExits[lastBin]++;
+        }
+
+        // Right side bounds and counts, for a split after bin i
+        BuildBounds rightBounds[NumSpatialBins - 1];
+        int         rightCount[NumSpatialBins - 1];
+        BuildBounds accumBounds;
+        int         accumCount = 0;
+        accumBounds.Reset();
+        for (int b = NumSpatialBins - 1; b > 0; b--)
+        {
+            accumBounds.Grow(binBounds[b]);
+            accumCount += binExits[b];
+            rightBounds[b - 1] = accumBounds;
+            rightCount[b - 1]  = accumCount;
+        }
+
+        // Sweep from the left
+        accumBounds.Reset();
+        accumCount = 0;
+        for (int b = 0; b < NumSpatialBins - 1; b++)
+        {
+            accumBounds.Grow(binBounds[b]);
+            accumCount += binEntries[b];
+            if (accumCount == 0 || rightCount[b] == 0)
+            {
+                continue;
+            }
+
+            const float cost = TraversalCost + IntersectCost * invArea *
+                ((ctx.NumGroups(accumCount) * accumBounds.SurfaceArea()) + (ctx.NumGroups(rightCount[b]) * rightBounds[b].SurfaceArea()));
+
+            if (cost < split.Cost)
+            {
+                split.Cost        = cost;
+                split.Axis        = axis;
+                split.Bin         = b;
+                split.Position    = bounds.Min[axis] + (float(b + 1) * binWidth);
+                split.LeftBounds  = accumBounds;
+                split.RightBounds = rightBounds[b];
+                split.LeftCount   = accumCount;
+                split.RightCount  = rightCount[b];
+            }
+        }
+    }
+
+    return (split.Axis >= 0);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void BVHNode::splitReferences(const BuildContext& ctx, const std::vector<BuildPrimitive>& refs, const SplitCandidate& split,
+                              std::vector<BuildPrimitive>& leftRefs, std::vector<BuildPrimitive>& rightRefs)
+{
+    const int   axis        = split.Axis;
+    const float position    = split.Position;
+    BuildBounds leftBounds  = split.LeftBounds;
+    BuildBounds rightBounds = split.RightBounds;
+    int         leftCount   = split.LeftCount;
+    int         rightCount  = split.RightCount;
+
+    for (const BuildPrimitive& ref : refs)
+    {
+        if (ref.Bounds.Max[axis] <= position)
+        {
+            leftRefs.push_back(ref);
+            continue;
+        }
+        else if (ref.Bounds.Min[axis] >= position)
+        {
+            rightRefs.push_back(ref);
+            continue;
+        }
+
+        // Straddles the plane. Keep it whole on one side when that costs no more than duplicating it.
+        BuildBounds leftGrown = leftBounds, rightGrown = rightBounds;
+        leftGrown.Grow(ref.Bounds);
+        rightGrown.Grow(ref.Bounds);
+
+        const float splitCost = (leftBounds.SurfaceArea() * ctx.NumGroups(leftCount)) + (rightBounds.SurfaceArea() * ctx.NumGroups(rightCount));
+        const float leftCost  = (leftGrown.SurfaceArea() * ctx.NumGroups(leftCount)) + (rightBounds.SurfaceArea() * ctx.NumGroups(rightCount - 1));
+        const float rightCost = (leftBounds.SurfaceArea() * ctx.NumGroups(leftCount - 1)) + (rightGrown.SurfaceArea() * ctx.NumGroups(rightCount));
+
+        if (splitCost < GetMin(leftCost, rightCost) && consumeSplitBudget(ctx))
+        {
+            BuildPrimitive clipped;
+            clipReference(ref, axis, -FLT_MAX, position, clipped);
+            if (!clipped.Bounds.IsEmpty())
+            {
+                leftRefs.push_back(clipped);
+            }
+
+            clipReference(ref, axis, position, FLT_MAX, clipped);
+            if (!clipped.Bounds.IsEmpty())
+            {
+                rightRefs.push_back(clipped);
+            }
+        }
+        else if (leftCost <= rightCost)
+        {
+            leftRefs.push_back(ref);
+            leftBounds = leftGrown;
+            rightCount--;
+        }
+        else
+        {
+            rightRefs.push_back(ref);
+            rightBounds = rightGrown;
+            leftCount--;
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+bool BVHNode::consumeSplitBudget(const BuildContext& ctx)
+{
+    if (ctx.SplitBudget->fetch_sub(1) > 0)
+    {
+        return true;
+    }
+
+    (*ctx.SplitBudget)++;
+    return false;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void BVHNode::clipReference(const BuildPrimitive& ref, int axis, float slabMin, float slabMax, BuildPrimitive& clipped)
+{
+    // Never grow past the reference's bounds, earlier splits may have clipped them already
+    clipped = ref;
+    clipped.Bounds.Min[axis] = GetMax(clipped.Bounds.Min[axis], slabMin);
+    clipped.Bounds.Max[axis] = GetMin(clipped.Bounds.Max[axis], slabMax);
+
+    // Hitables that can clip themselves give tighter bounds than the box
+    AABB box;
+    if (ref.Hitable->ClipBoundingBox(axis, slabMin, slabMax, box))
+    {
+        for (int a = 0; a < 3; a++)
+        {
+            clipped.Bounds.Min[a] = GetMax(clipped.Bounds.Min[a], box.Min()[a]);
+            clipped.Bounds.Max[a] = GetMin(clipped.Bounds.Max[a], box.Max()[a]);
+        }
+    }
+
+    for (int a = 0; a < 3; a++)
+    {
+        clipped.Centroid[a] = 0.5f * (clipped.Bounds.Min[a] + clipped.Bounds.Max[a]);
+    }
+    clipped.Bounds0 = clipped.Bounds;
+    clipped.Bounds1 = clipped.Bounds;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+bool BVHNode::findObjectSplit(const BuildContext& ctx, const BuildPrimitive* prims, int begin, int end, const BuildBounds& centroidBounds,
+                              float invArea, SplitCandidate& split)
+{
+    // Bin centroids along each axis and sweep for the cheapest split
+    split.Cost = FLT_MAX;
+    split.Axis = -1;
+    split.Bin  = -1;
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        const float extent = centroidBounds.Max[axis] - centroidBounds.Min[axis];
+        if (extent <= 0.f)
+        {
+            continue;
+        }
+
+        BuildBounds binBounds[NumSAHBins];
+        int         binCounts[NumSAHBins];
+        for (int b = 0; b < NumSAHBins; b++)
+        {
+            binBounds[b].Reset();
+            binCounts[b] = 0;
+        }
+
+        const float scale = float(NumSAHBins) / extent;
+        for (int i = begin; i < end; i++)
+        {
+            const int b = GetMin(int((prims[i].Centroid[axis] - centroidBounds.Min[axis]) * scale), NumSAHBins - 1);
+            binBounds[b].Grow(prims[i].Bounds);
+            binCounts[b]++;
+        }
+
+        // Right side bounds and counts, for a split after bin i
+        BuildBounds rightBounds[NumSAHBins - 1];
+        int         rightCount[NumSAHBins - 1];
+        BuildBounds accumBounds;
+        int         accumCount = 0;
+        accumBounds.Reset();
+        for (int b = NumSAHBins - 1; b > 0; b--)
+        {
+            accumBounds.Grow(binBounds[b]);
+            accumCount += binCounts[b];
+            rightBounds[b - 1] = accumBounds;
+            rightCount[b - 1]  = accumCount;
+        }
+
+        // Sweep from the left
+        accumBounds.Reset();
+        accumCount = 0;
+        for (int b = 0; b < NumSAHBins - 1; b++)
+        {
+            accumBounds.Grow(binBounds[b]);
+            accumCount += binCounts[b];
+            if (accumCount == 0 || rightCount[b] == 0)
+            {
+                continue;
+            }
+
+            const float cost = TraversalCost + IntersectCost * invArea *
+                ((ctx.NumGroups(accumCount) * accumBounds.SurfaceArea()) + (ctx.NumGroups(rightCount[b]) * rightBounds[b].SurfaceArea()));
+
+            if (cost < split.Cost)
+            {
+                split.Cost        = cost;
+                split.Axis        = axis;
+                split.Bin         = b;
+                split.LeftBounds  = accumBounds;
+                split.RightBounds = rightBounds[b];
+                split.LeftCount   = accumCount;
+                split.RightCount  = rightCount[b];
+            }
+        }
+    }
+
+    return (split.Axis >= 0);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+int BVHNode::splitSAH(const BuildContext& ctx, int begin, int end, const BuildBounds& bounds, const BuildBounds& centroidBounds)
+{
+    BuildPrimitive* prims    = ctx.Prims;
+    const int       numPrims = end - begin;
+
+    const float    parentArea = bounds.SurfaceArea();
+    const float    invArea    = (parentArea > 0.f) ? (1.f / parentArea) : 0.f;
+    SplitCandidate split;
+
+    // Pick between a leaf and the split
+    int mid = begin + (numPrims / 2);
+    if (!findObjectSplit(ctx, prims, begin, end, centroidBounds, invArea, split))
+    {
+        const float extentX = bounds.Max[0] - bounds.Min[0];
+        const float extentY = bounds.Max[1] - bounds.Min[1];
+        const float extentZ = bounds.Max[2] - bounds.Min[2];
+        SplitAxis = (extentX >= extentY && extentX >= extentZ) ? 0 : ((extentY >= extentZ) ? 1 : 2);
+
+        // Centroids all sit on one point, there's nothing to bin
+        if (numPrims <= MaxLeafPrimitives)
+        {
+            return -1;
+        }
+    }
+    else
+    {
+        const float leafCost = IntersectCost * ctx.NumGroups(numPrims);
+        if (numPrims <= MaxLeafPrimitives && leafCost <= split.Cost)
+        {
+            return -1;
+        }
+
+        SplitAxis = split.Axis;
+
+        const int   bestAxis = split.Axis;
+        const int   bestBin  = split.Bin;
+        const float binMin   = centroidBounds.Min[bestAxis];
+        const float scale    = float(NumSAHBins) / (centroidBounds.Max[bestAxis] - binMin);
+        BuildPrimitive* midPrim = std::partition(prims + begin, prims + end, [bestAxis, bestBin, binMin, scale](const BuildPrimitive& prim)
+        {
+            return GetMin(int((prim.Centroid[bestAxis] - binMin) * scale), NumSAHBins - 1) <= bestBin;
+        });
+
+        mid = int(midPrim - prims);
+    }
+
+    return mid;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+int BVHNode::splitMorton(const BuildContext& ctx, int begin, int end)
 {
-    AABB boxLeft, boxRight;
-    IHitable* ah = *(IHitable**)a;
-    IHitable* bh = *(IHitable**)b;
+    const BuildPrimitive* prims    = ctx.Prims;
+    const int             numPrims = end - begin;
+    if (numPrims <= MaxLeafPrimitives)
+    {
+        return -1;
+    }
+
+    // Identical codes can't be told apart any further
+    const uint32_t firstCode = prims[begin].MortonCode;
+    const uint32_t lastCode  = prims[end - 1].MortonCode;
+    if (firstCode == lastCode)
+    {
+        return begin + (numPrims / 2);
+    }
 
-    if (!ah->BoundingBox(0, 0, boxLeft) || !bh->BoundingBox(0, 0, boxRight))
+    // Codes are sorted and share every bit above the highest differing one, so split where that bit flips.
+    // Bits are interleaved x, y, z from the top.
+    const int      bit  = int(bit_scan_reverse(firstCode ^ lastCode));
+    const uint32_t mask = 1u << bit;
+    SplitAxis = 2 - (bit % 3);
+
+    const BuildPrimitive* midPrim = std::partition_point(prims + begin, prims + end, [mask](const BuildPrimitive& prim)
     {
-        std::cerr << "No bounding box in bvh_node constructor\n";
-        return 0;
+        return (prim.MortonCode & mask) == 0;
+    });
+
+    return int(midPrim - prims);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void BVHNode::makeLeaf(const BuildContext& ctx, int begin, int end)
+{
+    for (int i = begin; i < end; i++)
+    {
+        ctx.OrderedPrims[i] = ctx.Prims[i].Hitable;
     }
 
-    float val;
-    switch (mode)
+    Primitives    = ctx.OrderedPrims + begin;
+    NumPrimitives = end - begin;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void BVHNode::makeLeaf(const BuildContext& ctx, const std::vector<BuildPrimitive>& refs)
+{
+    // Leaves finish in any order, relayoutLeaf() puts them back in tree order afterwards
+    const int offset = ctx.NumReferences->fetch_add(int(refs.size()));
+    RTL_ASSERT(offset + int(refs.size()) <= ctx.MaxReferences);
+
+    for (size_t i = 0; i < refs.size(); i++)
     {
-    case CompareX:
-        val = boxLeft.Min().X() - boxRight.Min().X();
-        break;
+        ctx.OrderedPrims[offset + i] = refs[i].Hitable;
+    }
 
-    case CompareY:
-        val = boxLeft.Min().Y() - boxRight.Min().Y();
-        break;
+    Primitives    = ctx.OrderedPrims + offset;
+    NumPrimitives = int(refs.size());
+}
 
-    case CompareZ:
-        val = boxLeft.Min().Z() - boxRight.Min().Z();
-        break;
+// ----------------------------------------------------------------------------------------------------------------------------
 
-    default:
-        val = 0;
+void BVHNode::relayoutLeaf(IHitable** storage, int& storageOffset)
+{
+    if (!IsLeaf())
+    {
+        Left->relayoutLeaf(storage, storageOffset);
+        Right->relayoutLeaf(storage, storageOffset);
+        return;
     }
 
-    if (val < 0.f)
+    for (int i = 0; i < NumPrimitives; i++)
     {
-        return -1;
+        storage[storageOffset + i] = Primitives[i];
     }
-    else if (val == 0)
+
+    Primitives     = storage + storageOffset;
+    storageOffset += NumPrimitives;
+}
+
+void BVHNode::setBounds(const BuildBounds& bounds, const BuildBounds& bounds0, const BuildBounds& bounds1, float time0, float time1)
+{
+    // Empty ranges get a degenerate box at the origin
+    bool moving = false;
+    if (bounds.Min[0] > bounds.Max[0])
     {
-        return 0;
+        Box = AABB(Vec4(0, 0, 0), Vec4(0, 0, 0));
     }
     else
     {
-        return 1;
+        Box = AABB(Vec4(bounds.Min[0], bounds.Min[1], bounds.Min[2]), Vec4(bounds.Max[0], bounds.Max[1], bounds.Max[2]));
+        for (int axis = 0; axis < 3; axis++)
+        {
+            moving |= (bounds0.Min[axis] != bounds1.Min[axis]) || (bounds0.Max[axis] != bounds1.Max[axis]);
+        }
+    }
+
+    // Static nodes don't need the end boxes, they're the same as Box
+    if (!moving)
+    {
+        delete Motion;
+        Motion = nullptr;
+        return;
     }
+
+    if (Motion == nullptr)
+    {
+        Motion = new MotionBounds();
+    }
+
+    Motion->Box0  = AABB(Vec4(bounds0.Min[0], bounds0.Min[1], bounds0.Min[2]), Vec4(bounds0.Max[0], bounds0.Max[1], bounds0.Max[2]));
+    Motion->Box1  = AABB(Vec4(bounds1.Min[0], bounds1.Min[1], bounds1.Min[2]), Vec4(bounds1.Max[0], bounds1.Max[1], bounds1.Max[2]));
+    Motion->Time0 = time0;
+    Motion->Time1 = time1;
 }
 
 // ----------------------------------------------------------------------------------------------------------------------------
 
-int BVHNode::boxXCompare(const void* a, const void* b)
+AABB BVHNode::boxAtTime(float time) const
 {
-    return boxCompare(a, b, ECompareMode::CompareX);
+    const float s = (Motion->Time1 > Motion->Time0) ? ((time - Motion->Time0) / (Motion->Time1 - Motion->Time0)) : 0.f;
+
+    return AABB(
+        Motion->Box0.Min() + s * (Motion->Box1.Min() - Motion->Box0.Min()),
+        Motion->Box0.Max() + s * (Motion->Box1.Max() - Motion->Box0.Max()));
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+static inline float surfaceArea(const AABB& box)
+{
+    const Vec4 d = box.Max() - box.Min();
+    return 2.f * ((d.X() * d.Y()) + (d.Y() * d.Z()) + (d.Z() * d.X()));
 }
 
 // ----------------------------------------------------------------------------------------------------------------------------
 
-int BVHNode::boxYCompare(const void* a, const void* b)
+float BVHNode::GetSAHCost() const
 {
-    return boxCompare(a, b, ECompareMode::CompareY);
+    if (IsTreeReleased())
+    {
+        return compiledSAHCost();
+    }
+
+    const float rootArea = surfaceArea(Box);
+    if (rootArea <= 0.f)
+    {
+        return IntersectCost * float(countPrimitives());
+    }
+
+    return sahCost(1.f / rootArea);
 }
 
 // ----------------------------------------------------------------------------------------------------------------------------
 
-int BVHNode::boxZCompare(const void* a, const void* b)
+float BVHNode::sahCost(float invRootArea) const
 {
-    return boxCompare(a, b, ECompareMode::CompareZ);
+    const float relativeArea = surfaceArea(Box) * invRootArea;
+    if (IsLeaf())
+    {
+        return relativeArea * IntersectCost * float(NumPrimitives);
+    }
+
+    return (relativeArea * TraversalCost) + Left->sahCost(invRootArea) + Right->sahCost(invRootArea);
 }
 
 // ----------------------------------------------------------------------------------------------------------------------------
 
-BVHNode::BVHNode(IHitable** list, int n, float time0, float time1)
+float BVHNode::compiledSAHCost() const
 {
-    // Randomly choose an axis to split on
-    int axis = int(3 * RandomFloat());
-    if (axis == 0)
+    if (Root->Wide8 != nullptr)
     {
-        qsort(list, n, sizeof(IHitable*), BVHNode::boxXCompare);
+        return Root->Wide8->GetSAHCost();
     }
-    else if (axis == 1)
+    else if (Root->Wide4 != nullptr)
     {
-        qsort(list, n, sizeof(IHitable*), BVHNode::boxYCompare);
+        return Root->Wide4->GetSAHCost();
     }
-    else
+
+    return Root->Flat->GetSAHCost();
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+int BVHNode::countPrimitives() const
+{
+    return IsLeaf() ? NumPrimitives : (Left->countPrimitives() + Right->countPrimitives());
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void BVHNode::Refit(float time0, float time1)
+{
+    if (Root == nullptr)
+    {
+        return;
+    }
+
+    refit(time0, time1);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+bool BVHNode::RefitOrRebuild(float time0, float time1, float threshold)
+{
+    if (Root == nullptr)
+    {
+        return false;
+    }
+
+    refit(time0, time1);
+
+    const float cost = GetSAHCost();
+    if (cost > Root->BuildSAHCost * threshold)
+    {
+        DEBUG_PRINTF("BVHNode: SAH cost went from %.2f to %.2f, rebuilding\n", Root->BuildSAHCost, cost);
+        rebuild(time0, time1);
+        return true;
+    }
+
+    return false;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void BVHNode::refit(float time0, float time1)
+{
+    // Packed leaves and the like hold copies of the geometry, bring those up to date before taking bounds
+    const int numStored = countPrimitives();
+    for (int i = 0; i < numStored; i++)
+    {
+        Root->PrimitiveStorage[i]->Refresh();
+    }
+
+    Root->Time0 = time0;
+    Root->Time1 = time1;
+
+    BuildBounds bounds, bounds0, bounds1;
+    if (!Root->Released)
+    {
+        refitNode(time0, time1, bounds, bounds0, bounds1);
+    }
+
+    // The compiled copy keeps its layout and only has its bounds rewritten
+    if (Root->Wide8 != nullptr)
+    {
+        Root->Wide8->Refit(time0, time1);
+        Root->Wide8->GetBounds(bounds0, bounds1);
+    }
+    else if (Root->Wide4 != nullptr)
+    {
+        Root->Wide4->Refit(time0, time1);
+        Root->Wide4->GetBounds(bounds0, bounds1);
+    }
+    else if (Root->Flat != nullptr)
+    {
+        Root->Flat->Refit(time0, time1);
+        Root->Flat->GetBounds(bounds0, bounds1);
+    }
+
+    // Without its tree, the root takes its box from the compiled copy's
+    if (Root->Released)
     {
-        qsort(list, n, sizeof(IHitable*), BVHNode::boxZCompare);
+        bounds = bounds0;
+        bounds.Grow(bounds1);
+        setBounds(bounds, bounds0, bounds1, time0, time1);
     }
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void BVHNode::GetPrimitiveBounds(IHitable* const* primitives, int n, float time0, float time1,
+                                 BuildBounds& bounds, BuildBounds& bounds0, BuildBounds& bounds1)
+{
+    bounds.Reset();
+    bounds0.Reset();
+    bounds1.Reset();
 
-    // Construct children nodes
-    if (n == 1)
+    for (int i = 0; i < n; i++)
     {
-        // For one object, just dupe to left and right
-        Left = Right = list[0];
+        BuildPrimitive prim;
+        gatherBounds(primitives[i], time0, time1, prim);
+        bounds.Grow(prim.Bounds);
+        bounds0.Grow(prim.Bounds0);
+        bounds1.Grow(prim.Bounds1);
     }
-    else if (n == 2)
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void BVHNode::refitNode(float time0, float time1, BuildBounds& bounds, BuildBounds& bounds0, BuildBounds& bounds1)
+{
+    bounds.Reset();
+    bounds0.Reset();
+    bounds1.Reset();
+
+    if (IsLeaf())
     {
-        Left = list[0];
-        Right = list[1];
+        GetPrimitiveBounds(Primitives, NumPrimitives, time0, time1, bounds, bounds0, bounds1);
     }
     else
     {
-        int halfN = n / 2;
-        Left = new BVHNode(list, halfN, time0, time1);
-        Right = new BVHNode(list + halfN, n - halfN, time0, time1);
+        BuildBounds childBounds, childBounds0, childBounds1;
+        Left->refitNode(time0, time1, childBounds, childBounds0, childBounds1);
+        bounds.Grow(childBounds);
+        bounds0.Grow(childBounds0);
+        bounds1.Grow(childBounds1);
+
+        Right->refitNode(time0, time1, childBounds, childBounds0, childBounds1);
+        bounds.Grow(childBounds);
+        bounds0.Grow(childBounds0);
+        bounds1.Grow(childBounds1);
     }
 
-    // Compute bounding box
-    AABB boxLeft, boxRight;
-    if (!Left->BoundingBox(time0, time1, boxLeft) || !Right->BoundingBox(time0, time1, boxRight))
+    setBounds(bounds, bounds0, bounds1, time0, time1);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void BVHNode::rebuild(float time0, float time1)
+{
+    // Take the primitives back out of the tree, without the leaves deleting them. With duplicates in the
+    // leaves, the root's list has each one once. Packed leaves go back to the primitives they were packed
+    // from, so the new tree can split those as finely as the first one did.
+    std::vector<IHitable*> list;
+    if (HasDuplicates())
     {
-        std::cerr << "No bounding box in bvh_node constructor\n";
+        list.assign(Root->UniquePrimitives, Root->UniquePrimitives + Root->NumUniquePrimitives);
+    }
+    else
+    {
+        const int numStored = countPrimitives();
+        for (int i = 0; i < numStored; i++)
+        {
+            if (Root->Unpacker)
+            {
+                Root->Unpacker(Root->PrimitiveStorage[i], list);
+                delete Root->PrimitiveStorage[i];
+            }
+            else
+            {
+                list.push_back(Root->PrimitiveStorage[i]);
+            }
+        }
+
+        // Spatial splits can have packed the same original into several leaves
+        if (Root->Unpacker && Root->Method == BuildSpatialSAH)
+        {
+            std::unordered_set<IHitable*> seen;
+            list.erase(std::remove_if(list.begin(), list.end(), [&seen](IHitable* hitable) { return !seen.insert(hitable).second; }), list.end());
+        }
+    }
+
+    if (!IsLeaf())
+    {
+        deleteNodes(Left);
+        deleteNodes(Right);
+    }
+
+    delete[] Root->PrimitiveStorage;
+    delete[] Root->UniquePrimitives;
+    releaseCompiled();
+
+    // A released tree is released again once it's compiled
+    const bool released = Root->Released;
+
+    Left                      = nullptr;
+    Right                     = nullptr;
+    Primitives                = nullptr;
+    NumPrimitives             = 0;
+    SplitAxis                 = 0;
+    Root->PrimitiveStorage    = nullptr;
+    Root->UniquePrimitives    = nullptr;
+    Root->NumUniquePrimitives = 0;
+    Root->Released            = false;
+
+    buildRoot(list.data(), int(list.size()), time0, time1, Root->GroupSize, Root->Method, Root->CurrentLayout);
+    if (Root->Packer)
+    {
+        const LeafPacker   pack   = Root->Packer;
+        const LeafUnpacker unpack = Root->Unpacker;
+        PackLeaves(pack, unpack);
+    }
+
+    if (released)
+    {
+        ReleaseTree();
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void BVHNode::PackLeaves(const LeafPacker& pack, const LeafUnpacker& unpack)
+{
+    // Packing goes leaf by leaf, so it needs the tree
+    if (Root == nullptr || Root->Released)
+    {
+        return;
+    }
+
+    // Packed leaves are written back to the front of the storage, so it stays contiguous in tree order
+    int storageOffset = 0;
+    packLeaf(pack, Root->PrimitiveStorage, storageOffset);
+    Root->Packer   = pack;
+    Root->Unpacker = unpack;
+
+    // Each leaf owns its packed hitable, so the list of duplicated originals goes too
+    delete[] Root->UniquePrimitives;
+    Root->UniquePrimitives    = nullptr;
+    Root->NumUniquePrimitives = 0;
+
+    SetLayout(Root->CurrentLayout);
+    Root->BuildSAHCost = GetSAHCost();
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void BVHNode::packLeaf(const LeafPacker& pack, IHitable** storage, int& storageOffset)
+{
+    if (!IsLeaf())
+    {
+        Left->packLeaf(pack, storage, storageOffset);
+        Right->packLeaf(pack, storage, storageOffset);
+        return;
+    }
+
+    if (NumPrimitives == 0)
+    {
+        return;
+    }
+
+    IHitable* packed = pack(Primitives, NumPrimitives);
+
+    Primitives    = storage + storageOffset;
+    Primitives[0] = packed;
+    NumPrimitives = 1;
+    storageOffset++;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void BVHNode::deleteNodes(BVHNode* node)
+{
+    if (node->IsLeaf())
+    {
+        node->NumPrimitives = 0;
+    }
+    else
+    {
+        deleteNodes(node->Left);
+        deleteNodes(node->Right);
+        node->Left  = nullptr;
+        node->Right = nullptr;
     }
-    Box = AABB::SurroundingBox(boxLeft, boxRight);
+
+    delete node;
 }
 
 // ----------------------------------------------------------------------------------------------------------------------------
 
 BVHNode::~BVHNode()
 {
-    if (Left != nullptr)
+    if (HasDuplicates())
+    {
+        // Leaves share primitives, delete them once from the root's list
+        for (int i = 0; i < Root->NumUniquePrimitives; i++)
+        {
+            delete Root->UniquePrimitives[i];
+        }
+
+        if (!IsLeaf())
+        {
+            deleteNodes(Left);
+            deleteNodes(Right);
+            Left  = nullptr;
+            Right = nullptr;
+        }
+    }
+    else if (IsLeaf())
+    {
+        // Leaves own their primitives
+        for (int i = 0; i < NumPrimitives; i++)
+        {
+            delete Primitives[i];
+            Primitives[i] = nullptr;
+        }
+    }
+    else
     {
         delete Left;
+        delete Right;
     }
 
-    if (Right != nullptr && Right != Left)
+    if (Root != nullptr)
     {
-        delete Right;
+        delete[] Root->PrimitiveStorage;
+        delete[] Root->UniquePrimitives;
+        releaseCompiled();
+        delete Root;
     }
+    delete Motion;
 
-    Left  = nullptr;
-    Right = nullptr;
+    Left       = nullptr;
+    Right      = nullptr;
+    Primitives = nullptr;
+    Root       = nullptr;
+    Motion     = nullptr;
 }
 
 // ----------------------------------------------------------------------------------------------------------------------------
 
 bool BVHNode::BoundingBox(float t0, float t1, AABB& box) const
 {
-    box = Box;
+    box = (Motion != nullptr) ? AABB::SurroundingBox(boxAtTime(t0), boxAtTime(t1)) : Box;
     return true;
 }
 
@@ -165,37 +1719,138 @@ bool BVHNode::BoundingBox(float t0, float t1, AABB& box) const
 
 bool BVHNode::Hit(const Ray& ray, float tMin, float tMax, HitRecord& rec) const
 {
-    if (Box.Hit(ray, tMin, tMax))
+    if (Root != nullptr)
     {
-        HitRecord leftRec, rightRec;
-
-        bool hitLeft = Left->Hit(ray, tMin, tMax, leftRec);
-        bool hitRight = Right->Hit(ray, tMin, tMax, rightRec);
+        if (Root->Wide8 != nullptr)
+        {
+            return Root->Wide8->Hit(ray, tMin, tMax, rec);
+        }
+        else if (Root->Wide4 != nullptr)
+        {
+            return Root->Wide4->Hit(ray, tMin, tMax, rec);
+        }
+        else if (Root->Flat != nullptr)
+        {
+            return Root->Flat->Hit(ray, tMin, tMax, rec);
+        }
+    }
 
-        if (hitLeft && hitRight)
+    if (((Motion != nullptr) ? boxAtTime(ray.Time()) : Box).Hit(ray, tMin, tMax))
+    {
+        if (Left == nullptr)
         {
-            if (leftRec.T < rightRec.T)
-            {
-                rec = leftRec;
-            }
-            else
+            // Closest hit among the leaf primitives
+            HitRecord tempRec;
+            bool      hitAnything  = false;
+            float     closestSoFar = tMax;
+            for (int i = 0; i < NumPrimitives; i++)
             {
-                rec = rightRec;
+                if (Primitives[i]->Hit(ray, tMin, closestSoFar, tempRec))
+                {
+                    hitAnything  = true;
+                    closestSoFar = tempRec.T;
+                    rec          = tempRec;
+                }
             }
 
-            return true;
+            return hitAnything;
+        }
+
+        // Near child first, then the far child only has to beat whatever the near one hit
+        const bool      farIsLeft = ray.InverseDirectionArray()[SplitAxis] < 0.f;
+        const BVHNode*  nearNode  = farIsLeft ? Right : Left;
+        const BVHNode*  farNode   = farIsLeft ? Left : Right;
+
+        HitRecord  farRec;
+        const bool hitNear = nearNode->Hit(ray, tMin, tMax, rec);
+        const bool hitFar  = farNode->Hit(ray, tMin, hitNear ? rec.T : tMax, farRec);
+        if (hitFar)
+        {
+            rec = farRec;
+        }
+
+        return (hitNear || hitFar);
+    }
+
+    return false;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+bool BVHNode::Occluded(const Ray& ray, float tMin, float tMax) const
+{
+    if (Root != nullptr)
+    {
+        if (Root->Wide8 != nullptr)
+        {
+            return Root->Wide8->Occluded(ray, tMin, tMax);
         }
-        else if (hitLeft)
+        else if (Root->Wide4 != nullptr)
         {
-            rec = leftRec;
-            return true;
+            return Root->Wide4->Occluded(ray, tMin, tMax);
         }
-        else if (hitRight)
+        else if (Root->Flat != nullptr)
         {
-            rec = rightRec;
-            return true;
+            return Root->Flat->Occluded(ray, tMin, tMax);
         }
     }
 
-    return false;
+    if (!((Motion != nullptr) ? boxAtTime(ray.Time()) : Box).Hit(ray, tMin, tMax))
+    {
+        return false;
+    }
+
+    if (Left == nullptr)
+    {
+        for (int i = 0; i < NumPrimitives; i++)
+        {
+            if (Primitives[i]->Occluded(ray, tMin, tMax))
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    // Any hit will do, so there's no point ordering the children
+    return Left->Occluded(ray, tMin, tMax) || Right->Occluded(ray, tMin, tMax);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void BVHNode::HitPacket(const Ray* rays, int numRays, float tMin, float* tMax, HitRecord* recs, bool* hits) const
+{
+    // Only the wide layouts trace packets, everything else goes ray by ray
+    if (Root != nullptr && Root->Wide8 != nullptr)
+    {
+        Root->Wide8->HitPacket(rays, numRays, tMin, tMax, recs, hits);
+    }
+    else if (Root != nullptr && Root->Wide4 != nullptr)
+    {
+        Root->Wide4->HitPacket(rays, numRays, tMin, tMax, recs, hits);
+    }
+    else
+    {
+        IHitable::HitPacket(rays, numRays, tMin, tMax, recs, hits);
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void BVHNode::HitStream(const Ray* rays, int numRays, float tMin, float* tMax, HitRecord* recs, bool* hits) const
+{
+    // Only the wide layouts interleave rays, everything else goes ray by ray
+    if (Root != nullptr && Root->Wide8 != nullptr)
+    {
+        Root->Wide8->HitStream(rays, numRays, tMin, tMax, recs, hits);
+    }
+    else if (Root != nullptr && Root->Wide4 != nullptr)
+    {
+        Root->Wide4->HitStream(rays, numRays, tMin, tMax, recs, hits);
+    }
+    else
+    {
+        IHitable::HitStream(rays, numRays, tMin, tMax, recs, hits);
+    }
 }
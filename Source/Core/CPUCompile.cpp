@@ -17,6 +17,7 @@
 // 
 // ----------------------------------------------------------------------------------------------------------------------------
 
+#include "BVHAnalyzer.hpp"
 #include "BVHNode.hpp"
 #include "Camera.hpp"
 #include "ConstantMedium.hpp"
@@ -27,12 +28,19 @@
 #include "HitableList.hpp"
 #include "HitableTransform.hpp"
 #include "ImageIO.hpp"
+#include "LeafPrimitives.hpp"
+#include "LinearBVH.hpp"
 #include "Material.hpp"
 #include "MovingSphere.hpp"
 #include "Perlin.hpp"
 #include "Raytracer.hpp"
 #include "SampleScenes.hpp"
+#include "SceneFlattener.hpp"
 #include "Sphere.hpp"
+#include "ThreadPool.hpp"
+#include "TileScheduler.hpp"
+#include "TriangleBlock.hpp"
 #include "TriMesh.hpp"
 #include "Util.hpp"
+#include "WideBVH.hpp"
 #include "XYZRect.hpp"
\ No newline at end of file
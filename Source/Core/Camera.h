@@ -44,9 +44,9 @@ namespace Core
 
         inline Ray GetRay(float s, float t) const
         {
-            Vec4  rd = LensRadius * RandomInUnitDisk();
+            Vec4  rd = LensRadius * SampleInUnitDisk();
             Vec4  offset = U * rd.X() + V * rd.Y();
-            float time = Time0 + RandomFloat() * (Time1 - Time0);
+            float time = Time0 + SampleFloat() * (Time1 - Time0);
 
             return Ray(Origin + offset, LowerLeftCorner + (s * Horizontal) + (t * Vertical) - Origin - offset, time);
         }
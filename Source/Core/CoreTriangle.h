@@ -43,10 +43,19 @@ namespace Core
 
         Triangle(const Vertex& v0, const Vertex& v1, const Vertex& v2, Material* Mat);
 
+        // Moves the triangle. Anything built over it, such as a BVH, needs refitting afterwards.
+        void         SetVertices(const Vertex& v0, const Vertex& v1, const Vertex& v2);
+
         virtual bool BoundingBox(float t0, float t1, AABB& box) const;
+        virtual bool ClipBoundingBox(int axis, float slabMin, float slabMax, AABB& box) const;
         virtual bool Hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const;
+        virtual bool Occluded(const Ray& r, float tMin, float tMax) const;
+
+        const Vertex*     GetVertices() const { return Vertices; }
+        virtual Material* GetMaterial() override { return MatPtr; }
 
-        const Vertex* GetVertices() const { return Vertices; }
+        // Interpolates the vertex attributes for a hit found at t with barycentrics u, v
+        void          FillHitRecord(const Ray& r, float t, float u, float v, HitRecord& rec) const;
 
     private:
 
@@ -58,6 +67,10 @@ namespace Core
             Vec3f  UV;
         };
 
+    private:
+
+        bool        intersect(const Ray& r, float tMin, float tMax, float& t, float& u, float& v) const;
+
     private:
 
         Vertex      Vertices[3];
@@ -24,6 +24,14 @@ using namespace Core;
 // ----------------------------------------------------------------------------------------------------------------------------
 
 Triangle::Triangle(const Vertex& v0, const Vertex& v1, const Vertex& v2, Material* Mat)
+{
+    SetVertices(v0, v1, v2);
+    MatPtr = Mat;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void Triangle::SetVertices(const Vertex& v0, const Vertex& v1, const Vertex& v2)
 {
     Vertex temp[3] =
     {
@@ -39,8 +47,6 @@ Triangle::Triangle(const Vertex& v0, const Vertex& v1, const Vertex& v2, Materia
         FastVertices[i].Color  = Vec3f(temp[i].Color[0],  temp[i].Color[1],  temp[i].Color[2]);
         FastVertices[i].UV     = Vec3f(temp[i].UV[0],     temp[i].UV[1],     1.f);
     }
-    
-    MatPtr = Mat;
 }
 
 // ----------------------------------------------------------------------------------------------------------------------------
@@ -66,7 +72,58 @@ bool Triangle::BoundingBox(float t0, float t1, AABB& box) const
 
 // ----------------------------------------------------------------------------------------------------------------------------
 
-bool Triangle::Hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const
+bool Triangle::ClipBoundingBox(int axis, float slabMin, float slabMax, AABB& box) const
+{
+    // Walk the edges, keeping the vertices inside the slab and the points where edges cross its planes
+    Vec4 vMin(FLT_MAX, FLT_MAX, FLT_MAX);
+    Vec4 vMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    bool clipped = false;
+
+    const float planes[2] = { slabMin, slabMax };
+    for (int i = 0; i < 3; i++)
+    {
+        const Vec3f& a = FastVertices[i].Vert;
+        const Vec3f& b = FastVertices[(i + 1) % 3].Vert;
+
+        if (a[axis] >= slabMin && a[axis] <= slabMax)
+        {
+            for (int j = 0; j < 3; j++)
+            {
+                vMin[j] = GetMin<float>(vMin[j], a[j]);
+                vMax[j] = GetMax<float>(vMax[j], a[j]);
+            }
+            clipped = true;
+        }
+
+        for (int p = 0; p < 2; p++)
+        {
+            if ((a[axis] < planes[p]) == (b[axis] < planes[p]))
+            {
+                continue;
+            }
+
+            const float s = (planes[p] - a[axis]) / (b[axis] - a[axis]);
+            for (int j = 0; j < 3; j++)
+            {
+                const float x = (j == axis) ? planes[p] : (a[j] + s * (b[j] - a[j]));
+                vMin[j] = GetMin<float>(vMin[j], x);
+                vMax[j] = GetMax<float>(vMax[j], x);
+            }
+            clipped = true;
+        }
+    }
+
+    if (clipped)
+    {
+        box = AABB(vMin, vMax);
+    }
+
+    return clipped;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+bool Triangle::intersect(const Ray& r, float tMin, float tMax, float& t, float& u, float& v) const
 {
     const float EPSILON = 0.0000001f;
 
@@ -79,7 +136,7 @@ bool Triangle::Hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const
 
     Vec3f edge1, edge2, h, s, q;
 
-    float a, f, u, v;
+    float a, f;
 
     edge1 = vertex1 - vertex0;
     edge2 = vertex2 - vertex0;
@@ -107,23 +164,9 @@ bool Triangle::Hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const
     }
 
     // At this stage we can compute t to find out where the intersection point is on the line
-    float t = f * dot_product(edge2, q);
+    t = f * dot_product(edge2, q);
     if (t > EPSILON && t > tMin && t < tMax)
     {
-        const float w       = (1 - u - v);
-        Vec3f       texUv   = w * FastVertices[0].UV     + u * FastVertices[1].UV     + v * FastVertices[2].UV;
-        Vec3f       normal  = w * FastVertices[0].Normal + u * FastVertices[1].Normal + v * FastVertices[2].Normal;
-
-        Vec4 slowNormal;
-        normal.store(&slowNormal[0]);
-
-        // Ray intersection
-        rec.U       = texUv[0];
-        rec.V       = texUv[1];
-        rec.T       = t;
-        rec.MatPtr  = MatPtr;
-        rec.P       = r.PointAtParameter(t);
-        rec.Normal  = slowNormal;
         return true;
     }
     else
@@ -132,3 +175,45 @@ bool Triangle::Hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const
         return false;
     }
 }
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+bool Triangle::Hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const
+{
+    float t, u, v;
+    if (intersect(r, tMin, tMax, t, u, v))
+    {
+        FillHitRecord(r, t, u, v, rec);
+        return true;
+    }
+
+    return false;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+bool Triangle::Occluded(const Ray& r, float tMin, float tMax) const
+{
+    float t, u, v;
+    return intersect(r, tMin, tMax, t, u, v);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void Triangle::FillHitRecord(const Ray& r, float t, float u, float v, HitRecord& rec) const
+{
+    const float w       = (1 - u - v);
+    Vec3f       texUv   = w * FastVertices[0].UV     + u * FastVertices[1].UV     + v * FastVertices[2].UV;
+    Vec3f       normal  = w * FastVertices[0].Normal + u * FastVertices[1].Normal + v * FastVertices[2].Normal;
+
+    Vec4 slowNormal;
+    normal.store(&slowNormal[0]);
+
+    // Ray intersection
+    rec.U       = texUv[0];
+    rec.V       = texUv[1];
+    rec.T       = t;
+    rec.MatPtr  = MatPtr;
+    rec.P       = r.PointAtParameter(t);
+    rec.Normal  = slowNormal;
+}
@@ -35,6 +35,7 @@ namespace Core
 
         virtual bool Hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const;
         virtual bool BoundingBox(float t0, float t1, AABB& box) const;
+        virtual bool Occluded(const Ray& r, float tMin, float tMax) const;
 
         IHitable* GetHitObject() { return Hitable; }
     private:
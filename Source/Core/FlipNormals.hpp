@@ -53,3 +53,10 @@ bool FlipNormals::BoundingBox(float t0, float t1, AABB& box) const
 {
     return Hitable->BoundingBox(t0, t1, box);
 }
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+bool FlipNormals::Occluded(const Ray& r, float tMin, float tMax) const
+{
+    return Hitable->Occluded(r, tMin, tMax);
+}
@@ -37,6 +37,7 @@ namespace Core
 
         virtual bool BoundingBox(float t0, float t1, AABB& box) const;
         virtual bool Hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const;
+        virtual bool Occluded(const Ray& r, float tMin, float tMax) const;
 
         inline void  GetPoints(Vec4& minP, Vec4& maxP) const
         {
@@ -78,3 +78,10 @@ bool HitableBox::Hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const
 {
     return HitList->Hit(r, tMin, tMax, rec);
 }
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+bool HitableBox::Occluded(const Ray& r, float tMin, float tMax) const
+{
+    return HitList->Occluded(r, tMin, tMax);
+}
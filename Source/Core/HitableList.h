@@ -34,6 +34,9 @@ namespace Core
 
         virtual bool      Hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const;
         virtual bool      BoundingBox(float t0, float t1, AABB& box) const;
+        virtual bool      Occluded(const Ray& r, float tMin, float tMax) const;
+        virtual void      HitPacket(const Ray* rays, int numRays, float tMin, float* tMax, HitRecord* recs, bool* hits) const;
+        virtual void      HitStream(const Ray* rays, int numRays, float tMin, float* tMax, HitRecord* recs, bool* hits) const;
         virtual float     PdfValue(const Vec4& origin, const Vec4& v) const;
         virtual Vec4      Random(const Vec4& origin) const;
 
@@ -60,6 +60,42 @@ bool HitableList::Hit(const Ray& r, float tMin, float tMax, HitRecord& rec) cons
 
 // ----------------------------------------------------------------------------------------------------------------------------
 
+bool HitableList::Occluded(const Ray& r, float tMin, float tMax) const
+{
+    for (int i = 0; i < ListSize; i++)
+    {
+        if (List[i]->Occluded(r, tMin, tMax))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void HitableList::HitPacket(const Ray* rays, int numRays, float tMin, float* tMax, HitRecord* recs, bool* hits) const
+{
+    // Every hitable gets the whole batch, so packet aware ones can share the work
+    for (int i = 0; i < ListSize; i++)
+    {
+        List[i]->HitPacket(rays, numRays, tMin, tMax, recs, hits);
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void HitableList::HitStream(const Ray* rays, int numRays, float tMin, float* tMax, HitRecord* recs, bool* hits) const
+{
+    for (int i = 0; i < ListSize; i++)
+    {
+        List[i]->HitStream(rays, numRays, tMin, tMax, recs, hits);
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
 bool HitableList::BoundingBox(float t0, float t1, AABB& box) const
 {
     if (ListSize < 1)
@@ -83,7 +119,7 @@ bool HitableList::BoundingBox(float t0, float t1, AABB& box) const
     // Try adding additional hitable bounding boxes
     for (int i = 1; i < ListSize; i++)
     {
-        if (List[0]->BoundingBox(t0, t1, tempBox))
+        if (List[i]->BoundingBox(t0, t1, tempBox))
         {
             retBox = AABB::SurroundingBox(retBox, tempBox);
         }
@@ -113,6 +149,6 @@ float HitableList::PdfValue(const Vec4& origin, const Vec4& v) const
 
 Vec4 HitableList::Random(const Vec4& origin) const
 {
-    int index = rand() % ListSize;
+    int index = GetMin(int(SampleFloat() * ListSize), ListSize - 1);
     return List[index]->Random(origin);
 }
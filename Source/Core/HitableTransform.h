@@ -23,6 +23,8 @@
 #include "Ray.h"
 #include "AABB.h"
 #include "Util.h"
+#include "AffineTransform.h"
+#include <memory>
 
 namespace Core
 {
@@ -37,6 +39,7 @@ namespace Core
 
         virtual bool        Hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const;
         virtual bool        BoundingBox(float t0, float t1, AABB& box) const;
+        virtual bool        Occluded(const Ray& r, float tMin, float tMax) const;
         inline IHitable*    GetHitObject() { return HitObject; }
         inline const Vec4&  GetOffset() const { return Offset; }
 
@@ -57,9 +60,14 @@ namespace Core
 
         virtual bool           Hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const;
         virtual bool           BoundingBox(float t0, float t1, AABB& box) const;
+        virtual bool           Occluded(const Ray& r, float tMin, float tMax) const;
         inline float           GetAngleDegrees() const { return AngleDegrees; }
         inline IHitable*       GetHitObject() { return HitObject; }
 
+    private:
+
+        Ray       rotateRay(const Ray& r) const;
+
     private:
 
         IHitable* HitObject;
@@ -70,4 +78,27 @@ namespace Core
         AABB      Bbox;
     };
 
+    // ----------------------------------------------------------------------------------------------------------------------------
+
+    // Places a shared bottom level hitable (usually a TriMesh and its BVH) in the world with a full affine transform.
+    // Any number of instances can point at the same hitable, and put in a BVHNode they form the top level.
+    class HitableInstance : public IHitable
+    {
+    public:
+
+        HitableInstance(std::shared_ptr<IHitable> blas, const AffineTransform& objectToWorld);
+        virtual ~HitableInstance();
+
+        virtual bool                     Hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const;
+        virtual bool                     BoundingBox(float t0, float t1, AABB& box) const;
+        virtual bool                     Occluded(const Ray& r, float tMin, float tMax) const;
+        inline IHitable*                 GetHitObject() { return BLAS.get(); }
+        inline const AffineTransform&    GetObjectToWorld() const { return ObjectToWorld; }
+
+    private:
+
+        std::shared_ptr<IHitable>  BLAS;
+        AffineTransform            ObjectToWorld;
+        AffineTransform            WorldToObject;
+    };
 }
\ No newline at end of file
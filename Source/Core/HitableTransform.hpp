@@ -48,6 +48,13 @@ bool HitableTranslate::Hit(const Ray& r, float tMin, float tMax, HitRecord& rec)
 
 // ----------------------------------------------------------------------------------------------------------------------------
 
+bool HitableTranslate::Occluded(const Ray& r, float tMin, float tMax) const
+{
+    return HitObject->Occluded(Ray(r.Origin() - Offset, r.Direction(), r.Time()), tMin, tMax);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
 bool HitableTranslate::BoundingBox(float t0, float t1, AABB& box) const
 {
     if (HitObject->BoundingBox(t0, t1, box))
@@ -114,7 +121,7 @@ HitableRotateY::~HitableRotateY()
 
 // ----------------------------------------------------------------------------------------------------------------------------
 
-bool HitableRotateY::Hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const
+Ray HitableRotateY::rotateRay(const Ray& r) const
 {
     Vec4 origin = r.Origin();
     Vec4 direction = r.Direction();
@@ -125,7 +132,14 @@ bool HitableRotateY::Hit(const Ray& r, float tMin, float tMax, HitRecord& rec) c
     direction[0] = CosTheta * r.Direction()[0] - SinTheta * r.Direction()[2];
     direction[2] = SinTheta * r.Direction()[0] + CosTheta * r.Direction()[2];
 
-    Ray rotatedR(origin, direction, r.Time());
+    return Ray(origin, direction, r.Time());
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+bool HitableRotateY::Hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const
+{
+    Ray rotatedR = rotateRay(r);
     if (HitObject->Hit(rotatedR, tMin, tMax, rec))
     {
         Vec4 p = rec.P;
@@ -148,8 +162,69 @@ bool HitableRotateY::Hit(const Ray& r, float tMin, float tMax, HitRecord& rec) c
 
 // ----------------------------------------------------------------------------------------------------------------------------
 
+bool HitableRotateY::Occluded(const Ray& r, float tMin, float tMax) const
+{
+    return HitObject->Occluded(rotateRay(r), tMin, tMax);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
 bool HitableRotateY::BoundingBox(float t0, float t1, AABB& box) const
 {
     box = Bbox;
     return HasBox;
 }
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+HitableInstance::HitableInstance(std::shared_ptr<IHitable> blas, const AffineTransform& objectToWorld)
+    : BLAS(blas)
+    , ObjectToWorld(objectToWorld)
+    , WorldToObject(objectToWorld.Inverse())
+{
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+HitableInstance::~HitableInstance()
+{
+    // The last instance out frees the shared hitable
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+bool HitableInstance::Hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const
+{
+    // One transform into object space, the direction isn't renormalized so hit distances carry over as is
+    Ray objectRay(WorldToObject.TransformPoint(r.Origin()), WorldToObject.TransformVector(r.Direction()), r.Time());
+    if (BLAS->Hit(objectRay, tMin, tMax, rec))
+    {
+        rec.P      = ObjectToWorld.TransformPoint(rec.P);
+        rec.Normal = UnitVector(WorldToObject.TransformVectorTransposed(rec.Normal));
+        return true;
+    }
+
+    return false;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+bool HitableInstance::Occluded(const Ray& r, float tMin, float tMax) const
+{
+    Ray objectRay(WorldToObject.TransformPoint(r.Origin()), WorldToObject.TransformVector(r.Direction()), r.Time());
+    return BLAS->Occluded(objectRay, tMin, tMax);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+bool HitableInstance::BoundingBox(float t0, float t1, AABB& box) const
+{
+    AABB objectBox;
+    if (BLAS->BoundingBox(t0, t1, objectBox))
+    {
+        box = ObjectToWorld.TransformBox(objectBox);
+        return true;
+    }
+
+    return false;
+}
@@ -55,6 +55,54 @@ namespace Core
         virtual bool        IsALightShape() const { return IsLightShape; }
         virtual Material*   GetMaterial() { return nullptr; }
 
+        // Bounds of just the part of the hitable between slabMin and slabMax along axis, for BVH builds that split
+        // primitives. Returns false if the hitable can do no better than clipping its bounding box.
+        virtual bool        ClipBoundingBox(int /*axis*/, float /*slabMin*/, float /*slabMax*/, AABB& /*box*/) const { return false; }
+
+        // Rereads whatever the hitable copied from geometry it doesn't own, after that geometry has moved. BVH refits
+        // call it on their primitives before asking for new bounds.
+        virtual void        Refresh() {}
+
+        // Any hit in (tMin, tMax), for visibility queries that don't care which one or where. Hitables override this
+        // to stop at the first hit and skip the hit attributes.
+        virtual bool        Occluded(const Ray& r, float tMin, float tMax) const
+        {
+            HitRecord tempRec;
+            return Hit(r, tMin, tMax, tempRec);
+        }
+
+        // Closest hits for a batch of rays. tMax is per ray and gets pulled in to every hit found, so a batch can go
+        // through several hitables in turn. Hitables that can share work across the batch override this.
+        virtual void        HitPacket(const Ray* rays, int numRays, float tMin, float* tMax, HitRecord* recs, bool* hits) const
+        {
+            HitRecord tempRec;
+            for (int i = 0; i < numRays; i++)
+            {
+                if (Hit(rays[i], tMin, tMax[i], tempRec))
+                {
+                    recs[i] = tempRec;
+                    tMax[i] = tempRec.T;
+                    hits[i] = true;
+                }
+            }
+        }
+
+        // Same as HitPacket, for rays that have nothing in common, like the bounces of a wavefront. Hitables that
+        // can interleave the rays, to overlap their cache misses, override this.
+        virtual void        HitStream(const Ray* rays, int numRays, float tMin, float* tMax, HitRecord* recs, bool* hits) const
+        {
+            HitRecord tempRec;
+            for (int i = 0; i < numRays; i++)
+            {
+                if (Hit(rays[i], tMin, tMax[i], tempRec))
+                {
+                    recs[i] = tempRec;
+                    tMax[i] = tempRec.T;
+                    hits[i] = true;
+                }
+            }
+        }
+
     protected:
 
         IHitable() : IsLightShape(false) {}
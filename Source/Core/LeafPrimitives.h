@@ -0,0 +1,97 @@
+// ----------------------------------------------------------------------------------------------------------------------------
+// 
+// Copyright 2019 Khoi Nguyen
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+//    The above copyright notice and this permission notice shall be included in all copies or substantial
+//    portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+// 
+// ----------------------------------------------------------------------------------------------------------------------------
+
+#pragma once
+#include <cstdint>
+#include "IHitable.h"
+#include "BVHNode.h"
+#include "Ray.h"
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+namespace Core
+{
+    // Concrete hitable types compiled BVH leaves intersect directly, rather than through the IHitable vtable.
+    // Anything else is generic and still makes a virtual call.
+    enum PrimitiveType : uint8_t
+    {
+        PrimitiveGeneric = 0,
+        PrimitiveSphere,
+        PrimitiveMovingSphere,
+        PrimitiveXYZRect,
+        PrimitiveTriangle,
+        PrimitiveTriangleBlock4,
+        PrimitiveTriangleBlock8,
+        PrimitiveBox,
+        PrimitiveConstantMedium,
+    };
+
+    // ----------------------------------------------------------------------------------------------------------------------------
+
+    // Leaf intersection for the compiled BVHs. A leaf's primitives are kept sorted by type with a tag each, so every
+    // run of one type goes through a loop specialized for it. BVHs made of a single type, like a mesh's triangle
+    // blocks, skip the tags and get a whole traversal specialized for that type.
+    class LeafPrimitives
+    {
+    public:
+
+        // Stands in for the primitive type of a BVH that mixes types, its leaves dispatch on their tags
+        struct Mixed {};
+
+        static PrimitiveType GetType(const IHitable* hitable);
+
+        // Orders a leaf's primitives by type, keeping their order within a type, and fills in their tags
+        static void          SortByType(IHitable** prims, uint8_t* types, int count);
+
+        // The type all the primitives share, PrimitiveGeneric if they differ
+        static PrimitiveType GetUniformType(const uint8_t* types, int count);
+
+        // Prefetches what the hit tests read from outside the primitives themselves, like the triangles of a triangle
+        // block. False if there's nothing to fetch.
+        static bool          PrefetchPayload(IHitable* const* prims, const uint8_t* types, int count);
+
+        // Closest hit within (tMin, tMax), pulling tMax in to it. A mailbox skips primitives already tested.
+        static bool          Hit(IHitable* const* prims, const uint8_t* types, int count, const Ray& ray, float tMin, float& tMax,
+                                 HitRecord& rec, BVHNode::Mailbox* mailbox);
+        static bool          Occluded(IHitable* const* prims, const uint8_t* types, int count, const Ray& ray, float tMin, float tMax,
+                                      BVHNode::Mailbox* mailbox);
+
+        // Same, for leaves whose primitives are all a T, or Mixed
+        template <typename T>
+        static inline bool   HitLeaf(IHitable* const* prims, const uint8_t* types, int count, const Ray& ray, float tMin, float& tMax,
+                                     HitRecord& rec, BVHNode::Mailbox* mailbox);
+        template <typename T>
+        static inline bool   OccludedLeaf(IHitable* const* prims, const uint8_t* types, int count, const Ray& ray, float tMin, float tMax,
+                                          BVHNode::Mailbox* mailbox);
+
+        // Calls traverse with a null pointer to the uniform type, or to Mixed. Only the types whole BVHs are usually
+        // made of get their own traversal, the rest go through the tags.
+        template <typename Traverse>
+        static inline bool   Dispatch(PrimitiveType uniformType, const Traverse& traverse);
+
+    private:
+
+        template <typename T>
+        static inline bool   hitRun(IHitable* const* prims, int begin, int end, const Ray& ray, float tMin, float& tMax,
+                                    HitRecord& rec, BVHNode::Mailbox* mailbox);
+        template <typename T>
+        static inline bool   occludedRun(IHitable* const* prims, int begin, int end, const Ray& ray, float tMin, float tMax,
+                                         BVHNode::Mailbox* mailbox);
+    };
+}
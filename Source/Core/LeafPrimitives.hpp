@@ -0,0 +1,295 @@
+// ----------------------------------------------------------------------------------------------------------------------------
+// 
+// Copyright 2019 Khoi Nguyen
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+//    The above copyright notice and this permission notice shall be included in all copies or substantial
+//    portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+// 
+// ----------------------------------------------------------------------------------------------------------------------------
+
+#include "LeafPrimitives.h"
+#include "ConstantMedium.h"
+#include "CoreTriangle.h"
+#include "HitableBox.h"
+#include "MovingSphere.h"
+#include "Sphere.h"
+#include "TriangleBlock.h"
+#include "XYZRect.h"
+#include <algorithm>
+#include <type_traits>
+#include <typeinfo>
+
+using namespace Core;
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+PrimitiveType LeafPrimitives::GetType(const IHitable* hitable)
+{
+    // Exact types only, a subclass could override the test
+    const std::type_info& tid = typeid(*hitable);
+
+    if (tid == typeid(Sphere))          return PrimitiveSphere;
+    if (tid == typeid(MovingSphere))    return PrimitiveMovingSphere;
+    if (tid == typeid(XYZRect))         return PrimitiveXYZRect;
+    if (tid == typeid(Triangle))        return PrimitiveTriangle;
+    if (tid == typeid(TriangleBlock4))  return PrimitiveTriangleBlock4;
+    if (tid == typeid(TriangleBlock8))  return PrimitiveTriangleBlock8;
+    if (tid == typeid(HitableBox))      return PrimitiveBox;
+    if (tid == typeid(ConstantMedium))  return PrimitiveConstantMedium;
+
+    return PrimitiveGeneric;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void LeafPrimitives::SortByType(IHitable** prims, uint8_t* types, int count)
+{
+    std::stable_sort(prims, prims + count, [](const IHitable* a, const IHitable* b)
+    {
+        return GetType(a) < GetType(b);
+    });
+
+    for (int i = 0; i < count; i++)
+    {
+        types[i] = uint8_t(GetType(prims[i]));
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+PrimitiveType LeafPrimitives::GetUniformType(const uint8_t* types, int count)
+{
+    for (int i = 1; i < count; i++)
+    {
+        if (types[i] != types[0])
+        {
+            return PrimitiveGeneric;
+        }
+    }
+
+    return (count > 0) ? PrimitiveType(types[0]) : PrimitiveGeneric;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+bool LeafPrimitives::PrefetchPayload(IHitable* const* prims, const uint8_t* types, int count)
+{
+    bool fetched = false;
+    for (int i = 0; i < count; i++)
+    {
+        if (types[i] == PrimitiveTriangleBlock4)
+        {
+            static_cast<const TriangleBlock4*>(prims[i])->Prefetch();
+            fetched = true;
+        }
+        else if (types[i] == PrimitiveTriangleBlock8)
+        {
+            static_cast<const TriangleBlock8*>(prims[i])->Prefetch();
+            fetched = true;
+        }
+    }
+
+    return fetched;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+template <typename T>
+inline bool LeafPrimitives::HitLeaf(IHitable* const* prims, const uint8_t* types, int count, const Ray& ray, float tMin, float& tMax,
+                                    HitRecord& rec, BVHNode::Mailbox* mailbox)
+{
+    if constexpr (std::is_same<T, Mixed>::value)
+    {
+        return Hit(prims, types, count, ray, tMin, tMax, rec, mailbox);
+    }
+    else
+    {
+        return hitRun<T>(prims, 0, count, ray, tMin, tMax, rec, mailbox);
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+template <typename T>
+inline bool LeafPrimitives::OccludedLeaf(IHitable* const* prims, const uint8_t* types, int count, const Ray& ray, float tMin, float tMax,
+                                         BVHNode::Mailbox* mailbox)
+{
+    if constexpr (std::is_same<T, Mixed>::value)
+    {
+        return Occluded(prims, types, count, ray, tMin, tMax, mailbox);
+    }
+    else
+    {
+        return occludedRun<T>(prims, 0, count, ray, tMin, tMax, mailbox);
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+template <typename Traverse>
+inline bool LeafPrimitives::Dispatch(PrimitiveType uniformType, const Traverse& traverse)
+{
+    switch (uniformType)
+    {
+        case PrimitiveSphere:          return traverse((Sphere*)nullptr);
+        case PrimitiveTriangle:        return traverse((Triangle*)nullptr);
+        case PrimitiveTriangleBlock4:  return traverse((TriangleBlock4*)nullptr);
+        case PrimitiveTriangleBlock8:  return traverse((TriangleBlock8*)nullptr);
+        default:                       return traverse((Mixed*)nullptr);
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+template <typename T>
+inline bool LeafPrimitives::hitRun(IHitable* const* prims, int begin, int end, const Ray& ray, float tMin, float& tMax,
+                                   HitRecord& rec, BVHNode::Mailbox* mailbox)
+{
+    HitRecord tempRec;
+    bool      hitAnything = false;
+    for (int i = begin; i < end; i++)
+    {
+        if (mailbox != nullptr && !mailbox->Insert(prims[i]))
+        {
+            continue;
+        }
+
+        // Qualified, so the call is static. The generic run instantiates with IHitable and stays virtual.
+        const T* prim = static_cast<const T*>(prims[i]);
+        bool     hit;
+        if constexpr (std::is_same<T, IHitable>::value)
+        {
+            hit = prim->Hit(ray, tMin, tMax, tempRec);
+        }
+        else
+        {
+            hit = prim->T::Hit(ray, tMin, tMax, tempRec);
+        }
+
+        if (hit)
+        {
+            hitAnything = true;
+            tMax        = tempRec.T;
+            rec         = tempRec;
+        }
+    }
+
+    return hitAnything;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+template <typename T>
+inline bool LeafPrimitives::occludedRun(IHitable* const* prims, int begin, int end, const Ray& ray, float tMin, float tMax,
+                                        BVHNode::Mailbox* mailbox)
+{
+    for (int i = begin; i < end; i++)
+    {
+        if (mailbox != nullptr && !mailbox->Insert(prims[i]))
+        {
+            continue;
+        }
+
+        const T* prim = static_cast<const T*>(prims[i]);
+        bool     occluded;
+        if constexpr (std::is_same<T, IHitable>::value)
+        {
+            occluded = prim->Occluded(ray, tMin, tMax);
+        }
+        else
+        {
+            occluded = prim->T::Occluded(ray, tMin, tMax);
+        }
+
+        if (occluded)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+bool LeafPrimitives::Hit(IHitable* const* prims, const uint8_t* types, int count, const Ray& ray, float tMin, float& tMax,
+                         HitRecord& rec, BVHNode::Mailbox* mailbox)
+{
+    bool hitAnything = false;
+    for (int begin = 0; begin < count; )
+    {
+        const uint8_t type = types[begin];
+        int           end  = begin + 1;
+        while (end < count && types[end] == type)
+        {
+            end++;
+        }
+
+        bool hit;
+        switch (type)
+        {
+            case PrimitiveSphere:          hit = hitRun<Sphere>(prims, begin, end, ray, tMin, tMax, rec, mailbox);         break;
+            case PrimitiveMovingSphere:    hit = hitRun<MovingSphere>(prims, begin, end, ray, tMin, tMax, rec, mailbox);   break;
+            case PrimitiveXYZRect:         hit = hitRun<XYZRect>(prims, begin, end, ray, tMin, tMax, rec, mailbox);        break;
+            case PrimitiveTriangle:        hit = hitRun<Triangle>(prims, begin, end, ray, tMin, tMax, rec, mailbox);       break;
+            case PrimitiveTriangleBlock4:  hit = hitRun<TriangleBlock4>(prims, begin, end, ray, tMin, tMax, rec, mailbox); break;
+            case PrimitiveTriangleBlock8:  hit = hitRun<TriangleBlock8>(prims, begin, end, ray, tMin, tMax, rec, mailbox); break;
+            case PrimitiveBox:             hit = hitRun<HitableBox>(prims, begin, end, ray, tMin, tMax, rec, mailbox);     break;
+            case PrimitiveConstantMedium:  hit = hitRun<ConstantMedium>(prims, begin, end, ray, tMin, tMax, rec, mailbox); break;
+            default:                       hit = hitRun<IHitable>(prims, begin, end, ray, tMin, tMax, rec, mailbox);       break;
+        }
+
+        hitAnything |= hit;
+        begin = end;
+    }
+
+    return hitAnything;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+bool LeafPrimitives::Occluded(IHitable* const* prims, const uint8_t* types, int count, const Ray& ray, float tMin, float tMax,
+                              BVHNode::Mailbox* mailbox)
+{
+    for (int begin = 0; begin < count; )
+    {
+        const uint8_t type = types[begin];
+        int           end  = begin + 1;
+        while (end < count && types[end] == type)
+        {
+            end++;
+        }
+
+        bool occluded;
+        switch (type)
+        {
+            case PrimitiveSphere:          occluded = occludedRun<Sphere>(prims, begin, end, ray, tMin, tMax, mailbox);         break;
+            case PrimitiveMovingSphere:    occluded = occludedRun<MovingSphere>(prims, begin, end, ray, tMin, tMax, mailbox);   break;
+            case PrimitiveXYZRect:         occluded = occludedRun<XYZRect>(prims, begin, end, ray, tMin, tMax, mailbox);        break;
+            case PrimitiveTriangle:        occluded = occludedRun<Triangle>(prims, begin, end, ray, tMin, tMax, mailbox);       break;
+            case PrimitiveTriangleBlock4:  occluded = occludedRun<TriangleBlock4>(prims, begin, end, ray, tMin, tMax, mailbox); break;
+            case PrimitiveTriangleBlock8:  occluded = occludedRun<TriangleBlock8>(prims, begin, end, ray, tMin, tMax, mailbox); break;
+            case PrimitiveBox:             occluded = occludedRun<HitableBox>(prims, begin, end, ray, tMin, tMax, mailbox);     break;
+            case PrimitiveConstantMedium:  occluded = occludedRun<ConstantMedium>(prims, begin, end, ray, tMin, tMax, mailbox); break;
+            default:                       occluded = occludedRun<IHitable>(prims, begin, end, ray, tMin, tMax, mailbox);       break;
+        }
+
+        if (occluded)
+        {
+            return true;
+        }
+        begin = end;
+    }
+
+    return false;
+}
@@ -0,0 +1,153 @@
+// ----------------------------------------------------------------------------------------------------------------------------
+// 
+// Copyright 2019 Khoi Nguyen
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+//    The above copyright notice and this permission notice shall be included in all copies or substantial
+//    portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+// 
+// ----------------------------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include "IHitable.h"
+#include "LeafPrimitives.h"
+#include "Ray.h"
+#include "Util.h"
+#include "vcl/vectorclass.h"
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+namespace Core
+{
+    class BVHNode;
+
+    // Compiled, pointer free copy of a BVHNode tree. Nodes are stored depth first, so the first child of an
+    // interior node always follows it and only the second child needs an offset.
+    class LinearBVH
+    {
+    public:
+
+        struct Node
+        {
+            float    BoundsMin[3];
+            float    BoundsMax[3];
+            union
+            {
+                int32_t PrimitiveOffset;    // Leaf
+                int32_t SecondChildOffset;  // Interior
+            };
+            uint16_t NumPrimitives;         // Zero for interior nodes
+            uint8_t  Axis;                  // Split axis, for ordered traversal
+            uint8_t  Pad;
+        };
+
+        // Per node change in bounds from the start to the end of the time range, only kept for moving trees
+        struct MotionDelta
+        {
+            float    DeltaMin[3];
+            float    DeltaMax[3];
+            float    Pad[2];
+        };
+
+        static const int MaxTraversalDepth = 64;
+
+    public:
+
+        LinearBVH();
+        ~LinearBVH();
+
+        bool               Build(BVHNode* root);
+
+        // Rewrites every node's bounds from the primitives under it, keeping the layout. Moving trees keep their
+        // motion deltas, static ones take bounds over the whole time range.
+        void               Refit(float time0, float time1);
+
+        // Bounds of the whole tree at either end of the time range, and its surface area heuristic cost relative to
+        // the root's area, summed the same way as BVHNode::GetSAHCost()
+        void               GetBounds(BVHNode::BuildBounds& bounds0, BVHNode::BuildBounds& bounds1) const;
+        float              GetSAHCost() const;
+
+        bool               Hit(const Ray& ray, float tMin, float tMax, HitRecord& rec) const;
+        bool               Occluded(const Ray& ray, float tMin, float tMax) const;
+
+        inline const Node* GetNodes() const          { return Nodes; }
+        inline int         GetNumNodes() const       { return NumNodes; }
+        inline int         GetNumPrimitives() const  { return NumPrimitives; }
+        inline size_t      GetMemoryUsage() const
+        {
+            return (NumNodes * sizeof(Node)) + (NumPrimitives * (sizeof(IHitable*) + sizeof(uint8_t))) +
+                ((Motion != nullptr) ? (NumNodes * sizeof(MotionDelta)) : 0);
+        }
+        inline bool        HasMotion() const         { return Motion != nullptr; }
+
+    private:
+
+        void               countNodes(BVHNode* node, int depth);
+        int                flattenNode(BVHNode* node, int& nodeOffset, int& primOffset);
+        void               cleanup();
+        void               nodeBounds(int i, BVHNode::BuildBounds& bounds0, BVHNode::BuildBounds& bounds1) const;
+
+        template <typename PrimType>
+        bool               hitTree(const Ray& ray, float tMin, float tMax, HitRecord& rec) const;
+        template <typename PrimType>
+        bool               occludedTree(const Ray& ray, float tMin, float tMax) const;
+
+        static inline bool hitNode(const Node& node, const Vec4f& origin, const Vec4f& invDir, float tMin, float tMax)
+        {
+            // Lane 3 picks up the neighbouring field and is ignored below
+            const Vec4f vT0  = (Vec4f().load(node.BoundsMin) - origin) * invDir;
+            const Vec4f vT1  = (Vec4f().load(node.BoundsMax) - origin) * invDir;
+            const Vec4f vMin = min(vT0, vT1);
+            const Vec4f vMax = max(vT0, vT1);
+
+            const float minVal = GetMax(vMin[2], GetMax(vMin[0], vMin[1]));
+            const float maxVal = GetMin(vMax[2], GetMin(vMax[0], vMax[1]));
+
+            return (maxVal >= GetMax(tMin, minVal) && minVal < tMax);
+        }
+
+        static inline bool hitNode(const Node& node, const MotionDelta& delta, float motionScale, const Vec4f& origin, const Vec4f& invDir, float tMin, float tMax)
+        {
+            // Same test against the bounds lerped to the ray's time
+            const Vec4f vMinP = mul_add(Vec4f().load(delta.DeltaMin), Vec4f(motionScale), Vec4f().load(node.BoundsMin));
+            const Vec4f vMaxP = mul_add(Vec4f().load(delta.DeltaMax), Vec4f(motionScale), Vec4f().load(node.BoundsMax));
+            const Vec4f vT0   = (vMinP - origin) * invDir;
+            const Vec4f vT1   = (vMaxP - origin) * invDir;
+            const Vec4f vMin  = min(vT0, vT1);
+            const Vec4f vMax  = max(vT0, vT1);
+
+            const float minVal = GetMax(vMin[2], GetMax(vMin[0], vMin[1]));
+            const float maxVal = GetMin(vMax[2], GetMin(vMax[0], vMax[1]));
+
+            return (maxVal >= GetMax(tMin, minVal) && minVal < tMax);
+        }
+
+    private:
+
+        Node*        Nodes;
+        int          NumNodes;
+        IHitable**   Primitives;
+        uint8_t*     PrimitiveTypes;    // PrimitiveType of each, sorted within a leaf
+        PrimitiveType UniformType;      // Shared by every primitive, PrimitiveGeneric if mixed
+        int          NumPrimitives;
+        int          MaxDepth;
+        bool         Duplicates;
+        MotionDelta* Motion;
+        float        MotionTime0;
+        float        MotionInvDuration;
+    };
+
+    static_assert(sizeof(LinearBVH::Node) == 32, "LinearBVH nodes are expected to be 32 bytes");
+    static_assert(sizeof(LinearBVH::MotionDelta) == 32, "LinearBVH motion deltas are expected to be 32 bytes");
+}
@@ -0,0 +1,411 @@
+// ----------------------------------------------------------------------------------------------------------------------------
+// 
+// Copyright 2019 Khoi Nguyen
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+//    The above copyright notice and this permission notice shall be included in all copies or substantial
+//    portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+// 
+// ----------------------------------------------------------------------------------------------------------------------------
+
+#include "LinearBVH.h"
+#include "BVHNode.h"
+#include <vector>
+
+using namespace Core;
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+LinearBVH::LinearBVH()
+    : Nodes(nullptr)
+    , NumNodes(0)
+    , Primitives(nullptr)
+    , PrimitiveTypes(nullptr)
+    , UniformType(PrimitiveGeneric)
+    , NumPrimitives(0)
+    , MaxDepth(0)
+    , Duplicates(false)
+    , Motion(nullptr)
+    , MotionTime0(0)
+    , MotionInvDuration(0)
+{
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+LinearBVH::~LinearBVH()
+{
+    cleanup();
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void LinearBVH::cleanup()
+{
+    // Primitives are still owned by the BVHNode tree
+    delete[] Nodes;
+    delete[] Primitives;
+    delete[] PrimitiveTypes;
+    delete[] Motion;
+
+    Nodes          = nullptr;
+    Motion         = nullptr;
+    Primitives     = nullptr;
+    PrimitiveTypes = nullptr;
+    UniformType    = PrimitiveGeneric;
+    NumNodes       = 0;
+    NumPrimitives  = 0;
+    MaxDepth       = 0;
+    Duplicates     = false;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+bool LinearBVH::Build(BVHNode* root)
+{
+    cleanup();
+
+    // Size everything up front
+    countNodes(root, 1);
+    if (NumPrimitives == 0)
+    {
+        cleanup();
+        return false;
+    }
+
+    if (MaxDepth > MaxTraversalDepth)
+    {
+        DEBUG_PRINTF("LinearBVH: tree depth %d exceeds the traversal stack\n", MaxDepth);
+        cleanup();
+        return false;
+    }
+
+    Nodes          = new Node[NumNodes];
+    Primitives     = new IHitable*[GetMax(NumPrimitives, 1)];
+    PrimitiveTypes = new uint8_t[GetMax(NumPrimitives, 1)];
+
+    // Static trees skip the motion test entirely
+    if (root->HasMotion() && root->GetTime1() > root->GetTime0())
+    {
+        Motion            = new MotionDelta[NumNodes];
+        MotionTime0       = root->GetTime0();
+        MotionInvDuration = 1.f / (root->GetTime1() - root->GetTime0());
+    }
+
+    // Spatial splits put primitives in more than one leaf, traversal mailboxes them
+    Duplicates = root->HasDuplicates();
+
+    int nodeOffset = 0, primOffset = 0;
+    flattenNode(root, nodeOffset, primOffset);
+
+    // Traversal gets specialized for trees made of one type
+    UniformType = LeafPrimitives::GetUniformType(PrimitiveTypes, NumPrimitives);
+
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void LinearBVH::countNodes(BVHNode* node, int depth)
+{
+    NumNodes++;
+    MaxDepth = GetMax(MaxDepth, depth);
+
+    if (node->IsLeaf())
+    {
+        NumPrimitives += node->GetNumPrimitives();
+    }
+    else
+    {
+        countNodes(node->GetLeft(), depth + 1);
+        countNodes(node->GetRight(), depth + 1);
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+int LinearBVH::flattenNode(BVHNode* node, int& nodeOffset, int& primOffset)
+{
+    const int myOffset = nodeOffset++;
+    Node&     flat     = Nodes[myOffset];
+    if (Motion != nullptr)
+    {
+        // Bounds at the start of the time range, plus how far they move by the end
+        const AABB&  box0  = node->GetBoxAtTime0();
+        const AABB&  box1  = node->GetBoxAtTime1();
+        MotionDelta& delta = Motion[myOffset];
+        for (int axis = 0; axis < 3; axis++)
+        {
+            flat.BoundsMin[axis]  = box0.Min()[axis];
+            flat.BoundsMax[axis]  = box0.Max()[axis];
+            delta.DeltaMin[axis]  = box1.Min()[axis] - box0.Min()[axis];
+            delta.DeltaMax[axis]  = box1.Max()[axis] - box0.Max()[axis];
+        }
+        delta.Pad[0] = delta.Pad[1] = 0.f;
+    }
+    else
+    {
+        const AABB& box = node->GetBox();
+        for (int axis = 0; axis < 3; axis++)
+        {
+            flat.BoundsMin[axis] = box.Min()[axis];
+            flat.BoundsMax[axis] = box.Max()[axis];
+        }
+    }
+    flat.Axis = uint8_t(node->GetSplitAxis());
+    flat.Pad  = 0;
+
+    if (node->IsLeaf())
+    {
+        flat.PrimitiveOffset = primOffset;
+        flat.NumPrimitives   = uint16_t(node->GetNumPrimitives());
+        for (int i = 0; i < node->GetNumPrimitives(); i++)
+        {
+            Primitives[primOffset++] = node->GetPrimitive(i);
+        }
+        LeafPrimitives::SortByType(&Primitives[flat.PrimitiveOffset], &PrimitiveTypes[flat.PrimitiveOffset], flat.NumPrimitives);
+    }
+    else
+    {
+        // First child lands right after us
+        flat.NumPrimitives = 0;
+        flattenNode(node->GetLeft(), nodeOffset, primOffset);
+        flat.SecondChildOffset = flattenNode(node->GetRight(), nodeOffset, primOffset);
+    }
+
+    return myOffset;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void LinearBVH::Refit(float time0, float time1)
+{
+    // Depth first order puts both children after their parent, so walking backwards reaches them first
+    std::vector<BVHNode::BuildBounds> bounds0(NumNodes), bounds1(NumNodes);
+    for (int i = NumNodes - 1; i >= 0; i--)
+    {
+        Node& node = Nodes[i];
+        if (node.NumPrimitives > 0)
+        {
+            BVHNode::BuildBounds bounds;
+            BVHNode::GetPrimitiveBounds(&Primitives[node.PrimitiveOffset], node.NumPrimitives, time0, time1, bounds, bounds0[i], bounds1[i]);
+            if (Motion == nullptr)
+            {
+                bounds0[i] = bounds;
+                bounds1[i] = bounds;
+            }
+        }
+        else
+        {
+            bounds0[i] = bounds0[i + 1];
+            bounds0[i].Grow(bounds0[node.SecondChildOffset]);
+            bounds1[i] = bounds1[i + 1];
+            bounds1[i].Grow(bounds1[node.SecondChildOffset]);
+        }
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            node.BoundsMin[axis] = bounds0[i].Min[axis];
+            node.BoundsMax[axis] = bounds0[i].Max[axis];
+        }
+
+        if (Motion != nullptr)
+        {
+            for (int axis = 0; axis < 3; axis++)
+            {
+                Motion[i].DeltaMin[axis] = bounds1[i].Min[axis] - bounds0[i].Min[axis];
+                Motion[i].DeltaMax[axis] = bounds1[i].Max[axis] - bounds0[i].Max[axis];
+            }
+        }
+    }
+
+    if (Motion != nullptr)
+    {
+        MotionTime0       = time0;
+        MotionInvDuration = (time1 > time0) ? (1.f / (time1 - time0)) : 0.f;
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void LinearBVH::nodeBounds(int i, BVHNode::BuildBounds& bounds0, BVHNode::BuildBounds& bounds1) const
+{
+    for (int axis = 0; axis < 3; axis++)
+    {
+        bounds0.Min[axis] = Nodes[i].BoundsMin[axis];
+        bounds0.Max[axis] = Nodes[i].BoundsMax[axis];
+        bounds1.Min[axis] = bounds0.Min[axis] + ((Motion != nullptr) ? Motion[i].DeltaMin[axis] : 0.f);
+        bounds1.Max[axis] = bounds0.Max[axis] + ((Motion != nullptr) ? Motion[i].DeltaMax[axis] : 0.f);
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void LinearBVH::GetBounds(BVHNode::BuildBounds& bounds0, BVHNode::BuildBounds& bounds1) const
+{
+    nodeBounds(0, bounds0, bounds1);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+float LinearBVH::GetSAHCost() const
+{
+    // Nodes are costed over the whole time range, which for linear motion is the union of the two end boxes
+    float cost = 0.f, rootArea = 0.f;
+    for (int i = 0; i < NumNodes; i++)
+    {
+        BVHNode::BuildBounds bounds, bounds1;
+        nodeBounds(i, bounds, bounds1);
+        bounds.Grow(bounds1);
+
+        const float area = bounds.SurfaceArea();
+        const Node& node = Nodes[i];
+        cost    += area * ((node.NumPrimitives > 0) ? (BVHNode::IntersectCost * float(node.NumPrimitives)) : BVHNode::TraversalCost);
+        rootArea = (i == 0) ? area : rootArea;
+    }
+
+    return (rootArea > 0.f) ? (cost / rootArea) : (BVHNode::IntersectCost * float(NumPrimitives));
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+bool LinearBVH::Hit(const Ray& ray, float tMin, float tMax, HitRecord& rec) const
+{
+    return LeafPrimitives::Dispatch(UniformType, [&](auto* primType)
+    {
+        return hitTree<typename std::remove_pointer<decltype(primType)>::type>(ray, tMin, tMax, rec);
+    });
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+template <typename PrimType>
+bool LinearBVH::hitTree(const Ray& ray, float tMin, float tMax, HitRecord& rec) const
+{
+    const Vec4f  origin       = static_cast<Vec4f>(ray.OriginFast());
+    const Vec4f  invDir       = static_cast<Vec4f>(ray.InverseDirectionFast());
+    const float* invDirArray  = ray.InverseDirectionArray();
+    const bool   dirIsNeg[3]  = { invDirArray[0] < 0.f, invDirArray[1] < 0.f, invDirArray[2] < 0.f };
+    const float  motionScale  = (ray.Time() - MotionTime0) * MotionInvDuration;
+    bool         hitAnything  = false;
+    float        closestSoFar = tMax;
+
+    int stack[MaxTraversalDepth];
+    int stackSize   = 0;
+    int currentNode = 0;
+
+    BVHNode::Mailbox mailbox;
+    while (true)
+    {
+        const Node& node   = Nodes[currentNode];
+        const bool  hitBox = (Motion == nullptr) ?
+            hitNode(node, origin, invDir, tMin, closestSoFar) :
+            hitNode(node, Motion[currentNode], motionScale, origin, invDir, tMin, closestSoFar);
+
+        if (hitBox)
+        {
+            if (node.NumPrimitives > 0)
+            {
+                // Only leaves call into the hitables
+                if (LeafPrimitives::HitLeaf<PrimType>(&Primitives[node.PrimitiveOffset], &PrimitiveTypes[node.PrimitiveOffset],
+                                                      node.NumPrimitives, ray, tMin, closestSoFar, rec, Duplicates ? &mailbox : nullptr))
+                {
+                    hitAnything = true;
+                }
+            }
+            else
+            {
+                // Visit the near child first, so hits there cull the far child by tMax
+                if (dirIsNeg[node.Axis])
+                {
+                    stack[stackSize++] = currentNode + 1;
+                    currentNode        = node.SecondChildOffset;
+                }
+                else
+                {
+                    stack[stackSize++] = node.SecondChildOffset;
+                    currentNode        = currentNode + 1;
+                }
+                continue;
+            }
+        }
+
+        if (stackSize == 0)
+        {
+            break;
+        }
+        currentNode = stack[--stackSize];
+    }
+
+    return hitAnything;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+bool LinearBVH::Occluded(const Ray& ray, float tMin, float tMax) const
+{
+    return LeafPrimitives::Dispatch(UniformType, [&](auto* primType)
+    {
+        return occludedTree<typename std::remove_pointer<decltype(primType)>::type>(ray, tMin, tMax);
+    });
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+template <typename PrimType>
+bool LinearBVH::occludedTree(const Ray& ray, float tMin, float tMax) const
+{
+    const Vec4f origin      = static_cast<Vec4f>(ray.OriginFast());
+    const Vec4f invDir      = static_cast<Vec4f>(ray.InverseDirectionFast());
+    const float motionScale = (ray.Time() - MotionTime0) * MotionInvDuration;
+
+    int stack[MaxTraversalDepth];
+    int stackSize   = 0;
+    int currentNode = 0;
+
+    BVHNode::Mailbox mailbox;
+    while (true)
+    {
+        const Node& node   = Nodes[currentNode];
+        const bool  hitBox = (Motion == nullptr) ?
+            hitNode(node, origin, invDir, tMin, tMax) :
+            hitNode(node, Motion[currentNode], motionScale, origin, invDir, tMin, tMax);
+
+        if (hitBox)
+        {
+            if (node.NumPrimitives > 0)
+            {
+                // First hit ends the query
+                if (LeafPrimitives::OccludedLeaf<PrimType>(&Primitives[node.PrimitiveOffset], &PrimitiveTypes[node.PrimitiveOffset],
+                                                           node.NumPrimitives, ray, tMin, tMax, Duplicates ? &mailbox : nullptr))
+                {
+                    return true;
+                }
+            }
+            else
+            {
+                // Any hit will do, so children go in storage order
+                stack[stackSize++] = node.SecondChildOffset;
+                currentNode        = currentNode + 1;
+                continue;
+            }
+        }
+
+        if (stackSize == 0)
+        {
+            break;
+        }
+        currentNode = stack[--stackSize];
+    }
+
+    return false;
+}
@@ -23,6 +23,7 @@
 #include "Util.h"
 #include "CoreTexture.h"
 #include "Pdf.h"
+#include <cstdint>
 #include <vector>
 
 namespace Core
@@ -54,8 +55,8 @@ namespace Core
             Pdf* PdfPtr;
         };
 
-        Material() : Owner(nullptr), AlbedoTexture(nullptr), EmitTex(nullptr) {}
-        Material(BaseTexture* albedo, BaseTexture* emitTex) : Owner(nullptr), AlbedoTexture(albedo), EmitTex(emitTex) {}
+        Material() : Owner(nullptr), AlbedoTexture(nullptr), EmitTex(nullptr), Id(nextId()) {}
+        Material(BaseTexture* albedo, BaseTexture* emitTex) : Owner(nullptr), AlbedoTexture(albedo), EmitTex(emitTex), Id(nextId()) {}
 
         virtual ~Material()
         {
@@ -80,6 +81,10 @@ namespace Core
         virtual BaseTexture*    GetAlbedoTexture() { return AlbedoTexture; }
         virtual BaseTexture*    GetEmitTexture() { return EmitTex; }
 
+        // Numbered in creation order, so scenes built the same way number their materials the same way wherever
+        // the heap put them
+        inline uint32_t         GetId() const { return Id; }
+
     public:
 
         IHitable* Owner;
@@ -88,6 +93,12 @@ namespace Core
 
         BaseTexture* AlbedoTexture;
         BaseTexture* EmitTex;
+
+    private:
+
+        static uint32_t nextId();
+
+        uint32_t     Id;
     };
 
     // ----------------------------------------------------------------------------------------------------------------------------
@@ -19,6 +19,7 @@
 
 #include "Material.h"
 #include "OrthoNormalBasis.h"
+#include <atomic>
 #include <cstring>
 #include <iostream>
 #include <fstream>
@@ -27,6 +28,14 @@ using namespace Core;
 
 // ----------------------------------------------------------------------------------------------------------------------------
 
+uint32_t Material::nextId()
+{
+    static std::atomic<uint32_t> sNextId(0);
+    return sNextId++;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
 Vec4 Material::GetAverageAlbedo() const
 {
     // Run through the entire texture map and get an average color
@@ -183,7 +192,7 @@ bool MDielectric::Scatter(const Ray& rayIn, const HitRecord& hitRec, ScatterReco
         reflectProb = 1.0f;
     }
 
-    if (RandomFloat() < reflectProb)
+    if (SampleFloat() < reflectProb)
     {
         scatterRec.SpecularRay = Ray(hitRec.P, reflected, rayIn.Time());
     }
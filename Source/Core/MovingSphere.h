@@ -33,10 +33,17 @@ namespace Core
 
         virtual bool      Hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const;
         virtual bool      BoundingBox(float t0, float t1, AABB& box) const;
+        virtual bool      Occluded(const Ray& r, float tMin, float tMax) const;
         Vec4              Center(float time) const;
         float             GetRadius() const { return Radius; }
+        float             GetTime0() const { return Time0; }
+        float             GetTime1() const { return Time1; }
         virtual Material* GetMaterial() override { return Mat; }
 
+    private:
+
+        bool       intersect(const Ray& r, const Vec4& center, float tMin, float tMax, float& t) const;
+
     private:
 
         Vec4       Center0, Center1;
@@ -54,9 +54,9 @@ Vec4 MovingSphere::Center(float time) const
 
 // ----------------------------------------------------------------------------------------------------------------------------
 
-bool MovingSphere::Hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const
+bool MovingSphere::intersect(const Ray& r, const Vec4& center, float tMin, float tMax, float& t) const
 {
-    Vec4  oc = r.Origin() - Center(r.Time());
+    Vec4  oc = r.Origin() - center;
 
     float a = Dot(r.Direction(), r.Direction());
     float b = Dot(oc, r.Direction());
@@ -71,11 +71,7 @@ bool MovingSphere::Hit(const Ray& r, float tMin, float tMax, HitRecord& rec) con
         bool test1Passed = (test1 < tMax && test1 > tMin);
         if (test0Passed || test1Passed)
         {
-            rec.T = test0Passed ? test0 : test1;
-            rec.P = r.PointAtParameter(rec.T);
-            rec.Normal = (rec.P - Center(r.Time())) / Radius;
-            rec.MatPtr = Mat;
-            GetSphereUV((rec.P - Center(r.Time())) / Radius, rec.U, rec.V);
+            t = test0Passed ? test0 : test1;
             return true;
         }
     }
@@ -85,10 +81,35 @@ bool MovingSphere::Hit(const Ray& r, float tMin, float tMax, HitRecord& rec) con
 
 // ----------------------------------------------------------------------------------------------------------------------------
 
+bool MovingSphere::Hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const
+{
+    const Vec4 center = Center(r.Time());
+    if (!intersect(r, center, tMin, tMax, rec.T))
+    {
+        return false;
+    }
+
+    rec.P = r.PointAtParameter(rec.T);
+    rec.Normal = (rec.P - center) / Radius;
+    rec.MatPtr = Mat;
+    GetSphereUV(rec.Normal, rec.U, rec.V);
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+bool MovingSphere::Occluded(const Ray& r, float tMin, float tMax) const
+{
+    float t;
+    return intersect(r, Center(r.Time()), tMin, tMax, t);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
 bool MovingSphere::BoundingBox(float t0, float t1, AABB& box) const
 {
-    AABB a = AABB::ComputerAABBForSphere(Center0, Radius);
-    AABB b = AABB::ComputerAABBForSphere(Center1, Radius);
+    AABB a = AABB::ComputerAABBForSphere(Center(t0), Radius);
+    AABB b = AABB::ComputerAABBForSphere(Center(t1), Radius);
 
     box = AABB::SurroundingBox(a, b);
 
@@ -121,7 +121,7 @@ namespace Core
 
         virtual Vec4 Generate() const
         {
-            if (RandomFloat() < 0.5f)
+            if (SampleFloat() < 0.5f)
             {
                 return pdfs[0]->Generate();
             }
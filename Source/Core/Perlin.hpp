@@ -27,7 +27,7 @@ class SeedRandom
 public:
     SeedRandom()
     {
-        srand((unsigned int)time(NULL));
+        GetThreadRandomGenerator().Seed((uint32_t)time(NULL));
     }
 };
 
@@ -33,6 +33,9 @@ namespace Core
         Quat() : S(0), V(0, 0, 0) {}
         Quat(float s, const Vec4& v) : S(s), V(v) {}
 
+        inline float       GetScalar() const { return S; }
+        inline const Vec4& GetVector() const { return V; }
+
         // ----------------------------------------------------------------------------
 
         inline Quat operator +(const Quat& q) const
@@ -112,7 +115,7 @@ namespace Core
             q.ToUnitNormQuaternion();
 
             Quat qInverse = q.Inverse();
-            Quat rotated = q * p * q.Inverse();
+            Quat rotated = q * p * qInverse;
 
             return rotated.V;
         }
@@ -147,6 +150,7 @@ namespace Core
         inline Quat operator *=(float value)
         {
             (*this) = (*this) * value;
+            return (*this);
         }
 
     private:
@@ -0,0 +1,160 @@
+// ----------------------------------------------------------------------------------------------------------------------------
+// 
+// Copyright 2019 Khoi Nguyen
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+//    The above copyright notice and this permission notice shall be included in all copies or substantial
+//    portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+// 
+// ----------------------------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include "vcl/vectorclass.h"
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+namespace Core
+{
+    // xoshiro128+ generator. Small, lock free and seedable, meant to be owned by a single thread.
+    class RandomGenerator
+    {
+    public:
+
+        inline RandomGenerator(uint32_t seed = 0)
+        {
+            Seed(seed);
+        }
+
+        inline void Seed(uint32_t seed)
+        {
+            // Expand the seed with splitmix32, so nearby seeds give unrelated streams
+            for (int i = 0; i < 4; i++)
+            {
+                State[i] = SplitMix32(seed);
+            }
+        }
+
+        inline uint32_t NextUInt()
+        {
+            const uint32_t result = State[0] + State[3];
+            const uint32_t t      = State[1] << 9;
+
+            State[2] ^= State[0];
+            State[3] ^= State[1];
+            State[1] ^= State[2];
+            State[0] ^= State[3];
+            State[2] ^= t;
+            State[3]  = (State[3] << 11) | (State[3] >> 21);
+
+            return result;
+        }
+
+        // Uniform in [0, 1)
+        inline float NextFloat()
+        {
+            // The top 24 bits are the best quality ones for xoshiro128+
+            return float(NextUInt() >> 8) * (1.f / 16777216.f);
+        }
+
+        static inline uint32_t SplitMix32(uint32_t& state)
+        {
+            uint32_t z = (state += 0x9e3779b9u);
+            z = (z ^ (z >> 16)) * 0x85ebca6bu;
+            z = (z ^ (z >> 13)) * 0xc2b2ae35u;
+            return z ^ (z >> 16);
+        }
+
+        static inline uint32_t HashSeed(uint32_t a, uint32_t b, uint32_t c = 0)
+        {
+            uint32_t state = a;
+            state = SplitMix32(state) ^ b;
+            state = SplitMix32(state) ^ c;
+            return SplitMix32(state);
+        }
+
+    private:
+
+        uint32_t State[4];
+    };
+
+    // ----------------------------------------------------------------------------------------------------------------------------
+
+    // Eight independent xoshiro128+ lanes, producing 8 floats per call
+    class RandomGenerator8
+    {
+    public:
+
+        inline RandomGenerator8(uint32_t seed = 0)
+        {
+            Seed(seed);
+        }
+
+        inline void Seed(uint32_t seed)
+        {
+            uint32_t lanes[4][8];
+            for (int lane = 0; lane < 8; lane++)
+            {
+                uint32_t laneSeed = RandomGenerator::HashSeed(seed, lane);
+                for (int i = 0; i < 4; i++)
+                {
+                    lanes[i][lane] = RandomGenerator::SplitMix32(laneSeed);
+                }
+            }
+
+            for (int i = 0; i < 4; i++)
+            {
+                State[i].load(lanes[i]);
+            }
+        }
+
+        inline Vec8ui NextUInt8()
+        {
+            const Vec8ui result = State[0] + State[3];
+            const Vec8ui t      = State[1] << 9;
+
+            State[2] ^= State[0];
+            State[3] ^= State[1];
+            State[1] ^= State[2];
+            State[0] ^= State[3];
+            State[2] ^= t;
+            State[3]  = (State[3] << 11) | (State[3] >> 21);
+
+            return result;
+        }
+
+        // Eight uniforms in [0, 1)
+        inline Vec8f NextFloat8()
+        {
+            return to_float(Vec8i(NextUInt8() >> 8)) * (1.f / 16777216.f);
+        }
+
+        inline void NextFloat8(float out[8])
+        {
+            NextFloat8().store(out);
+        }
+
+    private:
+
+        Vec8ui State[4];
+    };
+
+    // ----------------------------------------------------------------------------------------------------------------------------
+
+    // Every thread gets its own generator, so RandomFloat() never contends on a shared lock
+    inline RandomGenerator& GetThreadRandomGenerator()
+    {
+        static thread_local RandomGenerator generator;
+        return generator;
+    }
+}
@@ -21,6 +21,7 @@
 
 #include <thread>
 #include <atomic>
+#include <mutex>
 #include <cstdint>
 
 #include "Ray.h"
@@ -33,6 +34,8 @@
 #include "ThreadEvent.h"
 #include "Pdf.h"
 #include "WorldScene.h"
+#include "TileScheduler.h"
+#include "ThreadPool.h"
 
 // ----------------------------------------------------------------------------------------------------------------------------
 namespace Core
@@ -44,6 +47,18 @@ namespace Core
         typedef std::chrono::time_point<std::chrono::system_clock> StdTime;
         typedef void(*OnTraceComplete)(Raytracer* tracer, bool actuallyFinished);
 
+        enum SamplerType
+        {
+            SamplerRandom = 0,
+            SamplerSobol,
+        };
+
+        enum IntegratorType
+        {
+            IntegratorRecursive = 0,    // Each path traced depth first, one ray at a time
+            IntegratorWavefront,        // A tile's paths advanced one bounce at a time, shading sorted by material
+        };
+
         struct Stats
         {
             int64_t     TotalRaysFired;
@@ -57,30 +72,74 @@ namespace Core
 
     public:
 
-        Raytracer(int width, int height, int numSamples, int maxDepth, int numThreads, bool pdfEnabled);
+        Raytracer(int width, int height, int numSamples, int maxDepth, int numThreads, bool pdfEnabled, ThreadPool* threadPool = nullptr);
         ~Raytracer();
 
         void             BeginRaytrace(WorldScene* scene, OnTraceComplete onComplete = nullptr);
         void             RestartCurrentRaytrace();
         bool             WaitForTraceToFinish(int timeoutMicroSeconds);
+        void             SetTileOptions(int tileLength, int samplesPerTileBatch);
+        void             SetPreviewUpdateInterval(int milliseconds);
+        void             SetRandomSeed(uint32_t seed);
+        void             SetSamplerType(SamplerType type);
+        void             SetPacketTracing(bool enabled);
+        void             SetIntegratorType(IntegratorType type);
+        void             SetRayReordering(bool enabled);
+        void             SetInterleavedTracing(bool enabled);
+        uint8_t*         GetOutputBufferRGBA8888();
         Stats            GetStats() const;
 
         inline Vec4*     GetOutputBuffer() const            { return OutputBuffer; }
-        inline uint8_t*  GetOutputBufferRGBA8888() const    { return OutputBufferRGBA8888; }
         inline int       GetOutputWidth() const             { return OutputWidth; }
         inline int       GetOutputHeight() const            { return OutputHeight; }
         inline int       GetNumberSamples() const           { return NumRaySamples; }
         inline bool      IsTracing() const                  { return IsRaytracing; }
+        inline SamplerType GetSamplerType() const           { return SamplingMode; }
+        inline bool      GetPacketTracing() const           { return PacketTracing; }
+        inline IntegratorType GetIntegratorType() const     { return Integrator; }
+        inline bool      GetRayReordering() const           { return RayReordering; }
+        inline bool      GetInterleavedTracing() const      { return InterleavedTracing; }
 
     private:
 
-        struct ThreadData
+        struct ShadeEntry
         {
-            bool RestartTrace = false;
+            size_t           MaterialType;
+            uint32_t         MaterialId;
+            int              RayIndex;
         };
 
-        static void      threadTraceNextPixel(int id, Raytracer* tracer, WorldScene* scene);
+        // Path states for one wave, a field per array
+        struct WavefrontState
+        {
+            WavefrontState(int maxPaths);
+            ~WavefrontState();
+
+            Ray*             Rays;
+            Ray*             NextRays;
+            int*             PathIndex;
+            int*             NextPathIndex;
+            HitRecord*       Records;
+            float*           TMax;
+            bool*            Hits;
+            Vec4*            Throughput;
+            Vec4*            Radiance;
+            ShadeEntry*      ShadeOrder;
+            uint32_t*        RayKeys;
+            int*             RayOrder;
+            int*             RayOrderTemp;
+            AABB             SceneBox;
+        };
+
+    private:
+
+        static void      threadTraceNextTile(int id, Raytracer* tracer, WorldScene* scene);
         Vec4             trace(WorldScene* scene, const Ray& r, int depth);
+        Vec4             shade(WorldScene* scene, const Ray& r, HitRecord& hitRec, int depth);
+        void             traceWavefront(WorldScene* scene, const TileScheduler::Tile& tile, int sampleIndex, int numPaths, WavefrontState& wave, Vec4* accumSlab);
+        void             reorderWave(WavefrontState& wave, int numRays);
+        void             mergeTileSlab(int tileIndex, const Vec4* accumSlab, int numSamples);
+        void             updatePreviewTile(int tileIndex, int numSamples);
         void             cleanupRaytrace();
         void             resetRaytrace();
 
@@ -93,22 +152,39 @@ namespace Core
         Vec4*                   ZeroedOutputBuffer;
         uint8_t*                OutputBufferRGBA8888;
 
+        // Preview options, RGBA is only converted when someone asks for it
+        std::mutex              PreviewMutex;
+        std::atomic<int>*       TileSampleCounts;
+        int*                    PreviewTileSampleCounts;
+        int                     NumPreviewTiles;
+        int                     PreviewIntervalMs;
+        StdTime                 LastPreviewUpdate;
+
         // Tracing options
         int                     NumRaySamples;
         int                     MaxDepth;
         int                     NumThreads;
         bool                    PdfEnabled;
+        int                     TileLength;
+        int                     SamplesPerTileBatch;
+        uint32_t                RandomSeed;
+        SamplerType             SamplingMode;
+        bool                    PacketTracing;
+        IntegratorType          Integrator;
+        bool                    RayReordering;
+        bool                    InterleavedTracing;
 
         // Thread tracking
-        std::atomic<int64_t>    CurrentPixelSampleOffset;
+        ThreadPool*             Pool;
+        bool                    OwnsPool;
+        TileScheduler           Scheduler;
+        std::atomic<int64_t>    NumPixelSamplesDone;
         std::atomic<int64_t>    TotalRaysFired;
         std::atomic<int>        NumThreadsDone;
         std::atomic<int>        NumPdfQueryRetries;
         std::atomic<bool>       ThreadExitRequested;
         StdTime                 StartTime;
         StdTime                 EndTime;
-        std::thread**           ThreadPtrs;
-        std::vector<ThreadData> LocalThreadData;
         ThreadEvent             RaytraceEvent;
         bool                    IsRaytracing;
         OnTraceComplete         OnComplete;
@@ -23,20 +23,56 @@
 #include <memory.h>
 #include <cfloat>
 #include <vector>
+#include <algorithm>
+#include <typeinfo>
 #include <math.h>
 
 using namespace Core;
 
 // ----------------------------------------------------------------------------------------------------------------------------
 
-Raytracer::Raytracer(int width, int height, int numSamples, int maxDepth, int numThreads, bool pdfEnabled) 
+static const int DefaultTileLength          = 32;
+static const int DefaultSamplesPerTileBatch = 1;
+static const int DefaultPreviewIntervalMs   = 100;
+
+// Sampler dimensions: pixel, lens and time for the camera ray, then a fixed block per bounce
+static const int CameraSampleDimensions     = 3;
+static const int BounceSampleDimensions     = 4;
+
+// Camera rays are traced in square packets of this many pixels per side
+static const int PrimaryPacketLength        = 8;
+static const int PrimaryPacketSize          = PrimaryPacketLength * PrimaryPacketLength;
+
+// Reordered bounce rays are binned on a grid with this many bits per axis over the scene bounds, then radix sorted
+// this many key bits per pass
+static const int ReorderCellBits            = 4;
+static const int ReorderRadixBits           = 8;
+static const int ReorderKeyBits             = 3 + (3 * ReorderCellBits);
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+Raytracer::Raytracer(int width, int height, int numSamples, int maxDepth, int numThreads, bool pdfEnabled, ThreadPool* threadPool) 
     : OutputWidth(width)
     , OutputHeight(height)
+    , TileSampleCounts(nullptr)
+    , PreviewTileSampleCounts(nullptr)
+    , NumPreviewTiles(0)
+    , PreviewIntervalMs(DefaultPreviewIntervalMs)
     , NumRaySamples(numSamples)
     , MaxDepth(maxDepth)
     , NumThreads(numThreads)
     , PdfEnabled(pdfEnabled)
-    , CurrentPixelSampleOffset(0)
+    , TileLength(DefaultTileLength)
+    , SamplesPerTileBatch(DefaultSamplesPerTileBatch)
+    , RandomSeed(0)
+    , SamplingMode(SamplerSobol)
+    , PacketTracing(true)
+    , Integrator(IntegratorRecursive)
+    , RayReordering(false)
+    , InterleavedTracing(false)
+    , Pool(threadPool)
+    , OwnsPool(threadPool == nullptr)
+    , NumPixelSamplesDone(0)
     , TotalRaysFired(0)
     , NumThreadsDone(0)
     , ThreadExitRequested(false)
@@ -45,7 +81,12 @@ Raytracer::Raytracer(int width, int height, int numSamples, int maxDepth, int nu
     OutputBuffer       = new Vec4[OutputWidth * OutputHeight];
     ZeroedOutputBuffer = new Vec4[OutputWidth * OutputHeight];
     OutputBufferRGBA8888   = new uint8_t[OutputWidth * OutputHeight * 4];
-    ThreadPtrs         = new std::thread*[NumThreads];
+
+    // Workers are parked between traces, so only spin them up once
+    if (OwnsPool)
+    {
+        Pool = new ThreadPool(NumThreads);
+    }
 
     for (int i = 0; i < (OutputWidth * OutputHeight); i++)
     {
@@ -68,8 +109,17 @@ Raytracer::~Raytracer()
     delete[] ZeroedOutputBuffer;
     ZeroedOutputBuffer = nullptr;
 
-    delete[] ThreadPtrs;
-    ThreadPtrs = nullptr;
+    delete[] TileSampleCounts;
+    TileSampleCounts = nullptr;
+
+    delete[] PreviewTileSampleCounts;
+    PreviewTileSampleCounts = nullptr;
+
+    if (OwnsPool)
+    {
+        delete Pool;
+    }
+    Pool = nullptr;
 }
 
 // ----------------------------------------------------------------------------------------------------------------------------
@@ -78,16 +128,121 @@ void Raytracer::BeginRaytrace(WorldScene* scene, OnTraceComplete onComplete)
 {
     // Clean up last trace, if any
     cleanupRaytrace();
-    resetRaytrace();
     OnComplete = onComplete;
 
-    // Create the threads and run them
-    LocalThreadData.resize(NumThreads);
-    for (int i = 0; i < NumThreads; i++)
+    // Hand out tiles, one work queue per thread
+    Scheduler.Setup(OutputWidth, OutputHeight, TileLength, NumRaySamples, SamplesPerTileBatch, NumThreads);
+
+    // Track merged samples per tile so the preview only converts what changed
+    if (NumPreviewTiles != Scheduler.GetNumTiles())
+    {
+        std::unique_lock<std::mutex> lck(PreviewMutex);
+
+        delete[] TileSampleCounts;
+        delete[] PreviewTileSampleCounts;
+
+        NumPreviewTiles         = Scheduler.GetNumTiles();
+        TileSampleCounts        = new std::atomic<int>[NumPreviewTiles];
+        PreviewTileSampleCounts = new int[NumPreviewTiles];
+    }
+
+    resetRaytrace();
+
+    // Wake up the pool workers and run them
+    Pool->Dispatch(NumThreads, [this, scene](int id) { threadTraceNextTile(id, this, scene); });
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void Raytracer::SetTileOptions(int tileLength, int samplesPerTileBatch)
+{
+    // Takes effect on the next BeginRaytrace()
+    TileLength          = GetMax(tileLength, 1);
+    SamplesPerTileBatch = GetMax(samplesPerTileBatch, 1);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void Raytracer::SetRandomSeed(uint32_t seed)
+{
+    // Takes effect on the next BeginRaytrace() or restart
+    RandomSeed = seed;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void Raytracer::SetSamplerType(SamplerType type)
+{
+    // Takes effect on the next BeginRaytrace()
+    SamplingMode = type;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void Raytracer::SetPacketTracing(bool enabled)
+{
+    // Takes effect on the next BeginRaytrace()
+    PacketTracing = enabled;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void Raytracer::SetIntegratorType(IntegratorType type)
+{
+    // Takes effect on the next BeginRaytrace()
+    Integrator = type;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void Raytracer::SetRayReordering(bool enabled)
+{
+    // Takes effect on the next BeginRaytrace(). Only the wavefront integrator has batches of bounces to reorder.
+    RayReordering = enabled;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void Raytracer::SetInterleavedTracing(bool enabled)
+{
+    // Takes effect on the next BeginRaytrace(). Wavefront bounces go through the scene as one stream, several rays
+    // in flight at once.
+    InterleavedTracing = enabled;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void Raytracer::SetPreviewUpdateInterval(int milliseconds)
+{
+    PreviewIntervalMs = GetMax(milliseconds, 0);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+uint8_t* Raytracer::GetOutputBufferRGBA8888()
+{
+    std::unique_lock<std::mutex> lck(PreviewMutex);
+
+    // Throttle conversions, callers polling faster than the interval get the last preview
+    const StdTime now = std::chrono::system_clock::now();
+    if (std::chrono::duration_cast<std::chrono::milliseconds>(now - LastPreviewUpdate).count() < PreviewIntervalMs)
     {
-        LocalThreadData[i].RestartTrace = false;
-        ThreadPtrs[i] = new std::thread(threadTraceNextPixel, i, this, scene);
+        return OutputBufferRGBA8888;
+    }
+    LastPreviewUpdate = now;
+
+    // Only convert tiles that had samples merged since the last update
+    for (int i = 0; i < NumPreviewTiles; i++)
+    {
+        const int numSamples = TileSampleCounts[i].load();
+        if (numSamples != PreviewTileSampleCounts[i])
+        {
+            updatePreviewTile(i, numSamples);
+            PreviewTileSampleCounts[i] = numSamples;
+        }
     }
+
+    return OutputBufferRGBA8888;
 }
 
 // ----------------------------------------------------------------------------------------------------------------------------
@@ -96,14 +251,24 @@ void Raytracer::resetRaytrace()
 {
     IsRaytracing                = true;
     TotalRaysFired              = 0;
-    CurrentPixelSampleOffset    = 0;
+    NumPixelSamplesDone         = 0;
     NumThreadsDone              = 0;
     NumPdfQueryRetries          = 0;
     StartTime                   = std::chrono::system_clock::now();
 
     // Clear out buffers
     const int area = OutputWidth * OutputHeight;
-    memset(OutputBufferRGBA8888, 0, sizeof(uint8_t) * area * 4);
+    {
+        std::unique_lock<std::mutex> lck(PreviewMutex);
+
+        memset(OutputBufferRGBA8888, 0, sizeof(uint8_t) * area * 4);
+        for (int i = 0; i < NumPreviewTiles; i++)
+        {
+            TileSampleCounts[i]        = 0;
+            PreviewTileSampleCounts[i] = 0;
+        }
+        LastPreviewUpdate = StdTime();
+    }
     memcpy(OutputBuffer, ZeroedOutputBuffer, sizeof(float) * area * 4);
 }
 
@@ -114,12 +279,7 @@ void Raytracer::RestartCurrentRaytrace()
     // This is not really thread-safe or consistent, but whatevs.
     if (IsRaytracing)
     {
-        CurrentPixelSampleOffset.store(0);
-        for (int i = 0; i < NumThreads; i++)
-        {
-            LocalThreadData[i].RestartTrace = true;
-        }
-        resetRaytrace();
+        Scheduler.Reset([this]() { resetRaytrace(); });
     }
 }
 
@@ -144,12 +304,12 @@ Raytracer::Stats Raytracer::GetStats() const
 
     Stats stats;
     stats.TotalRaysFired        = TotalRaysFired.load();
-    stats.NumPixelSamples       = CurrentPixelSampleOffset.load();
+    stats.NumPixelSamples       = NumPixelSamplesDone.load();
     stats.TotalNumPixelSamples  = numPixels * int64_t(NumRaySamples);
-    stats.CompletedSampleCount  = int(CurrentPixelSampleOffset.load() / numPixels);
+    stats.CompletedSampleCount  = int(NumPixelSamplesDone.load() / numPixels);
     stats.NumPdfQueryRetries    = NumPdfQueryRetries.load();
     stats.TotalTimeInSeconds    = (int)std::chrono::duration<double>(endTime - StartTime).count();
-    stats.CurrentPixelOffset    = int(CurrentPixelSampleOffset.load() % numPixels);
+    stats.CurrentPixelOffset    = int(NumPixelSamplesDone.load() % numPixels);
     
     return stats;
 }
@@ -164,14 +324,8 @@ void Raytracer::cleanupRaytrace()
         ThreadExitRequested = true;
         RaytraceEvent.WaitOne(-1);
 
-        // Join all the threads
-        for (int i = 0; i < NumThreads; i++)
-        {
-            ThreadPtrs[i]->join();
-            delete ThreadPtrs[i];
-            ThreadPtrs[i] = nullptr;
-        }
-        LocalThreadData.clear();
+        // Wait for all the workers to park again
+        Pool->Wait();
 
         // Reset event
         ThreadExitRequested = false;
@@ -182,91 +336,200 @@ void Raytracer::cleanupRaytrace()
 
 // ----------------------------------------------------------------------------------------------------------------------------
 
-void Raytracer::threadTraceNextPixel(int id, Raytracer* tracer, WorldScene* scene)
+void Raytracer::threadTraceNextTile(int id, Raytracer* tracer, WorldScene* scene)
 {
-    const int     numPixels         = tracer->OutputWidth * tracer->OutputHeight;
-    const int64_t totalPixelSamples = int64_t(numPixels) * int64_t(tracer->NumRaySamples);
-    const int     tileLength        = 32;
-    const int     tileArea          = tileLength * tileLength;
-    const int     numXTiles         = tracer->OutputWidth  / tileLength;
-    const int     numYTiles         = tracer->OutputHeight / tileLength;
-    const bool    tileEnabled       = ((tracer->OutputWidth % tileLength) == 0) && ((tracer->OutputHeight % tileLength) == 0);
+    const int64_t totalPixelSamples = int64_t(tracer->OutputWidth) * int64_t(tracer->OutputHeight) * int64_t(tracer->NumRaySamples);
 
-    // Thread starts here
-    int64_t pixelSampleOffset = tracer->CurrentPixelSampleOffset.load();
-    while ((tracer->ThreadExitRequested.load() == false) && pixelSampleOffset < totalPixelSamples)
+    // Thread local accumulation, sized for a full tile
+    const int         tileLength = tracer->Scheduler.GetTileLength();
+    std::vector<Vec4> accumSlab(tileLength * tileLength);
+
+    // Batched pixel jitter
+    RandomGenerator8  jitterGenerator;
+    float             jitter[8];
+    int               jitterIdx = 8;
+
+    // Low discrepancy sampling, if enabled. Everything else keeps drawing from the thread generator.
+    SobolSampler      sobolSampler;
+    Sampler*          sampler = (tracer->SamplingMode == SamplerSobol) ? &sobolSampler : nullptr;
+    SetThreadSampler(sampler);
+
+    // Jittered camera ray through a pixel. Jitter comes from the sampler, or the batch generator 4 pixels per refill.
+    auto makeCameraRay = [tracer, scene, sampler, &jitterGenerator, &jitter, &jitterIdx](int x, int y, int sampleIndex)
     {
-        // Find the next offset to the pixel to trace
-        while (pixelSampleOffset < totalPixelSamples)
+        float jitterX, jitterY;
+        if (sampler != nullptr)
+        {
+            sampler->StartPixelSample(x, y, sampleIndex);
+            sampler->Get2D(jitterX, jitterY);
+        }
+        else
         {
-            // See if we're restarting
-            if (tracer->LocalThreadData[id].RestartTrace)
+            if (jitterIdx >= 8)
             {
-                pixelSampleOffset = tracer->CurrentPixelSampleOffset.load();
-                tracer->LocalThreadData[id].RestartTrace = false;
+                jitterGenerator.NextFloat8(jitter);
+                jitterIdx = 0;
             }
+            jitterX = jitter[jitterIdx++];
+            jitterY = jitter[jitterIdx++];
+        }
 
-            // Try and get the next pixel offset
-            if (tracer->CurrentPixelSampleOffset.compare_exchange_strong(pixelSampleOffset, pixelSampleOffset + 1))
+        const float u = 0.f + float(x + jitterX) / float(tracer->OutputWidth);
+        const float v = 1.f - float(y + jitterY) / float(tracer->OutputHeight);
+        return scene->GetCamera().GetRay(u, v);
+    };
+
+    // Path states for the wavefront integrator, a full tile at a time
+    WavefrontState* wave = (tracer->Integrator == IntegratorWavefront) ? new WavefrontState(tileLength * tileLength) : nullptr;
+    if (wave != nullptr && !scene->GetWorld()->BoundingBox(0, 1, wave->SceneBox))
+    {
+        wave->SceneBox = AABB(Vec4(-1, -1, -1), Vec4(1, 1, 1));
+    }
+
+    // Primary ray packets
+    std::vector<Ray>       packetRays(PrimaryPacketSize);
+    std::vector<HitRecord> packetRecs(PrimaryPacketSize);
+    float                  packetTMax[PrimaryPacketSize];
+    bool                   packetHits[PrimaryPacketSize];
+
+    // Thread starts here
+    TileScheduler::WorkItem item;
+    while (tracer->ThreadExitRequested.load() == false)
+    {
+        // Grab the next batch of tile samples, stealing if our queue is dry
+        if (!tracer->Scheduler.Next(id, item))
+        {
+            // Other threads still own tiles that may be requeued
+            if (tracer->Scheduler.HasPendingWork())
             {
-                break;
+                std::this_thread::yield();
+                continue;
             }
-            pixelSampleOffset = tracer->CurrentPixelSampleOffset.load();
+
+            break;
         }
 
-        // Do we have a pixel to trace?
-        if (pixelSampleOffset < totalPixelSamples)
+        // Seed from the tile and sample range, so results don't depend on which thread picked up the work
+        const uint32_t batchSeed = RandomGenerator::HashSeed(tracer->RandomSeed, uint32_t(item.TileIndex), uint32_t(item.SampleStart));
+        GetThreadRandomGenerator().Seed(batchSeed);
+        jitterGenerator.Seed(batchSeed);
+        jitterIdx = 8;
+        sobolSampler.SetSeed(tracer->RandomSeed);
+
+        // Trace the whole batch into our own slab, nobody else touches it
+        const TileScheduler::Tile& tile = tracer->Scheduler.GetTile(item.TileIndex);
+        for (int i = 0; i < (tile.Width * tile.Height); i++)
         {
-            const int curOffset = pixelSampleOffset % numPixels;
+            accumSlab[i] = Vec4(0, 0, 0);
+        }
 
-            // Compute effective offsets to the buffer
-            int x, y, outIdx;
-            if (tileEnabled)
+        bool batchDone = true;
+        for (int s = 0; s < item.SampleCount; s++)
+        {
+            // Drop the rest of the batch if we're exiting or the trace was restarted underneath us
+            if (tracer->ThreadExitRequested.load() || tracer->Scheduler.IsStale(item))
             {
-                // Figure out which tile we are on
-                const int tileId     = curOffset / tileArea;
-                const int tileOffset = curOffset % tileArea;
-                const int tileX      = tileId % numXTiles;
-                const int tileY      = tileId / numXTiles;
-
-                // Compute offsets
-                x      = (tileX * tileLength) + (tileOffset % tileLength);
-                y      = (tileY * tileLength) + (tileOffset / tileLength);
-                outIdx = (y * tracer->OutputWidth) + x;
+                batchDone = false;
+                break;
             }
-            else
+
+            const int sampleIndex = item.SampleStart + s;
+            if (wave != nullptr)
             {
-                // Trace via scan-lines
-                x      = curOffset % tracer->OutputWidth;
-                y      = curOffset / tracer->OutputWidth;
-                outIdx = curOffset;
-            }
+                // Camera rays go out in packet sized blocks, so the first bounce still traces coherently
+                int numPaths = 0;
+                for (int py = 0; py < tile.Height; py += PrimaryPacketLength)
+                {
+                    for (int px = 0; px < tile.Width; px += PrimaryPacketLength)
+                    {
+                        const int packetWidth  = GetMin(PrimaryPacketLength, tile.Width - px);
+                        const int packetHeight = GetMin(PrimaryPacketLength, tile.Height - py);
+                        for (int i = 0; i < (packetWidth * packetHeight); i++)
+                        {
+                            const int tx = px + (i % packetWidth);
+                            const int ty = py + (i / packetWidth);
+                            wave->Rays[numPaths]      = makeCameraRay(tile.X + tx, tile.Y + ty, sampleIndex);
+                            wave->PathIndex[numPaths] = (ty * tile.Width) + tx;
+                            numPaths++;
+                        }
+                    }
+                }
 
-            // Get a random ray to the pixel
-            const float u = 0.f + float(x + RandomFloat()) / float(tracer->OutputWidth);
-            const float v = 1.f - float(y + RandomFloat()) / float(tracer->OutputHeight);
-            const Ray   r = scene->GetCamera().GetRay(u, v);
+                tracer->traceWavefront(scene, tile, sampleIndex, numPaths, *wave, accumSlab.data());
+                continue;
+            }
 
-            // Trace and accumulate color to output buffer
-            tracer->OutputBuffer[outIdx] += tracer->trace(scene, r, 0);
+            if (!tracer->PacketTracing)
+            {
+                for (int ty = 0; ty < tile.Height; ty++)
+                {
+                    for (int tx = 0; tx < tile.Width; tx++)
+                    {
+                        // Trace and accumulate color to the slab
+                        const Ray r = makeCameraRay(tile.X + tx, tile.Y + ty, sampleIndex);
+                        accumSlab[(ty * tile.Width) + tx] += tracer->trace(scene, r, 0);
+                    }
+                }
+                continue;
+            }
 
-            // Write RGBA (for previewing)
+            // Neighbouring camera rays take nearly the same path, so they go through the scene as one packet
+            for (int py = 0; py < tile.Height; py += PrimaryPacketLength)
             {
-                const int64_t numSamples = (pixelSampleOffset / int64_t(numPixels)) + 1;
-                Vec4          curCol     = tracer->OutputBuffer[outIdx] * float(1.0 / double(numSamples));
+                for (int px = 0; px < tile.Width; px += PrimaryPacketLength)
+                {
+                    const int packetWidth  = GetMin(PrimaryPacketLength, tile.Width - px);
+                    const int packetHeight = GetMin(PrimaryPacketLength, tile.Height - py);
+                    const int numRays      = packetWidth * packetHeight;
+                    for (int i = 0; i < numRays; i++)
+                    {
+                        packetRays[i] = makeCameraRay(tile.X + px + (i % packetWidth), tile.Y + py + (i / packetWidth), sampleIndex);
+                        packetTMax[i] = FLT_MAX;
+                        packetHits[i] = false;
+                    }
 
-                int rgbaOffset = outIdx * 4;
-                int ir, ig, ib, ia;
-                GetRGBA8888(curCol, false, ir, ig, ib, ia);
+                    tracer->TotalRaysFired += numRays;
+                    scene->GetWorld()->HitPacket(packetRays.data(), numRays, 0.001f, packetTMax, packetRecs.data(), packetHits);
 
-                tracer->OutputBufferRGBA8888[rgbaOffset + 0] = (uint8_t)ir;
-                tracer->OutputBufferRGBA8888[rgbaOffset + 1] = (uint8_t)ig;
-                tracer->OutputBufferRGBA8888[rgbaOffset + 2] = (uint8_t)ib;
-                tracer->OutputBufferRGBA8888[rgbaOffset + 3] = (uint8_t)ia;
+                    // Bounces are traced ray by ray
+                    for (int i = 0; i < numRays; i++)
+                    {
+                        const int tx = px + (i % packetWidth);
+                        const int ty = py + (i / packetWidth);
+                        if (!packetHits[i])
+                        {
+                            accumSlab[(ty * tile.Width) + tx] += scene->GetCamera().GetBackgroundColor();
+                            continue;
+                        }
+
+                        // Pick the pixel's sample back up where its camera ray left off
+                        if (sampler != nullptr)
+                        {
+                            sampler->StartPixelSample(tile.X + tx, tile.Y + ty, sampleIndex);
+                        }
+                        accumSlab[(ty * tile.Width) + tx] += tracer->shade(scene, packetRays[i], packetRecs[i], 0);
+                    }
+                }
             }
         }
+
+        if (!batchDone)
+        {
+            continue;
+        }
+
+        // Merge the slab and requeue the tile. Batches of a tile are merged one after the other, in sample order.
+        tracer->Scheduler.Complete(id, item, [tracer, &tile, &item, &accumSlab]()
+        {
+            tracer->mergeTileSlab(item.TileIndex, accumSlab.data(), item.SampleStart + item.SampleCount);
+            tracer->NumPixelSamplesDone += int64_t(tile.Width) * int64_t(tile.Height) * int64_t(item.SampleCount);
+        });
     }
 
+    // Pool threads outlive this trace
+    SetThreadSampler(nullptr);
+    delete wave;
+
     // This thread is done
     tracer->NumThreadsDone++;
 
@@ -277,7 +540,7 @@ void Raytracer::threadTraceNextPixel(int id, Raytracer* tracer, WorldScene* scen
         tracer->EndTime = std::chrono::system_clock::now();
         if (tracer->OnComplete != nullptr)
         {
-            bool actuallyFinished = tracer->CurrentPixelSampleOffset.load() == totalPixelSamples;
+            bool actuallyFinished = tracer->NumPixelSamplesDone.load() == totalPixelSamples;
             tracer->OnComplete(tracer, actuallyFinished);
         }
 
@@ -286,33 +549,158 @@ void Raytracer::threadTraceNextPixel(int id, Raytracer* tracer, WorldScene* scen
     }
 }
 
+Raytracer::WavefrontState::WavefrontState(int maxPaths)
+{
+    Rays          = new Ray[maxPaths];
+    NextRays      = new Ray[maxPaths];
+    PathIndex     = new int[maxPaths];
+    NextPathIndex = new int[maxPaths];
+    Records       = new HitRecord[maxPaths];
+    TMax          = new float[maxPaths];
+    Hits          = new bool[maxPaths];
+    Throughput    = new Vec4[maxPaths];
+    Radiance      = new Vec4[maxPaths];
+    ShadeOrder    = new ShadeEntry[maxPaths];
+    RayKeys       = new uint32_t[maxPaths];
+    RayOrder      = new int[maxPaths];
+    RayOrderTemp  = new int[maxPaths];
+}
+
 // ----------------------------------------------------------------------------------------------------------------------------
 
-Vec4 Raytracer::trace(WorldScene* scene, const Ray& r, int depth)
+Raytracer::WavefrontState::~WavefrontState()
 {
-    // Bail if we're requested to exit
-    if (ThreadExitRequested.load() == true)
+    delete[] Rays;
+    delete[] NextRays;
+    delete[] PathIndex;
+    delete[] NextPathIndex;
+    delete[] Records;
+    delete[] TMax;
+    delete[] Hits;
+    delete[] Throughput;
+    delete[] Radiance;
+    delete[] ShadeOrder;
+    delete[] RayKeys;
+    delete[] RayOrder;
+    delete[] RayOrderTemp;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void Raytracer::traceWavefront(WorldScene* scene, const TileScheduler::Tile& tile, int sampleIndex, int numPaths, WavefrontState& wave, Vec4* accumSlab)
+{
+    // Expects the camera rays and their slab indices in wave.Rays and wave.PathIndex. Paths are indexed by their pixel
+    // in the slab, rays by their slot in the current wave.
+    Sampler*   sampler    = GetThreadSampler();
+    const Vec4 background = scene->GetCamera().GetBackgroundColor();
+    for (int i = 0; i < numPaths; i++)
     {
-        return scene->GetCamera().GetBackgroundColor();
+        wave.Throughput[wave.PathIndex[i]] = Vec4(1, 1, 1);
+        wave.Radiance[wave.PathIndex[i]]   = Vec4(0, 0, 0);
     }
 
-    // Increment num rays fired
-    TotalRaysFired++;
-
-    // Let's do the path trace
-    HitRecord hitRec;
-    if (scene->GetWorld()->Hit(r, 0.001f, FLT_MAX, hitRec))
+    int numActive = numPaths;
+    for (int depth = 0; numActive > 0; depth++)
     {
-        // We got a hit, get the emitted color
-        const Vec4 emitted = hitRec.MatPtr->Emitted(r, hitRec, hitRec.U, hitRec.V, hitRec.P);
+        if (ThreadExitRequested.load() == true)
+        {
+            break;
+        }
+
+        // Camera rays already go out coherently, bounces get sorted first if asked
+        if (RayReordering && depth > 0)
+        {
+            reorderWave(wave, numActive);
+        }
+
+        // Intersect the whole wave. Bounces spread out too far for packet culling to pay, even once sorted, so only
+        // camera rays go through as packets.
+        TotalRaysFired += numActive;
+        if (depth == 0)
+        {
+            for (int i = 0; i < numActive; i++)
+            {
+                wave.TMax[i] = FLT_MAX;
+                wave.Hits[i] = false;
+            }
+
+            scene->GetWorld()->HitPacket(wave.Rays, numActive, 0.001f, wave.TMax, wave.Records, wave.Hits);
+        }
+        else if (InterleavedTracing)
+        {
+            // Bounces have nothing in common, but taking turns lets one ray's cache misses hide behind another's work
+            for (int i = 0; i < numActive; i++)
+            {
+                wave.TMax[i] = FLT_MAX;
+                wave.Hits[i] = false;
+            }
 
-        // Test for ray scatter
-        Material::ScatterRecord scatterRec;
-        if (depth < MaxDepth && hitRec.MatPtr->Scatter(r, hitRec, scatterRec))
+            scene->GetWorld()->HitStream(wave.Rays, numActive, 0.001f, wave.TMax, wave.Records, wave.Hits);
+        }
+        else
+        {
+            for (int i = 0; i < numActive; i++)
+            {
+                wave.Hits[i] = scene->GetWorld()->Hit(wave.Rays[i], 0.001f, FLT_MAX, wave.Records[i]);
+            }
+        }
+
+        // Misses pick up the background. Hits are sorted by material, so each kind gets shaded back to back.
+        int numHits = 0;
+        for (int i = 0; i < numActive; i++)
+        {
+            if (!wave.Hits[i])
+            {
+                const int path = wave.PathIndex[i];
+                wave.Radiance[path] += wave.Throughput[path] * background;
+                continue;
+            }
+
+            const Material* mat = wave.Records[i].MatPtr;
+            wave.ShadeOrder[numHits++] = { typeid(*mat).hash_code(), mat->GetId(), i };
+        }
+
+        std::sort(wave.ShadeOrder, wave.ShadeOrder + numHits, [](const ShadeEntry& a, const ShadeEntry& b)
         {
+            if (a.MaterialType != b.MaterialType)
+            {
+                return a.MaterialType < b.MaterialType;
+            }
+            // Shading draws random numbers, so the order can't depend on where materials sit in memory, or a fixed
+            // seed wouldn't give the same image every run
+            return (a.MaterialId != b.MaterialId) ? (a.MaterialId < b.MaterialId) : (a.RayIndex < b.RayIndex);
+        });
+
+        // Shade, and queue the bounces of paths that keep going
+        int numNext = 0;
+        for (int k = 0; k < numHits; k++)
+        {
+            const int  i      = wave.ShadeOrder[k].RayIndex;
+            const int  path   = wave.PathIndex[i];
+            const Ray& r      = wave.Rays[i];
+            HitRecord& hitRec = wave.Records[i];
+
+            // Same sampler dimensions the recursive integrator would use for this bounce
+            if (sampler != nullptr)
+            {
+                sampler->StartPixelSample(tile.X + (path % tile.Width), tile.Y + (path / tile.Width), sampleIndex);
+                sampler->SetDimension(CameraSampleDimensions + (depth * BounceSampleDimensions));
+            }
+
+            const Vec4 emitted = hitRec.MatPtr->Emitted(r, hitRec, hitRec.U, hitRec.V, hitRec.P);
+
+            Material::ScatterRecord scatterRec;
+            if (depth >= MaxDepth || !hitRec.MatPtr->Scatter(r, hitRec, scatterRec))
+            {
+                // Path ends here
+                wave.Radiance[path] += wave.Throughput[path] * emitted;
+                continue;
+            }
+
             if (scatterRec.IsSpecular)
             {
-                return scatterRec.Attenuation * trace(scene, scatterRec.SpecularRay, depth + 1);
+                wave.Throughput[path]   *= scatterRec.Attenuation;
+                wave.NextRays[numNext]   = scatterRec.SpecularRay;
             }
             else
             {
@@ -321,7 +709,6 @@ Vec4 Raytracer::trace(WorldScene* scene, const Ray& r, int depth)
                 float pdfValue   = 1.f;
                 if (PdfEnabled)
                 {
-                    // Prepare the pdf query
                     HitablePdf  hitablePdf(scene->GetLightShapes(), hitRec.P);
                     MixturePdf  mixPdf(&hitablePdf, scatterRec.PdfPtr);
                     Pdf*        pdf = scatterRec.PdfPtr;
@@ -341,19 +728,224 @@ Vec4 Raytracer::trace(WorldScene* scene, const Ray& r, int depth)
                     pdfValue = 1.0f;
                 }
 
-                // Compute the aggregate color
-                const Vec4 color = trace(scene, scattered, depth + 1);
-                const Vec4 ret   = emitted + (scatterRec.Attenuation * scatterPdf * color / pdfValue);
-
-                VEC3_SANITY_CHECK(ret);
-                return ret;
+                wave.Radiance[path]     += wave.Throughput[path] * emitted;
+                wave.Throughput[path]   *= scatterRec.Attenuation * scatterPdf / pdfValue;
+                wave.NextRays[numNext]   = scattered;
             }
+
+            wave.NextPathIndex[numNext++] = path;
         }
-       
-        // No scattering, or reached max depth. Return emitted color
-        return emitted;
+
+        std::swap(wave.Rays, wave.NextRays);
+        std::swap(wave.PathIndex, wave.NextPathIndex);
+        numActive = numNext;
     }
-    
+
+    for (int i = 0; i < numPaths; i++)
+    {
+        accumSlab[i] += wave.Radiance[i];
+    }
+}
+
+void Raytracer::reorderWave(WavefrontState& wave, int numRays)
+{
+    // Key each ray by its direction octant, then by the Morton code of the grid cell its origin falls in. Rays that
+    // start close together and head the same way then run back to back, and mostly visit the same BVH nodes.
+    const Vec4  boxMin   = wave.SceneBox.Min();
+    const Vec4  boxMax   = wave.SceneBox.Max();
+    const float maxCell  = float((1 << ReorderCellBits) - 1);
+    float       scale[3];
+    for (int axis = 0; axis < 3; axis++)
+    {
+        const float extent = boxMax[axis] - boxMin[axis];
+        scale[axis] = (extent > 0.f) ? (maxCell / extent) : 0.f;
+    }
+
+    for (int i = 0; i < numRays; i++)
+    {
+        const Vec4 origin    = wave.Rays[i].Origin();
+        const Vec4 direction = wave.Rays[i].Direction();
+
+        uint32_t cell[3];
+        uint32_t octant = 0;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            cell[axis] = uint32_t(Clamp((origin[axis] - boxMin[axis]) * scale[axis], 0.f, maxCell));
+            octant    |= (direction[axis] < 0.f) ? (1 << axis) : 0;
+        }
+
+        wave.RayKeys[i]  = (octant << (3 * ReorderCellBits)) |
+            (ExpandMortonBits(cell[0]) << 2) | (ExpandMortonBits(cell[1]) << 1) | ExpandMortonBits(cell[2]);
+        wave.RayOrder[i] = i;
+    }
+
+    // Keys are short, so a couple of stable radix passes beat a comparison sort by a wide margin
+    int* source = wave.RayOrder;
+    int* dest   = wave.RayOrderTemp;
+    for (int shift = 0; shift < ReorderKeyBits; shift += ReorderRadixBits)
+    {
+        const int NumBuckets = 1 << ReorderRadixBits;
+        int       offsets[NumBuckets] = {};
+        for (int i = 0; i < numRays; i++)
+        {
+            offsets[(wave.RayKeys[source[i]] >> shift) & (NumBuckets - 1)]++;
+        }
+
+        int sum = 0;
+        for (int b = 0; b < NumBuckets; b++)
+        {
+            const int count = offsets[b];
+            offsets[b] = sum;
+            sum       += count;
+        }
+
+        for (int i = 0; i < numRays; i++)
+        {
+            dest[offsets[(wave.RayKeys[source[i]] >> shift) & (NumBuckets - 1)]++] = source[i];
+        }
+
+        std::swap(source, dest);
+    }
+
+    for (int i = 0; i < numRays; i++)
+    {
+        wave.NextRays[i]      = wave.Rays[source[i]];
+        wave.NextPathIndex[i] = wave.PathIndex[source[i]];
+    }
+
+    std::swap(wave.Rays, wave.NextRays);
+    std::swap(wave.PathIndex, wave.NextPathIndex);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void Raytracer::mergeTileSlab(int tileIndex, const Vec4* accumSlab, int numSamples)
+{
+    const TileScheduler::Tile& tile = Scheduler.GetTile(tileIndex);
+    for (int ty = 0; ty < tile.Height; ty++)
+    {
+        // Slab rows map to contiguous runs in the output
+        Vec4*       outRow  = &OutputBuffer[((tile.Y + ty) * OutputWidth) + tile.X];
+        const Vec4* slabRow = &accumSlab[ty * tile.Width];
+
+        for (int tx = 0; tx < tile.Width; tx++)
+        {
+            outRow[tx] += slabRow[tx];
+        }
+    }
+
+    // Flag the tile for the next preview update
+    TileSampleCounts[tileIndex] = numSamples;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void Raytracer::updatePreviewTile(int tileIndex, int numSamples)
+{
+    // Expects PreviewMutex to be held. A tile may be merged into while we read it, which only skews this preview.
+    const TileScheduler::Tile& tile          = Scheduler.GetTile(tileIndex);
+    const float                invNumSamples = float(1.0 / double(GetMax(numSamples, 1)));
+    for (int ty = 0; ty < tile.Height; ty++)
+    {
+        const int rowOffset = ((tile.Y + ty) * OutputWidth) + tile.X;
+        for (int tx = 0; tx < tile.Width; tx++)
+        {
+            const int outIdx     = rowOffset + tx;
+            const int rgbaOffset = outIdx * 4;
+
+            int ir, ig, ib, ia;
+            GetRGBA8888(OutputBuffer[outIdx] * invNumSamples, false, ir, ig, ib, ia);
+
+            OutputBufferRGBA8888[rgbaOffset + 0] = (uint8_t)ir;
+            OutputBufferRGBA8888[rgbaOffset + 1] = (uint8_t)ig;
+            OutputBufferRGBA8888[rgbaOffset + 2] = (uint8_t)ib;
+            OutputBufferRGBA8888[rgbaOffset + 3] = (uint8_t)ia;
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+Vec4 Raytracer::trace(WorldScene* scene, const Ray& r, int depth)
+{
+    // Bail if we're requested to exit
+    if (ThreadExitRequested.load() == true)
+    {
+        return scene->GetCamera().GetBackgroundColor();
+    }
+
+    // Increment num rays fired
+    TotalRaysFired++;
+
+    // Let's do the path trace
+    HitRecord hitRec;
+    if (scene->GetWorld()->Hit(r, 0.001f, FLT_MAX, hitRec))
+    {
+        return shade(scene, r, hitRec, depth);
+    }
+
     // No hits, return background color
     return scene->GetCamera().GetBackgroundColor();
 }
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+Vec4 Raytracer::shade(WorldScene* scene, const Ray& r, HitRecord& hitRec, int depth)
+{
+    // Each bounce draws from its own block of sampler dimensions, however many the last bounce used
+    Sampler* sampler = GetThreadSampler();
+    if (sampler != nullptr)
+    {
+        sampler->SetDimension(CameraSampleDimensions + (depth * BounceSampleDimensions));
+    }
+
+    // We got a hit, get the emitted color
+    const Vec4 emitted = hitRec.MatPtr->Emitted(r, hitRec, hitRec.U, hitRec.V, hitRec.P);
+
+    // Test for ray scatter
+    Material::ScatterRecord scatterRec;
+    if (depth < MaxDepth && hitRec.MatPtr->Scatter(r, hitRec, scatterRec))
+    {
+        if (scatterRec.IsSpecular)
+        {
+            return scatterRec.Attenuation * trace(scene, scatterRec.SpecularRay, depth + 1);
+        }
+        else
+        {
+            Ray   scattered  = scatterRec.ScatteredClassic;
+            float scatterPdf = 1.f;
+            float pdfValue   = 1.f;
+            if (PdfEnabled)
+            {
+                // Prepare the pdf query
+                HitablePdf  hitablePdf(scene->GetLightShapes(), hitRec.P);
+                MixturePdf  mixPdf(&hitablePdf, scatterRec.PdfPtr);
+                Pdf*        pdf = scatterRec.PdfPtr;
+                if (scene->GetLightShapes() != nullptr)
+                {
+                    pdf = &mixPdf;
+                }
+
+                scattered  = Ray(hitRec.P, pdf->Generate(), r.Time());
+                pdfValue   = pdf->Value(scattered.Direction());
+                scatterPdf = hitRec.MatPtr->ScatteringPdf(r, hitRec, scattered);
+            }
+
+            // Clamp bad pdf values
+            if (isnan(pdfValue) || isinf(pdfValue))
+            {
+                pdfValue = 1.0f;
+            }
+
+            // Compute the aggregate color
+            const Vec4 color = trace(scene, scattered, depth + 1);
+            const Vec4 ret   = emitted + (scatterRec.Attenuation * scatterPdf * color / pdfValue);
+
+            VEC3_SANITY_CHECK(ret);
+            return ret;
+        }
+    }
+   
+    // No scattering, or reached max depth. Return emitted color
+    return emitted;
+}
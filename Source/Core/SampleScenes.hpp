@@ -287,34 +287,41 @@ static WorldScene* sampleSceneMesh()
         lsList[numLs++]      = lightShape;
     }
 
-    // Meshes
+    // Meshes, as instances of shared mesh BVHs under one top level BVH
     {
+        const Vec4 yAxis(0, 1, 0);
 
-        IHitable *r8 =
-            new HitableTranslate(
-                new HitableRotateY(
-                    TriMesh::CreateFromOBJFile(GetAbsolutePath(RUNTIMEDATA_DIR "/r8.obj").c_str(), 25.f, false), 20.f),
-                Vec4(220, 105, 145)
-            );
-        list[total++] = r8;
+        IHitable* r8Mesh     = TriMesh::CreateFromOBJFile(GetAbsolutePath(RUNTIMEDATA_DIR "/r8.obj").c_str(), 25.f, false);
+        IHitable* totoroMesh = TriMesh::CreateFromOBJFile(GetAbsolutePath(RUNTIMEDATA_DIR "/totoro.obj").c_str(), 10.f, false, new MMetal(new ConstantTexture(colorSapphire), 0.125f));
+        IHitable* luigiMesh  = TriMesh::CreateFromOBJFile(GetAbsolutePath(RUNTIMEDATA_DIR "/luigi.obj").c_str(), 2.f);
 
-#if 1
-        IHitable *totoro =
-            new HitableTranslate(
-                new HitableRotateY(
-                    TriMesh::CreateFromOBJFile(GetAbsolutePath(RUNTIMEDATA_DIR "/totoro.obj").c_str(), 10.f, false, new MMetal(new ConstantTexture(colorSapphire), 0.125f)), 180.f),
-                Vec4(-60, 105, 145)
-            );
-        list[total++] = totoro;
+        // Meshes whose OBJ couldn't be loaded are left out, an instance needs something to point at
+        IHitable** instances    = new IHitable*[3];
+        int        numInstances = 0;
 
-        IHitable *luigi =
-            new HitableTranslate(
-                new HitableRotateY(
-                    TriMesh::CreateFromOBJFile(GetAbsolutePath(RUNTIMEDATA_DIR "/luigi.obj").c_str(), 2.f), 180.f),
-                Vec4(-320, 105, -100)
-            );
-        list[total++] = luigi;
-#endif
+        if (r8Mesh != nullptr)
+        {
+            instances[numInstances++] = new HitableInstance(std::shared_ptr<IHitable>(r8Mesh), AffineTransform::Translation(Vec4(220, 105, 145)) * AffineTransform::Rotation(yAxis, 20.f));
+        }
+        if (totoroMesh != nullptr)
+        {
+            instances[numInstances++] = new HitableInstance(std::shared_ptr<IHitable>(totoroMesh), AffineTransform::Translation(Vec4(-60, 105, 145)) * AffineTransform::Rotation(yAxis, 180.f));
+        }
+        if (luigiMesh != nullptr)
+        {
+            instances[numInstances++] = new HitableInstance(std::shared_ptr<IHitable>(luigiMesh), AffineTransform::Translation(Vec4(-320, 105, -100)) * AffineTransform::Rotation(yAxis, 180.f));
+        }
+
+        if (numInstances > 0)
+        {
+            list[total++] = new BVHNode(instances, numInstances, 0, 1);
+        }
+        else
+        {
+            DEBUG_PRINTF("Couldn't load any of the sample meshes\n");
+        }
+
+        delete[] instances;
     }
 
     // Dielectric and metal spheres
@@ -0,0 +1,173 @@
+// ----------------------------------------------------------------------------------------------------------------------------
+// 
+// Copyright 2019 Khoi Nguyen
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+//    The above copyright notice and this permission notice shall be included in all copies or substantial
+//    portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+// 
+// ----------------------------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include "RandomGenerator.h"
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+namespace Core
+{
+    // Hands out the sample values for one pixel sample, one dimension at a time.
+    // Callers that want stratified samples (pixel, lens, time, bsdf, lights) pull from here instead of RandomFloat().
+    class Sampler
+    {
+    public:
+
+        virtual ~Sampler() {}
+
+        virtual void  StartPixelSample(int pixelX, int pixelY, int sampleIndex) = 0;
+        virtual float Get1D() = 0;
+        virtual void  Get2D(float& u, float& v) = 0;
+
+        inline void   SetDimension(int dimension)   { Dimension = dimension; }
+        inline int    GetDimension() const          { return Dimension; }
+
+    protected:
+
+        int Dimension = 0;
+    };
+
+    // ----------------------------------------------------------------------------------------------------------------------------
+
+    // Owen scrambled Sobol (0,2) sequence, padded per dimension.
+    // Every dimension reuses the first two Sobol dimensions with its own index shuffle and scramble, seeded
+    // from the pixel and dimension (Burley, "Practical Hash-based Owen Scrambling", JCGT 2020).
+    class SobolSampler : public Sampler
+    {
+    public:
+
+        inline SobolSampler(uint32_t seed = 0) : Seed(seed), PixelSeed(0), SampleIndex(0) {}
+
+        inline void SetSeed(uint32_t seed)
+        {
+            Seed = seed;
+        }
+
+        virtual void StartPixelSample(int pixelX, int pixelY, int sampleIndex)
+        {
+            PixelSeed   = RandomGenerator::HashSeed(Seed, uint32_t(pixelX), uint32_t(pixelY));
+            SampleIndex = uint32_t(sampleIndex);
+            Dimension   = 0;
+        }
+
+        virtual float Get1D()
+        {
+            uint32_t x, y;
+            sample2D(x, y);
+            return toFloat(x);
+        }
+
+        virtual void Get2D(float& u, float& v)
+        {
+            uint32_t x, y;
+            sample2D(x, y);
+            u = toFloat(x);
+            v = toFloat(y);
+        }
+
+    private:
+
+        inline void sample2D(uint32_t& x, uint32_t& y)
+        {
+            const uint32_t dimSeed = RandomGenerator::HashSeed(PixelSeed, uint32_t(Dimension++));
+            const uint32_t index   = nestedUniformScramble(SampleIndex, dimSeed);
+
+            x = nestedUniformScramble(sobolDim0(index), RandomGenerator::HashSeed(dimSeed, 0));
+            y = nestedUniformScramble(sobolDim1(index), RandomGenerator::HashSeed(dimSeed, 1));
+        }
+
+        static inline float toFloat(uint32_t x)
+        {
+            return float(x >> 8) * (1.f / 16777216.f);
+        }
+
+        static inline uint32_t reverseBits(uint32_t x)
+        {
+            x = (x << 16) | (x >> 16);
+            x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+            x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+            x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+            x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+            return x;
+        }
+
+        static inline uint32_t laineKarrasPermutation(uint32_t x, uint32_t seed)
+        {
+            // Each bit only affects the bits above it, which is what makes this an Owen scramble once reversed
+            x += seed;
+            x ^= x * 0x6c50b47cu;
+            x ^= x * 0xb82f1e52u;
+            x ^= x * 0xc7afe638u;
+            x ^= x * 0x8d22f6e6u;
+            return x;
+        }
+
+        static inline uint32_t nestedUniformScramble(uint32_t x, uint32_t seed)
+        {
+            return reverseBits(laineKarrasPermutation(reverseBits(x), seed));
+        }
+
+        static inline uint32_t sobolDim0(uint32_t index)
+        {
+            return reverseBits(index);
+        }
+
+        static inline uint32_t sobolDim1(uint32_t index)
+        {
+            uint32_t result = 0;
+            for (uint32_t v = 1u << 31; index != 0; index >>= 1, v ^= v >> 1)
+            {
+                if (index & 1)
+                {
+                    result ^= v;
+                }
+            }
+
+            return result;
+        }
+
+    private:
+
+        uint32_t Seed;
+        uint32_t PixelSeed;
+        uint32_t SampleIndex;
+    };
+
+    // ----------------------------------------------------------------------------------------------------------------------------
+
+    // The sampler the current thread is tracing with, or null to fall back to plain random numbers
+    inline Sampler*& ThreadSamplerSlot()
+    {
+        static thread_local Sampler* sampler = nullptr;
+        return sampler;
+    }
+
+    inline Sampler* GetThreadSampler()
+    {
+        return ThreadSamplerSlot();
+    }
+
+    inline void SetThreadSampler(Sampler* sampler)
+    {
+        ThreadSamplerSlot() = sampler;
+    }
+}
@@ -0,0 +1,93 @@
+// ----------------------------------------------------------------------------------------------------------------------------
+// 
+// Copyright 2019 Khoi Nguyen
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+//    The above copyright notice and this permission notice shall be included in all copies or substantial
+//    portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+// 
+// ----------------------------------------------------------------------------------------------------------------------------
+
+#pragma once
+#include <vector>
+#include "IHitable.h"
+#include "AffineTransform.h"
+#include "CoreTriangle.h"
+#include "XYZRect.h"
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+namespace Core
+{
+    class BVHNode;
+    class WorldScene;
+
+    // ----------------------------------------------------------------------------------------------------------------------------
+
+    // Bakes the transforms and normal flips of a scene into world space primitives, walking the hitable tree the same
+    // way the realtime renderer builds its render list. Rendering the result skips the translate, rotate, instance and
+    // flip wrappers on every ray. Anything that can't be baked exactly, such as a volume or a rotated sphere whose
+    // image texture would turn with it, stays as it was behind a single instance transform.
+    class SceneFlattener
+    {
+    public:
+
+        // Flattened scenes are often just a mesh plus a few primitives, where a linear list in front of the mesh costs
+        // more than the wrappers saved, so they get a top level BVH sooner than WorldScene::AutoBVHThreshold
+        static const int TopLevelBVHThreshold = 2;
+
+        struct Stats
+        {
+            int         NumTriangles;
+            int         NumPrimitives;
+            int         NumWrappersRemoved;     // Translate, rotate, instance and flip wrappers baked away
+            int         NumUnbaked;             // Hitables left behind an instance transform
+        };
+
+        struct Output
+        {
+            std::vector<Triangle*>   Triangles;     // Mesh triangles, and rects and boxes that had to be tessellated
+            std::vector<IHitable*>   Primitives;    // Everything else
+            Stats                    Counts;
+        };
+
+        // Appends the world space primitives under head to out. They are all new and belong to the caller, but
+        // their materials, and whatever the unbaked ones point at, still belong to head.
+        static void         Flatten(IHitable* head, Output& out);
+
+        // Flattens the scene's world into a new scene, with the triangles under one BVH of triangle blocks. The new
+        // scene takes over the old one and keeps it alive for the above. Instanced meshes get a copy per instance.
+        static WorldScene*  Flatten(WorldScene* scene, Stats* stats = nullptr);
+
+    private:
+
+        struct State
+        {
+            AffineTransform  ObjectToWorld;
+            AffineTransform  WorldToObject;
+            bool             TranslationOnly;
+            bool             Rigid;             // Rotation and translation only
+            bool             FlipNormals;
+        };
+
+        static void         flattenNode(IHitable* head, const State& state, Output& out);
+        static void         flattenBVH(BVHNode* root, const State& state, Output& out);
+        static void         flattenWrapped(IHitable* hitObject, const State& state, Output& out);
+        static bool         canBake(IHitable* head, const State& state);
+        static bool         canBakeSphere(Material* mat, const State& state);
+        static State        applyTransform(const State& state, const AffineTransform& objectToWorld);
+        static void         addRect(XYZRect::AxisPlane axis, float a0, float a1, float b0, float b1, float k, Material* mat,
+                                    bool isLightShape, const State& state, Output& out);
+        static void         addTriangle(const Triangle::Vertex vertices[3], Material* mat, const State& state, Output& out);
+        static void         addUnbaked(IHitable* hitable, const State& state, Output& out);
+    };
+}
@@ -0,0 +1,513 @@
+// ----------------------------------------------------------------------------------------------------------------------------
+// 
+// Copyright 2019 Khoi Nguyen
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+//    The above copyright notice and this permission notice shall be included in all copies or substantial
+//    portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+// 
+// ----------------------------------------------------------------------------------------------------------------------------
+
+#include "SceneFlattener.h"
+#include "BVHNode.h"
+#include "CoreTexture.h"
+#include "FlipNormals.h"
+#include "HitableBox.h"
+#include "HitableList.h"
+#include "HitableTransform.h"
+#include "MovingSphere.h"
+#include "Sphere.h"
+#include "TriangleBlock.h"
+#include "TriMesh.h"
+#include "WorldScene.h"
+#include <memory>
+#include <typeinfo>
+#include <unordered_set>
+
+using namespace Core;
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+static inline bool isTranslation(const AffineTransform& xform)
+{
+    for (int row = 0; row < 3; row++)
+    {
+        for (int col = 0; col < 3; col++)
+        {
+            if (xform.Get(row, col) != ((row == col) ? 1.f : 0.f))
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+static inline bool isRigid(const AffineTransform& xform)
+{
+    // Rows orthonormal
+    for (int a = 0; a < 3; a++)
+    {
+        for (int b = a; b < 3; b++)
+        {
+            const float d = xform.Get(a, 0) * xform.Get(b, 0) + xform.Get(a, 1) * xform.Get(b, 1) + xform.Get(a, 2) * xform.Get(b, 2);
+            if (fabsf(d - ((a == b) ? 1.f : 0.f)) > 1e-4f)
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+static inline bool isImageTexture(BaseTexture* tex)
+{
+    return (tex != nullptr) && (typeid(*tex) == typeid(ImageTexture));
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void SceneFlattener::Flatten(IHitable* head, Output& out)
+{
+    State state;
+    state.TranslationOnly = true;
+    state.Rigid           = true;
+    state.FlipNormals     = false;
+
+    flattenNode(head, state, out);
+
+    out.Counts.NumTriangles  = int(out.Triangles.size());
+    out.Counts.NumPrimitives = int(out.Primitives.size());
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+WorldScene* SceneFlattener::Flatten(WorldScene* scene, Stats* stats /*= nullptr*/)
+{
+    Output out = {};
+    Flatten(scene->GetWorld(), out);
+
+    const int  numTriangleMeshes = out.Triangles.empty() ? 0 : 1;
+    const int  numHitables       = int(out.Primitives.size()) + numTriangleMeshes;
+    IHitable** hitables          = new IHitable*[numHitables];
+    for (size_t i = 0; i < out.Primitives.size(); i++)
+    {
+        hitables[i] = out.Primitives[i];
+    }
+
+    if (numTriangleMeshes > 0)
+    {
+        hitables[numHitables - 1] = TriMesh::CreateFromTriangles(out.Triangles);
+    }
+
+    // Light shapes are still the old scene's, which stays alive
+    HitableList* lightShapes     = scene->GetLightShapes();
+    IHitable**   lightShapesList = nullptr;
+    int          numLightShapes  = 0;
+    if (lightShapes != nullptr && lightShapes->GetListSize() > 0)
+    {
+        numLightShapes  = lightShapes->GetListSize();
+        lightShapesList = new IHitable*[numLightShapes];
+        for (int i = 0; i < numLightShapes; i++)
+        {
+            lightShapesList[i] = lightShapes->GetList()[i];
+        }
+    }
+
+    WorldScene* flatScene = WorldScene::Create(scene->GetCamera(), hitables, numHitables, lightShapesList, numLightShapes,
+                                              TopLevelBVHThreshold);
+    flatScene->Source = scene;
+
+    if (stats != nullptr)
+    {
+        *stats = out.Counts;
+    }
+
+    return flatScene;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void SceneFlattener::flattenNode(IHitable* head, const State& state, Output& out)
+{
+    const std::type_info& tid = typeid(*head);
+
+    if (tid == typeid(HitableList))
+    {
+        HitableList* list = (HitableList*)head;
+        for (int i = 0; i < list->GetListSize(); i++)
+        {
+            flattenNode(list->GetList()[i], state, out);
+        }
+    }
+    else if (tid == typeid(BVHNode))
+    {
+        flattenBVH((BVHNode*)head, state, out);
+    }
+    else if (tid == typeid(HitableTranslate))
+    {
+        HitableTranslate* translate = (HitableTranslate*)head;
+
+        flattenWrapped(translate->GetHitObject(), applyTransform(state, AffineTransform::Translation(translate->GetOffset())), out);
+    }
+    else if (tid == typeid(HitableRotateY))
+    {
+        HitableRotateY* rotateY = (HitableRotateY*)head;
+
+        flattenWrapped(rotateY->GetHitObject(), applyTransform(state, AffineTransform::Rotation(Vec4(0, 1, 0), rotateY->GetAngleDegrees())), out);
+    }
+    else if (tid == typeid(HitableInstance))
+    {
+        HitableInstance* instance = (HitableInstance*)head;
+
+        flattenWrapped(instance->GetHitObject(), applyTransform(state, instance->GetObjectToWorld()), out);
+    }
+    else if (tid == typeid(FlipNormals))
+    {
+        State flipped = state;
+        flipped.FlipNormals = !state.FlipNormals;
+
+        flattenWrapped(((FlipNormals*)head)->GetHitObject(), flipped, out);
+    }
+    else if (tid == typeid(Sphere))
+    {
+        Sphere* sphere = (Sphere*)head;
+        if (canBakeSphere(sphere->GetMaterial(), state))
+        {
+            const Vec4 center = state.ObjectToWorld.TransformPoint(sphere->GetCenter());
+            out.Primitives.push_back(new Sphere(center, sphere->GetRadius(), sphere->GetMaterial(), sphere->IsALightShape()));
+        }
+        else
+        {
+            addUnbaked(head, state, out);
+        }
+    }
+    else if (tid == typeid(MovingSphere))
+    {
+        MovingSphere* sphere = (MovingSphere*)head;
+        if (canBakeSphere(sphere->GetMaterial(), state))
+        {
+            const float time0   = sphere->GetTime0();
+            const float time1   = sphere->GetTime1();
+            const Vec4  center0 = state.ObjectToWorld.TransformPoint(sphere->Center(time0));
+            const Vec4  center1 = state.ObjectToWorld.TransformPoint(sphere->Center(time1));
+            out.Primitives.push_back(new MovingSphere(center0, center1, time0, time1, sphere->GetRadius(), sphere->GetMaterial()));
+        }
+        else
+        {
+            addUnbaked(head, state, out);
+        }
+    }
+    else if (tid == typeid(HitableBox))
+    {
+        HitableBox* box = (HitableBox*)head;
+        Material*   mat = box->GetMaterial();
+
+        Vec4 p0, p1;
+        box->GetPoints(p0, p1);
+
+        if (state.TranslationOnly && !state.FlipNormals)
+        {
+            const Vec4 offset = state.ObjectToWorld.TransformPoint(Vec4(0, 0, 0));
+            out.Primitives.push_back(new HitableBox(p0 + offset, p1 + offset, mat));
+        }
+        else
+        {
+            // Same faces as the box makes for itself, the near ones flipped to face out
+            State flipped = state;
+            flipped.FlipNormals = !state.FlipNormals;
+
+            addRect(XYZRect::XY, p0.X(), p1.X(), p0.Y(), p1.Y(), p1.Z(), mat, false, state, out);
+            addRect(XYZRect::XY, p0.X(), p1.X(), p0.Y(), p1.Y(), p0.Z(), mat, false, flipped, out);
+            addRect(XYZRect::XZ, p0.X(), p1.X(), p0.Z(), p1.Z(), p1.Y(), mat, false, state, out);
+            addRect(XYZRect::XZ, p0.X(), p1.X(), p0.Z(), p1.Z(), p0.Y(), mat, false, flipped, out);
+            addRect(XYZRect::YZ, p0.Y(), p1.Y(), p0.Z(), p1.Z(), p1.X(), mat, false, state, out);
+            addRect(XYZRect::YZ, p0.Y(), p1.Y(), p0.Z(), p1.Z(), p0.X(), mat, false, flipped, out);
+        }
+    }
+    else if (tid == typeid(XYZRect))
+    {
+        XYZRect* rect = (XYZRect*)head;
+
+        float a0, a1, b0, b1, k;
+        rect->GetParams(a0, a1, b0, b1, k);
+        addRect(rect->GetAxisPlane(), a0, a1, b0, b1, k, rect->GetMaterial(), rect->IsALightShape(), state, out);
+    }
+    else if (tid == typeid(TriMesh))
+    {
+        IHitable** triArray = nullptr;
+        int        numTris  = 0;
+
+        ((TriMesh*)head)->GetTriArray(triArray, numTris);
+        for (int t = 0; t < numTris; t++)
+        {
+            Triangle* tri = (Triangle*)triArray[t];
+            addTriangle(tri->GetVertices(), tri->GetMaterial(), state, out);
+        }
+    }
+    else if (tid == typeid(Triangle))
+    {
+        Triangle* tri = (Triangle*)head;
+        addTriangle(tri->GetVertices(), tri->GetMaterial(), state, out);
+    }
+    else if (tid == typeid(TriangleBlock4) || tid == typeid(TriangleBlock8))
+    {
+        // Packed BVH leaves
+        const bool wide = (tid == typeid(TriangleBlock8));
+        const int  n    = wide ? ((TriangleBlock8*)head)->GetNumTriangles() : ((TriangleBlock4*)head)->GetNumTriangles();
+        for (int t = 0; t < n; t++)
+        {
+            Triangle* tri = (Triangle*)(wide ? ((TriangleBlock8*)head)->GetTriangle(t) : ((TriangleBlock4*)head)->GetTriangle(t));
+            addTriangle(tri->GetVertices(), tri->GetMaterial(), state, out);
+        }
+    }
+    else
+    {
+        addUnbaked(head, state, out);
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void SceneFlattener::flattenBVH(BVHNode* root, const State& state, Output& out)
+{
+    // Spatial splits can put a primitive in several leaves, it only gets baked once
+    std::vector<IHitable*> leafPrims;
+    std::vector<BVHNode*>  stack(1, root);
+    while (!stack.empty())
+    {
+        BVHNode* node = stack.back();
+        stack.pop_back();
+
+        if (node->IsLeaf())
+        {
+            for (int i = 0; i < node->GetNumPrimitives(); i++)
+            {
+                leafPrims.push_back(node->GetPrimitive(i));
+            }
+        }
+        else
+        {
+            stack.push_back(node->GetRight());
+            stack.push_back(node->GetLeft());
+        }
+    }
+
+    std::unordered_set<IHitable*> seen;
+    for (IHitable* prim : leafPrims)
+    {
+        if (!root->HasDuplicates() || seen.insert(prim).second)
+        {
+            flattenNode(prim, state, out);
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void SceneFlattener::flattenWrapped(IHitable* hitObject, const State& state, Output& out)
+{
+    // A subtree with something that can't be baked keeps one instance over all of it, rather than one per primitive
+    if (canBake(hitObject, state))
+    {
+        out.Counts.NumWrappersRemoved++;
+        flattenNode(hitObject, state, out);
+    }
+    else
+    {
+        addUnbaked(hitObject, state, out);
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+bool SceneFlattener::canBake(IHitable* head, const State& state)
+{
+    const std::type_info& tid = typeid(*head);
+
+    if (tid == typeid(HitableList))
+    {
+        HitableList* list = (HitableList*)head;
+        for (int i = 0; i < list->GetListSize(); i++)
+        {
+            if (!canBake(list->GetList()[i], state))
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+    else if (tid == typeid(BVHNode))
+    {
+        BVHNode* node = (BVHNode*)head;
+        if (!node->IsLeaf())
+        {
+            return canBake(node->GetLeft(), state) && canBake(node->GetRight(), state);
+        }
+
+        for (int i = 0; i < node->GetNumPrimitives(); i++)
+        {
+            if (!canBake(node->GetPrimitive(i), state))
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+    else if (tid == typeid(HitableTranslate))
+    {
+        HitableTranslate* translate = (HitableTranslate*)head;
+        return canBake(translate->GetHitObject(), applyTransform(state, AffineTransform::Translation(translate->GetOffset())));
+    }
+    else if (tid == typeid(HitableRotateY))
+    {
+        HitableRotateY* rotateY = (HitableRotateY*)head;
+        return canBake(rotateY->GetHitObject(), applyTransform(state, AffineTransform::Rotation(Vec4(0, 1, 0), rotateY->GetAngleDegrees())));
+    }
+    else if (tid == typeid(HitableInstance))
+    {
+        HitableInstance* instance = (HitableInstance*)head;
+        return canBake(instance->GetHitObject(), applyTransform(state, instance->GetObjectToWorld()));
+    }
+    else if (tid == typeid(FlipNormals))
+    {
+        State flipped = state;
+        flipped.FlipNormals = !state.FlipNormals;
+        return canBake(((FlipNormals*)head)->GetHitObject(), flipped);
+    }
+    else if (tid == typeid(Sphere) || tid == typeid(MovingSphere))
+    {
+        return canBakeSphere(head->GetMaterial(), state);
+    }
+
+    return (tid == typeid(HitableBox)) || (tid == typeid(XYZRect)) || (tid == typeid(TriMesh)) || (tid == typeid(Triangle)) ||
+           (tid == typeid(TriangleBlock4)) || (tid == typeid(TriangleBlock8));
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+bool SceneFlattener::canBakeSphere(Material* mat, const State& state)
+{
+    // Sphere u, v come from the normal, so rotating one turns an image texture with it
+    if (state.FlipNormals || !state.Rigid)
+    {
+        return false;
+    }
+
+    return state.TranslationOnly || (!isImageTexture(mat->GetAlbedoTexture()) && !isImageTexture(mat->GetEmitTexture()));
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+SceneFlattener::State SceneFlattener::applyTransform(const State& state, const AffineTransform& objectToWorld)
+{
+    State ret;
+    ret.ObjectToWorld   = state.ObjectToWorld * objectToWorld;
+    ret.WorldToObject   = ret.ObjectToWorld.Inverse();
+    ret.TranslationOnly = isTranslation(ret.ObjectToWorld);
+    ret.Rigid           = isRigid(ret.ObjectToWorld);
+    ret.FlipNormals     = state.FlipNormals;
+
+    return ret;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void SceneFlattener::addRect(XYZRect::AxisPlane axis, float a0, float a1, float b0, float b1, float k, Material* mat,
+                             bool isLightShape, const State& state, Output& out)
+{
+    // Rect axes in x, y, z order
+    int aAxis, bAxis, kAxis;
+    switch (axis)
+    {
+        case XYZRect::XY: aAxis = 0; bAxis = 1; kAxis = 2; break;
+        case XYZRect::XZ: aAxis = 0; bAxis = 2; kAxis = 1; break;
+        default:          aAxis = 1; bAxis = 2; kAxis = 0; break;
+    }
+
+    if (state.TranslationOnly && !state.FlipNormals)
+    {
+        const Vec4 offset = state.ObjectToWorld.TransformPoint(Vec4(0, 0, 0));
+        out.Primitives.push_back(new XYZRect(axis, a0 + offset[aAxis], a1 + offset[aAxis], b0 + offset[bAxis], b1 + offset[bAxis],
+            k + offset[kAxis], mat, isLightShape));
+        return;
+    }
+
+    // Two triangles, with the rect's u, v at the corners so textures land the same
+    const float cornerA[4] = { a0, a1, a1, a0 };
+    const float cornerB[4] = { b0, b0, b1, b1 };
+
+    Triangle::Vertex corners[4];
+    for (int i = 0; i < 4; i++)
+    {
+        corners[i].Vert         = Vec4(0, 0, 0);
+        corners[i].Vert[aAxis]  = cornerA[i];
+        corners[i].Vert[bAxis]  = cornerB[i];
+        corners[i].Vert[kAxis]  = k;
+        corners[i].Normal       = Vec4(0, 0, 0);
+        corners[i].Normal[kAxis] = 1.f;
+        corners[i].Color        = Vec4(0, 0, 0);
+        corners[i].UV[0]        = (i == 1 || i == 2) ? 1.f : 0.f;
+        corners[i].UV[1]        = (i >= 2) ? 1.f : 0.f;
+    }
+
+    const Triangle::Vertex tri0[3] = { corners[0], corners[1], corners[2] };
+    const Triangle::Vertex tri1[3] = { corners[0], corners[2], corners[3] };
+    addTriangle(tri0, mat, state, out);
+    addTriangle(tri1, mat, state, out);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void SceneFlattener::addTriangle(const Triangle::Vertex vertices[3], Material* mat, const State& state, Output& out)
+{
+    Triangle::Vertex baked[3];
+    for (int i = 0; i < 3; i++)
+    {
+        baked[i]      = vertices[i];
+        baked[i].Vert = state.ObjectToWorld.TransformPoint(vertices[i].Vert);
+
+        // Normals go through the inverse transpose, renormalized per vertex
+        Vec4 normal = vertices[i].Normal;
+        if (!state.TranslationOnly && normal.SquaredLength() > 0.f)
+        {
+            normal = UnitVector(state.WorldToObject.TransformVectorTransposed(normal));
+        }
+        baked[i].Normal = state.FlipNormals ? -normal : normal;
+    }
+
+    // Keep the winding matching the normal
+    if (state.FlipNormals)
+    {
+        std::swap(baked[1], baked[2]);
+    }
+
+    out.Triangles.push_back(new Triangle(baked[0], baked[1], baked[2], mat));
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void SceneFlattener::addUnbaked(IHitable* hitable, const State& state, Output& out)
+{
+    // The instance doesn't own the hitable, the scene it came from does
+    std::shared_ptr<IHitable> shared(hitable, [](IHitable*) {});
+    IHitable*                 instance = new HitableInstance(shared, state.ObjectToWorld);
+
+    out.Primitives.push_back(state.FlipNormals ? new FlipNormals(instance) : instance);
+    out.Counts.NumUnbaked++;
+}
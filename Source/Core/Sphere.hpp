@@ -48,7 +48,7 @@ Sphere::~Sphere()
 
 // ----------------------------------------------------------------------------------------------------------------------------
 
-bool Sphere::Hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const
+bool Sphere::intersect(const Ray& r, float tMin, float tMax, float& t) const
 {
     Vec3f oc = r.OriginFast() - CenterFast;
 
@@ -67,15 +67,7 @@ bool Sphere::Hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const
         const bool  test1Passed = (test1 < tMax && test1 > tMin);
         if (test0Passed || test1Passed)
         {
-            rec.T = test0Passed ? test0 : test1;
-            rec.P = r.PointAtParameter(rec.T);
-
-            const Vec4 delta = (rec.P - Center) / Radius;
-            rec.Normal = delta;
-            rec.MatPtr = Mat;
-
-            GetSphereUV(delta, rec.U, rec.V);
-
+            t = test0Passed ? test0 : test1;
             return true;
         }
     }
@@ -85,6 +77,34 @@ bool Sphere::Hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const
 
 // ----------------------------------------------------------------------------------------------------------------------------
 
+bool Sphere::Hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const
+{
+    if (!intersect(r, tMin, tMax, rec.T))
+    {
+        return false;
+    }
+
+    rec.P = r.PointAtParameter(rec.T);
+
+    const Vec4 delta = (rec.P - Center) / Radius;
+    rec.Normal = delta;
+    rec.MatPtr = Mat;
+
+    GetSphereUV(delta, rec.U, rec.V);
+
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+bool Sphere::Occluded(const Ray& r, float tMin, float tMax) const
+{
+    float t;
+    return intersect(r, tMin, tMax, t);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
 bool Sphere::BoundingBox(float t0, float t1, AABB& box) const
 {
     box = AABB::ComputerAABBForSphere(Center, Radius);
@@ -95,9 +115,7 @@ bool Sphere::BoundingBox(float t0, float t1, AABB& box) const
 
 float Sphere::PdfValue(const Vec4& origin, const Vec4& v) const
 {
-    HitRecord rec;
-
-    if (Hit(Ray(origin, v), 0.001f, FLT_MAX, rec))
+    if (Occluded(Ray(origin, v), 0.001f, FLT_MAX))
     {
         float cosThetaMax = sqrt(1 - Radius * Radius / (Center - origin).SquaredLength());
         float solidAngle = 2 * RT_PI * (1 - cosThetaMax);
@@ -0,0 +1,69 @@
+// ----------------------------------------------------------------------------------------------------------------------------
+// 
+// Copyright 2019 Khoi Nguyen
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+//    The above copyright notice and this permission notice shall be included in all copies or substantial
+//    portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+// 
+// ----------------------------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+#include <cstdint>
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+namespace Core
+{
+    class ThreadPool
+    {
+    public:
+
+        typedef std::function<void(int workerId)> Job;
+
+    public:
+
+        ThreadPool(int numThreads = 0);
+        ~ThreadPool();
+
+        // Disable copying of the pool
+        ThreadPool(const ThreadPool&)            = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        void        Dispatch(int numWorkers, const Job& job);
+        void        Wait();
+        int         GetNumThreads();
+
+    private:
+
+        void        addThreads(int numThreads);
+        static void threadWorkerLoop(ThreadPool* pool, int id, uint64_t lastJobId);
+
+    private:
+
+        std::mutex                  Mutex;
+        std::condition_variable     WakeCondVar;
+        std::condition_variable     DoneCondVar;
+        std::vector<std::thread*>   Threads;
+        Job                         CurrentJob;
+        uint64_t                    CurrentJobId;
+        int                         NumJobWorkers;
+        int                         NumWorkersRunning;
+        bool                        ExitRequested;
+    };
+}
@@ -0,0 +1,149 @@
+// ----------------------------------------------------------------------------------------------------------------------------
+// 
+// Copyright 2019 Khoi Nguyen
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+//    The above copyright notice and this permission notice shall be included in all copies or substantial
+//    portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+// 
+// ----------------------------------------------------------------------------------------------------------------------------
+
+#include "ThreadPool.h"
+
+using namespace Core;
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+ThreadPool::ThreadPool(int numThreads)
+    : CurrentJobId(0)
+    , NumJobWorkers(0)
+    , NumWorkersRunning(0)
+    , ExitRequested(false)
+{
+    std::unique_lock<std::mutex> lck(Mutex);
+    addThreads(numThreads);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+ThreadPool::~ThreadPool()
+{
+    Wait();
+
+    // Wake everyone up so they can exit
+    {
+        std::unique_lock<std::mutex> lck(Mutex);
+        ExitRequested = true;
+        WakeCondVar.notify_all();
+    }
+
+    for (int i = 0; i < (int)Threads.size(); i++)
+    {
+        Threads[i]->join();
+        delete Threads[i];
+        Threads[i] = nullptr;
+    }
+    Threads.clear();
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void ThreadPool::Dispatch(int numWorkers, const Job& job)
+{
+    // Only one job runs at a time
+    Wait();
+
+    std::unique_lock<std::mutex> lck(Mutex);
+
+    // Grow the pool if this job wants more workers than we have parked
+    if (numWorkers > (int)Threads.size())
+    {
+        addThreads(numWorkers - (int)Threads.size());
+    }
+
+    CurrentJob        = job;
+    NumJobWorkers     = numWorkers;
+    NumWorkersRunning = numWorkers;
+    CurrentJobId++;
+
+    WakeCondVar.notify_all();
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void ThreadPool::Wait()
+{
+    std::unique_lock<std::mutex> lck(Mutex);
+    DoneCondVar.wait(lck, [this] { return NumWorkersRunning == 0; });
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+int ThreadPool::GetNumThreads()
+{
+    std::unique_lock<std::mutex> lck(Mutex);
+    return (int)Threads.size();
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void ThreadPool::addThreads(int numThreads)
+{
+    // Expects Mutex to be held. New threads start parked on the current job id.
+    for (int i = 0; i < numThreads; i++)
+    {
+        const int id = (int)Threads.size();
+        Threads.push_back(new std::thread(threadWorkerLoop, this, id, CurrentJobId));
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void ThreadPool::threadWorkerLoop(ThreadPool* pool, int id, uint64_t lastJobId)
+{
+    while (true)
+    {
+        Job job;
+
+        // Park until there's a new job, or we're asked to exit
+        {
+            std::unique_lock<std::mutex> lck(pool->Mutex);
+            pool->WakeCondVar.wait(lck, [pool, lastJobId] { return pool->ExitRequested || pool->CurrentJobId != lastJobId; });
+
+            if (pool->ExitRequested)
+            {
+                break;
+            }
+
+            lastJobId = pool->CurrentJobId;
+            if (id >= pool->NumJobWorkers)
+            {
+                // Not needed for this job
+                continue;
+            }
+
+            job = pool->CurrentJob;
+        }
+
+        job(id);
+
+        // Let waiters know when the last worker is done
+        {
+            std::unique_lock<std::mutex> lck(pool->Mutex);
+            pool->NumWorkersRunning--;
+            if (pool->NumWorkersRunning == 0)
+            {
+                pool->DoneCondVar.notify_all();
+            }
+        }
+    }
+}
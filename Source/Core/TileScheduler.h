@@ -0,0 +1,91 @@
+// ----------------------------------------------------------------------------------------------------------------------------
+// 
+// Copyright 2019 Khoi Nguyen
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+//    The above copyright notice and this permission notice shall be included in all copies or substantial
+//    portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+// 
+// ----------------------------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <mutex>
+#include <deque>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+namespace Core
+{
+    class TileScheduler
+    {
+    public:
+
+        struct Tile
+        {
+            int X, Y;
+            int Width, Height;
+        };
+
+        struct WorkItem
+        {
+            int TileIndex;
+            int SampleStart;
+            int SampleCount;
+            int Generation;
+        };
+
+    public:
+
+        TileScheduler();
+        ~TileScheduler();
+
+        void               Setup(int outputWidth, int outputHeight, int tileLength, int numSamples, int samplesPerBatch, int numQueues);
+        void               Reset(const std::function<void()>& onReset = nullptr);
+        bool               Next(int queueId, WorkItem& item);
+        bool               Complete(int queueId, const WorkItem& item, const std::function<void()>& onCommit = nullptr);
+
+        inline bool        HasPendingWork() const               { return NumPendingTiles.load() > 0; }
+        inline bool        IsStale(const WorkItem& item) const  { return item.Generation != Generation.load(); }
+        inline const Tile& GetTile(int tileIndex) const         { return Tiles[tileIndex]; }
+        inline int         GetNumTiles() const                  { return (int)Tiles.size(); }
+        inline int         GetTileLength() const                { return TileLength; }
+        inline int         GetSamplesPerBatch() const           { return SamplesPerBatch; }
+
+    private:
+
+        // Each queue sits on its own cache line so owners and thieves don't false share
+        struct alignas(64) TileQueue
+        {
+            std::mutex              Mutex;
+            std::deque<WorkItem>    Items;
+        };
+
+        bool popFront(int queueId, WorkItem& item);
+        bool stealBack(int queueId, WorkItem& item);
+
+    private:
+
+        std::vector<Tile>   Tiles;
+        TileQueue*          Queues;
+        int                 NumQueues;
+        int                 TileLength;
+        int                 NumSamples;
+        int                 SamplesPerBatch;
+        std::atomic<int>    Generation;
+        std::atomic<int>    NumPendingTiles;
+    };
+}
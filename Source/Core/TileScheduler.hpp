@@ -0,0 +1,214 @@
+// ----------------------------------------------------------------------------------------------------------------------------
+// 
+// Copyright 2019 Khoi Nguyen
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+//    The above copyright notice and this permission notice shall be included in all copies or substantial
+//    portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+// 
+// ----------------------------------------------------------------------------------------------------------------------------
+
+#include "TileScheduler.h"
+#include "Util.h"
+
+using namespace Core;
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+TileScheduler::TileScheduler()
+    : Queues(nullptr)
+    , NumQueues(0)
+    , TileLength(0)
+    , NumSamples(0)
+    , SamplesPerBatch(1)
+    , Generation(0)
+    , NumPendingTiles(0)
+{
+    ;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+TileScheduler::~TileScheduler()
+{
+    delete[] Queues;
+    Queues = nullptr;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void TileScheduler::Setup(int outputWidth, int outputHeight, int tileLength, int numSamples, int samplesPerBatch, int numQueues)
+{
+    TileLength      = GetMax(tileLength, 1);
+    NumSamples      = numSamples;
+    SamplesPerBatch = Clamp(samplesPerBatch, 1, GetMax(numSamples, 1));
+
+    // Edge tiles are clipped to the output, so any resolution is tiled
+    Tiles.clear();
+    for (int y = 0; y < outputHeight; y += TileLength)
+    {
+        for (int x = 0; x < outputWidth; x += TileLength)
+        {
+            Tile tile;
+            tile.X      = x;
+            tile.Y      = y;
+            tile.Width  = GetMin(TileLength, outputWidth - x);
+            tile.Height = GetMin(TileLength, outputHeight - y);
+
+            Tiles.push_back(tile);
+        }
+    }
+
+    if (NumQueues != numQueues)
+    {
+        delete[] Queues;
+        NumQueues = GetMax(numQueues, 1);
+        Queues    = new TileQueue[NumQueues];
+    }
+
+    Reset();
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void TileScheduler::Reset(const std::function<void()>& onReset)
+{
+    std::vector<std::unique_lock<std::mutex>> locks;
+    for (int i = 0; i < NumQueues; i++)
+    {
+        locks.emplace_back(Queues[i].Mutex);
+    }
+
+    // Items handed out before this point belong to an older generation and are dropped on completion
+    Generation++;
+
+    // No work can be committed while we hold every queue, so it's safe to clear results here
+    if (onReset)
+    {
+        onReset();
+    }
+
+    for (int i = 0; i < NumQueues; i++)
+    {
+        Queues[i].Items.clear();
+    }
+
+    const int numTiles = (NumSamples > 0) ? (int)Tiles.size() : 0;
+    for (int i = 0; i < numTiles; i++)
+    {
+        // Interleave tiles across queues so every thread starts spread out over the image
+        WorkItem item;
+        item.TileIndex   = i;
+        item.SampleStart = 0;
+        item.SampleCount = GetMin(SamplesPerBatch, NumSamples);
+        item.Generation  = Generation;
+
+        Queues[i % NumQueues].Items.push_back(item);
+    }
+
+    NumPendingTiles = numTiles;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+bool TileScheduler::Next(int queueId, WorkItem& item)
+{
+    // Work on our own queue first
+    if (popFront(queueId, item))
+    {
+        return true;
+    }
+
+    // Ran dry, try stealing from the other queues
+    for (int i = 1; i < NumQueues; i++)
+    {
+        if (stealBack((queueId + i) % NumQueues, item))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+bool TileScheduler::Complete(int queueId, const WorkItem& item, const std::function<void()>& onCommit)
+{
+    std::unique_lock<std::mutex> lck(Queues[queueId].Mutex);
+
+    // Stale work from before a reset
+    if (IsStale(item))
+    {
+        return false;
+    }
+
+    // The tile is only requeued after this, so nobody else can be committing to it
+    if (onCommit)
+    {
+        onCommit();
+    }
+
+    // Requeue the tile at the back until all its samples are done
+    const int nextStart = item.SampleStart + item.SampleCount;
+    if (nextStart < NumSamples)
+    {
+        WorkItem nextItem;
+        nextItem.TileIndex   = item.TileIndex;
+        nextItem.SampleStart = nextStart;
+        nextItem.SampleCount = GetMin(SamplesPerBatch, NumSamples - nextStart);
+        nextItem.Generation  = Generation;
+
+        Queues[queueId].Items.push_back(nextItem);
+    }
+    else
+    {
+        NumPendingTiles--;
+    }
+
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+bool TileScheduler::popFront(int queueId, WorkItem& item)
+{
+    std::unique_lock<std::mutex> lck(Queues[queueId].Mutex);
+
+    if (Queues[queueId].Items.empty())
+    {
+        return false;
+    }
+
+    item = Queues[queueId].Items.front();
+    Queues[queueId].Items.pop_front();
+
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+bool TileScheduler::stealBack(int queueId, WorkItem& item)
+{
+    std::unique_lock<std::mutex> lck(Queues[queueId].Mutex, std::try_to_lock);
+
+    // Don't wait on a busy queue, just move on to the next victim
+    if (!lck.owns_lock() || Queues[queueId].Items.empty())
+    {
+        return false;
+    }
+
+    item = Queues[queueId].Items.back();
+    Queues[queueId].Items.pop_back();
+
+    return true;
+}
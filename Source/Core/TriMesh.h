@@ -23,7 +23,9 @@
 #include "Vec4.h"
 #include "Material.h"
 #include "CoreTriangle.h"
+#include "TriangleBlock.h"
 #include "BVHNode.h"
+#include "AffineTransform.h"
 #include <vector>
 
 // ----------------------------------------------------------------------------------------------------------------------------
@@ -53,10 +55,18 @@ namespace Core
 
     public:
 
-        static TriMesh*               CreateFromSTLFile(const char* filePath, Material* material, float scale = 1.0f);
-        static TriMesh*               CreateFromOBJFile(const char* filePath, float scale = 1.0f, bool makeMetalMaterial = false, Material* matOverride = nullptr);
+        // Meshes with long, thin triangles benefit from BuildSpatialSAH
+        static TriMesh*               CreateFromSTLFile(const char* filePath, Material* material, float scale = 1.0f,
+                                                        BVHNode::BuildMethod buildMethod = BVHNode::GetDefaultBuildMethod());
+        static TriMesh*               CreateFromOBJFile(const char* filePath, float scale = 1.0f, bool makeMetalMaterial = false, Material* matOverride = nullptr,
+                                                        BVHNode::BuildMethod buildMethod = BVHNode::GetDefaultBuildMethod());
+        // Takes ownership of the triangles, which keep their own materials
+        static TriMesh*               CreateFromTriangles(const std::vector<Triangle*>& triangles,
+                                                          BVHNode::BuildMethod buildMethod = BVHNode::GetDefaultBuildMethod());
         virtual bool                  BoundingBox(float t0, float t1, AABB& box) const;
         virtual bool                  Hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const;
+        virtual bool                  Occluded(const Ray& r, float tMin, float tMax) const;
+        virtual void                  HitStream(const Ray* rays, int numRays, float tMin, float* tMax, HitRecord* recs, bool* hits) const;
 
         void GetTriArray(IHitable**& ppTriArray, int& numTris) const
         {
@@ -66,12 +76,19 @@ namespace Core
 
         virtual Material* GetMaterial() override { return Mat; }
 
+        // Moves every vertex through xform, normals included, and refits the BVH over the moved triangles. The BVH is
+        // rebuilt instead once refitting has degraded it past rebuildThreshold (see BVHNode::RefitOrRebuild). Anything
+        // holding the mesh's bounds, such as a BVH above it, needs refitting too. Returns true if it rebuilt.
+        bool              Transform(const AffineTransform& xform, float rebuildThreshold = BVHNode::DefaultRebuildThreshold);
+
+        inline BVHNode*   GetBVH() const { return BVHHead; }
+
     private:
 
         TriMesh() : TriArray(nullptr), NumTriangles(0), BVHHead(NULL) {}
         virtual ~TriMesh();
 
-        void        createFromArray(std::vector<Triangle*> triArray);
+        void        createFromArray(std::vector<Triangle*> triArray, BVHNode::BuildMethod buildMethod);
         Triangle*   makeNewTriangle(
             int v0, int v1, int v2, 
             const std::vector<Vec4>& vertList, const std::vector<Vec4>& vertNormalList, const std::vector<TexCoord>& texCoordList,
@@ -40,6 +40,10 @@ struct STLTriangle
 };
 #pragma pack(pop)
 
+// Matches BVHNode::MaxLeafPrimitives, so every leaf is one block. Eight lanes still win on SSE2, where VCL runs them
+// as two halves, since a leaf then only needs a single closest-lane search.
+static const int MeshBlockWidth = 8;
+
 
 // ----------------------------------------------------------------------------------------------------------------------------
 
@@ -53,6 +57,12 @@ TriMesh::~TriMesh()
 
     if (TriArray != nullptr)
     {
+        // The BVH only owns the triangle blocks, the triangles are ours
+        for (int i = 0; i < NumTriangles; i++)
+        {
+            delete TriArray[i];
+        }
+
         delete[] TriArray;
         TriArray = nullptr;
     }
@@ -66,7 +76,7 @@ TriMesh::~TriMesh()
 
 // ----------------------------------------------------------------------------------------------------------------------------
 
-TriMesh* TriMesh::CreateFromSTLFile(const char* filePath, Material* material, float scale /*= 1.0f*/)
+TriMesh* TriMesh::CreateFromSTLFile(const char* filePath, Material* material, float scale /*= 1.0f*/, BVHNode::BuildMethod buildMethod)
 {
     TriMesh* ret = nullptr;
 
@@ -116,7 +126,7 @@ TriMesh* TriMesh::CreateFromSTLFile(const char* filePath, Material* material, fl
             triList.push_back(new Triangle(v0, v1, v2, material));
         }
 
-        ret->createFromArray(triList);
+        ret->createFromArray(triList, buildMethod);
     }
 
     return ret;
@@ -171,7 +181,7 @@ Triangle* TriMesh::makeNewTriangle(
 
 // ----------------------------------------------------------------------------------------------------------------------------
 
-TriMesh* TriMesh::CreateFromOBJFile(const char* filePath, float scale, bool makeMetalMaterial, Material* matOverride)
+TriMesh* TriMesh::CreateFromOBJFile(const char* filePath, float scale, bool makeMetalMaterial, Material* matOverride, BVHNode::BuildMethod buildMethod)
 {
     const int LINE_SIZE = 4096;
     char lineBuf[LINE_SIZE];
@@ -340,7 +350,7 @@ TriMesh* TriMesh::CreateFromOBJFile(const char* filePath, float scale, bool make
             }
         }
 
-        ret->createFromArray(triList);
+        ret->createFromArray(triList, buildMethod);
     }
 
     return ret;
@@ -348,6 +358,17 @@ TriMesh* TriMesh::CreateFromOBJFile(const char* filePath, float scale, bool make
 
 // ----------------------------------------------------------------------------------------------------------------------------
 
+TriMesh* TriMesh::CreateFromTriangles(const std::vector<Triangle*>& triangles, BVHNode::BuildMethod buildMethod)
+{
+    TriMesh* ret = new TriMesh();
+    ret->Mat = nullptr;
+    ret->createFromArray(triangles, buildMethod);
+
+    return ret;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
 bool TriMesh::BoundingBox(float t0, float t1, AABB& box) const
 {
     return BVHHead->BoundingBox(t0, t1, box);
@@ -362,7 +383,21 @@ bool TriMesh::Hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const
 
 // ----------------------------------------------------------------------------------------------------------------------------
 
-void TriMesh::createFromArray(std::vector<Triangle*> triArray)
+bool TriMesh::Occluded(const Ray& r, float tMin, float tMax) const
+{
+    return BVHHead->Occluded(r, tMin, tMax);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void TriMesh::HitStream(const Ray* rays, int numRays, float tMin, float* tMax, HitRecord* recs, bool* hits) const
+{
+    BVHHead->HitStream(rays, numRays, tMin, tMax, recs, hits);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+void TriMesh::createFromArray(std::vector<Triangle*> triArray, BVHNode::BuildMethod buildMethod)
 {
     // Convert to regular array
     TriArray = new IHitable*[triArray.size()];
@@ -372,6 +407,52 @@ void TriMesh::createFromArray(std::vector<Triangle*> triArray)
         TriArray[i] = triArray[i];
     }
 
-    // Build BVH tree
-    BVHHead = new BVHNode(TriArray, NumTriangles, 0, 0);
+    // Build BVH tree, then pack each leaf's triangles for SIMD intersection
+    BVHHead = new BVHNode(TriArray, NumTriangles, 0, 0, MeshBlockWidth, buildMethod);
+    BVHHead->PackLeaves(
+        [](IHitable* const* triangles, int numTriangles) -> IHitable*
+        {
+            return new TriangleBlock<MeshBlockWidth>(triangles, numTriangles);
+        },
+        [](IHitable* packed, std::vector<IHitable*>& triangles)
+        {
+            const TriangleBlock<MeshBlockWidth>* block = (const TriangleBlock<MeshBlockWidth>*)packed;
+            for (int i = 0; i < block->GetNumTriangles(); i++)
+            {
+                triangles.push_back((Triangle*)block->GetTriangle(i));
+            }
+        });
+
+    // Rendering and refits only need the compiled copy
+    if (BVHNode::GetReleaseTrees())
+    {
+        BVHHead->ReleaseTree();
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+bool TriMesh::Transform(const AffineTransform& xform, float rebuildThreshold)
+{
+    // Normals go through the inverse transpose, renormalized per vertex
+    const AffineTransform worldToObject = xform.Inverse();
+    for (int i = 0; i < NumTriangles; i++)
+    {
+        Triangle*        tri = (Triangle*)TriArray[i];
+        Triangle::Vertex moved[3];
+        for (int v = 0; v < 3; v++)
+        {
+            moved[v]      = tri->GetVertices()[v];
+            moved[v].Vert = xform.TransformPoint(moved[v].Vert);
+            if (moved[v].Normal.SquaredLength() > 0.f)
+            {
+                moved[v].Normal = UnitVector(worldToObject.TransformVectorTransposed(moved[v].Normal));
+            }
+        }
+
+        tri->SetVertices(moved[0], moved[1], moved[2]);
+    }
+
+    // Meshes are built static, over time zero
+    return BVHHead->RefitOrRebuild(0, 0, rebuildThreshold);
 }
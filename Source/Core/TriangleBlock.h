@@ -0,0 +1,80 @@
+// ----------------------------------------------------------------------------------------------------------------------------
+// 
+// Copyright 2019 Khoi Nguyen
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+//    The above copyright notice and this permission notice shall be included in all copies or substantial
+//    portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+// 
+// ----------------------------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <vector>
+#include "IHitable.h"
+#include "CoreTriangle.h"
+#include "WideBVH.h"
+#include "vcl/vectorclass.h"
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+namespace Core
+{
+    // A small group of triangles, usually one BVH leaf, stored SoA so a single Moller-Trumbore pass tests Width
+    // of them at once. Only the closest triangle gets its attributes interpolated. The triangles themselves are
+    // not owned by the block.
+    template <int Width>
+    class TriangleBlock : public IHitable
+    {
+    public:
+
+        typedef typename WideBVHLanes<Width>::Type Lanes;
+        typedef decltype(Lanes() < Lanes())        LaneMask;
+
+        struct alignas(32) Group
+        {
+            float    V0[3][Width];
+            float    Edge1[3][Width];
+            float    Edge2[3][Width];
+        };
+
+    public:
+
+        TriangleBlock(IHitable* const* triangles, int numTriangles);
+        virtual ~TriangleBlock();
+
+        virtual bool              Hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const;
+        virtual bool              BoundingBox(float t0, float t1, AABB& box) const;
+        virtual bool              Occluded(const Ray& r, float tMin, float tMax) const;
+
+        // Copies the triangles' vertices into the lanes again, after they've moved
+        virtual void              Refresh();
+
+        inline int                GetNumTriangles() const   { return int(Triangles.size()); }
+        inline void               Prefetch() const          { PrefetchLines(Groups.data(), Groups.size() * sizeof(Group)); }
+        inline const Triangle*    GetTriangle(int i) const  { return Triangles[i]; }
+
+    private:
+
+        // Moller-Trumbore against every lane of a group, the mask has the lanes hit within (tMin, tMax)
+        static inline LaneMask        intersectGroup(const Group& group, const Lanes origin[3], const Lanes direction[3],
+                                                     float tMin, float tMax, Lanes& t, Lanes& u, Lanes& v);
+
+    private:
+
+        std::vector<Group>            Groups;
+        std::vector<const Triangle*>  Triangles;
+    };
+
+    typedef TriangleBlock<4> TriangleBlock4;
+    typedef TriangleBlock<8> TriangleBlock8;
+}
@@ -0,0 +1,227 @@
+// ----------------------------------------------------------------------------------------------------------------------------
+// 
+// Copyright 2019 Khoi Nguyen
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+//    The above copyright notice and this permission notice shall be included in all copies or substantial
+//    portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+// 
+// ----------------------------------------------------------------------------------------------------------------------------
+
+#include "TriangleBlock.h"
+#include <cfloat>
+
+using namespace Core;
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+template <int Width>
+TriangleBlock<Width>::TriangleBlock(IHitable* const* triangles, int numTriangles)
+{
+    Triangles.resize(numTriangles);
+    Groups.resize((numTriangles + Width - 1) / Width);
+    for (int i = 0; i < numTriangles; i++)
+    {
+        Triangles[i] = (const Triangle*)triangles[i];
+    }
+
+    Refresh();
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+template <int Width>
+void TriangleBlock<Width>::Refresh()
+{
+    const int numTriangles = GetNumTriangles();
+    for (int g = 0; g < int(Groups.size()); g++)
+    {
+        for (int lane = 0; lane < Width; lane++)
+        {
+            // Unused lanes are degenerate and never pass the determinant test
+            const int i = (g * Width) + lane;
+            if (i >= numTriangles)
+            {
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    Groups[g].V0[axis][lane]    = 0.f;
+                    Groups[g].Edge1[axis][lane] = 0.f;
+                    Groups[g].Edge2[axis][lane] = 0.f;
+                }
+                continue;
+            }
+
+            const Triangle::Vertex* verts = Triangles[i]->GetVertices();
+            for (int axis = 0; axis < 3; axis++)
+            {
+                Groups[g].V0[axis][lane]    = verts[0].Vert[axis];
+                Groups[g].Edge1[axis][lane] = verts[1].Vert[axis] - verts[0].Vert[axis];
+                Groups[g].Edge2[axis][lane] = verts[2].Vert[axis] - verts[0].Vert[axis];
+            }
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+template <int Width>
+TriangleBlock<Width>::~TriangleBlock()
+{
+    // Triangles are owned by the mesh
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+template <int Width>
+bool TriangleBlock<Width>::BoundingBox(float /*t0*/, float /*t1*/, AABB& box) const
+{
+    // Taken from the lanes rather than cached, so the box always matches what Hit tests against
+    Vec4 vMin(FLT_MAX, FLT_MAX, FLT_MAX);
+    Vec4 vMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    for (int i = 0; i < GetNumTriangles(); i++)
+    {
+        const Group& group = Groups[i / Width];
+        const int    lane  = i % Width;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            const float v0 = group.V0[axis][lane];
+            const float v1 = v0 + group.Edge1[axis][lane];
+            const float v2 = v0 + group.Edge2[axis][lane];
+
+            vMin[axis] = GetMin<float>(vMin[axis], GetMin<float>(v0, GetMin<float>(v1, v2)));
+            vMax[axis] = GetMax<float>(vMax[axis], GetMax<float>(v0, GetMax<float>(v1, v2)));
+        }
+    }
+
+    box = AABB(vMin, vMax);
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+template <int Width>
+inline typename TriangleBlock<Width>::LaneMask TriangleBlock<Width>::intersectGroup(const Group& group, const Lanes origin[3], const Lanes direction[3],
+                                                                                  float tMin, float tMax, Lanes& t, Lanes& u, Lanes& v)
+{
+    const float EPSILON = 0.0000001f;
+
+    const Lanes& ox = origin[0];
+    const Lanes& oy = origin[1];
+    const Lanes& oz = origin[2];
+    const Lanes& dx = direction[0];
+    const Lanes& dy = direction[1];
+    const Lanes& dz = direction[2];
+    const Lanes  e1x = Lanes().load_a(group.Edge1[0]), e1y = Lanes().load_a(group.Edge1[1]), e1z = Lanes().load_a(group.Edge1[2]);
+    const Lanes  e2x = Lanes().load_a(group.Edge2[0]), e2y = Lanes().load_a(group.Edge2[1]), e2z = Lanes().load_a(group.Edge2[2]);
+
+    // h = dir x edge2, a = edge1 . h
+    const Lanes hx = (dy * e2z) - (dz * e2y);
+    const Lanes hy = (dz * e2x) - (dx * e2z);
+    const Lanes hz = (dx * e2y) - (dy * e2x);
+    const Lanes a  = (e1x * hx) + (e1y * hy) + (e1z * hz);
+    const Lanes f  = Lanes(1.f) / a;
+
+    // s = origin - v0, u = f * (s . h)
+    const Lanes sx = ox - Lanes().load_a(group.V0[0]);
+    const Lanes sy = oy - Lanes().load_a(group.V0[1]);
+    const Lanes sz = oz - Lanes().load_a(group.V0[2]);
+    u = f * ((sx * hx) + (sy * hy) + (sz * hz));
+
+    // q = s x edge1, v = f * (dir . q), t = f * (edge2 . q)
+    const Lanes qx = (sy * e1z) - (sz * e1y);
+    const Lanes qy = (sz * e1x) - (sx * e1z);
+    const Lanes qz = (sx * e1y) - (sy * e1x);
+    v = f * ((dx * qx) + (dy * qy) + (dz * qz));
+    t = f * ((e2x * qx) + (e2y * qy) + (e2z * qz));
+
+    return (abs(a) >= Lanes(EPSILON)) & (u >= Lanes(0.f)) & (v >= Lanes(0.f)) & ((u + v) <= Lanes(1.f)) &
+           (t > Lanes(EPSILON)) & (t > Lanes(tMin)) & (t < Lanes(tMax));
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+template <int Width>
+bool TriangleBlock<Width>::Hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const
+{
+    const Vec4  origin       = r.Origin();
+    const Vec4  direction    = r.Direction();
+    const Lanes rayOrigin[3] = { Lanes(origin[0]), Lanes(origin[1]), Lanes(origin[2]) };
+    const Lanes rayDir[3]    = { Lanes(direction[0]), Lanes(direction[1]), Lanes(direction[2]) };
+
+    float closestSoFar = tMax;
+    int   bestIndex    = -1;
+    float bestU        = 0.f;
+    float bestV        = 0.f;
+
+    for (int g = 0; g < int(Groups.size()); g++)
+    {
+        Lanes          t, u, v;
+        const LaneMask hitMask = intersectGroup(Groups[g], rayOrigin, rayDir, tMin, closestSoFar, t, u, v);
+        if (!horizontal_or(hitMask))
+        {
+            continue;
+        }
+
+        // Closest lane wins, everything else is discarded without touching the vertex attributes
+        float laneT[Width];
+        select(hitMask, t, Lanes(FLT_MAX)).store(laneT);
+
+        int lane = 0;
+        for (int i = 1; i < Width; i++)
+        {
+            lane = (laneT[i] < laneT[lane]) ? i : lane;
+        }
+
+        closestSoFar = laneT[lane];
+        bestIndex    = (g * Width) + lane;
+        bestU        = u[lane];
+        bestV        = v[lane];
+    }
+
+    if (bestIndex < 0)
+    {
+        return false;
+    }
+
+    Triangles[bestIndex]->FillHitRecord(r, closestSoFar, bestU, bestV, rec);
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+template <int Width>
+bool TriangleBlock<Width>::Occluded(const Ray& r, float tMin, float tMax) const
+{
+    const Vec4  origin       = r.Origin();
+    const Vec4  direction    = r.Direction();
+    const Lanes rayOrigin[3] = { Lanes(origin[0]), Lanes(origin[1]), Lanes(origin[2]) };
+    const Lanes rayDir[3]    = { Lanes(direction[0]), Lanes(direction[1]), Lanes(direction[2]) };
+
+    for (int g = 0; g < int(Groups.size()); g++)
+    {
+        Lanes t, u, v;
+        if (horizontal_or(intersectGroup(Groups[g], rayOrigin, rayDir, tMin, tMax, t, u, v)))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+namespace Core
+{
+    template class TriangleBlock<4>;
+    template class TriangleBlock<8>;
+}
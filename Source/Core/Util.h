@@ -20,8 +20,12 @@
 #pragma once
 #include "Vec4.h"
 #include "Systems.h"
+#include "RandomGenerator.h"
+#include "Sampler.h"
 #include <vector>
 #include <string>
+#include <cstdint>
+#include <xmmintrin.h>
 
 // ----------------------------------------------------------------------------------------------------------------------------
 
@@ -82,6 +86,31 @@ constexpr inline const T& Clamp(const T& val, const T& min, const T& max)
 
 // ----------------------------------------------------------------------------------------------------------------------------
 
+inline uint32_t ExpandMortonBits(uint32_t v)
+{
+    // Spreads the low 10 bits out to every third bit
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+inline void PrefetchLines(const void* ptr, size_t size)
+{
+    // Starts loading every cache line of the range, without waiting on any of them
+    const char* line = (const char*)(uintptr_t(ptr) & ~uintptr_t(63));
+    const char* end  = (const char*)ptr + size;
+    for (; line < end; line += 64)
+    {
+        _mm_prefetch(line, _MM_HINT_T0);
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
 inline bool CompareFloatEqual(float a, float b, float relTol = 0.0000001f, float absTol = 0.0000001f)
 {
     return (fabs(a - b) <= GetMax<float>(absTol, relTol * GetMax<float>(fabs(a), fabs(b))));
@@ -107,8 +136,32 @@ inline Core::Vec4 DeNaN(const Core::Vec4& c)
 
 inline float RandomFloat()
 {
-    float num = static_cast <float> (rand()) / static_cast <float> (RAND_MAX);
-    return num;
+    return Core::GetThreadRandomGenerator().NextFloat();
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+// Next value from the thread's sampler, or a plain random number when none is active
+inline float SampleFloat()
+{
+    Core::Sampler* sampler = Core::GetThreadSampler();
+    return (sampler != nullptr) ? sampler->Get1D() : RandomFloat();
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+inline void Sample2D(float& u, float& v)
+{
+    Core::Sampler* sampler = Core::GetThreadSampler();
+    if (sampler != nullptr)
+    {
+        sampler->Get2D(u, v);
+    }
+    else
+    {
+        u = RandomFloat();
+        v = RandomFloat();
+    }
 }
 
 // ----------------------------------------------------------------------------------------------------------------------------
@@ -139,10 +192,40 @@ inline Core::Vec4 RandomInUnitDisk()
 
 // ----------------------------------------------------------------------------------------------------------------------------
 
+// Concentric mapping, so stratified samples stay stratified on the disk
+inline Core::Vec4 SampleInUnitDisk()
+{
+    float u, v;
+    Sample2D(u, v);
+
+    const float a = 2.f * u - 1.f;
+    const float b = 2.f * v - 1.f;
+    if (a == 0.f && b == 0.f)
+    {
+        return Core::Vec4(0, 0, 0);
+    }
+
+    float r, theta;
+    if (fabsf(a) > fabsf(b))
+    {
+        r     = a;
+        theta = (RT_PI / 4.f) * (b / a);
+    }
+    else
+    {
+        r     = b;
+        theta = (RT_PI / 2.f) - (RT_PI / 4.f) * (a / b);
+    }
+
+    return Core::Vec4(r * cosf(theta), r * sinf(theta), 0);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
 inline Core::Vec4 RandomToSphere(float radius, float distanceSquared)
 {
-    float r1  = RandomFloat();
-    float r2  = RandomFloat();
+    float r1, r2;
+    Sample2D(r1, r2);
     float  z  = 1 + r2 * (sqrt(GetMax(0.f, 1 - radius * radius / distanceSquared)) - 1);
     float phi = 2 * RT_PI * r1;
     float x   = cos(phi) * sqrt(GetMax(0.f, 1 - z * z));
@@ -155,8 +238,8 @@ inline Core::Vec4 RandomToSphere(float radius, float distanceSquared)
 
 inline Core::Vec4 RandomCosineDirection()
 {
-    float r1  = RandomFloat();
-    float r2  = RandomFloat();
+    float r1, r2;
+    Sample2D(r1, r2);
     float z   = sqrt(1 - r2);
     float phi = 2 * RT_PI * r1;
     float x   = cos(phi) * 2 * sqrt(r2);
@@ -0,0 +1,201 @@
+// ----------------------------------------------------------------------------------------------------------------------------
+// 
+// Copyright 2019 Khoi Nguyen
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+//    The above copyright notice and this permission notice shall be included in all copies or substantial
+//    portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+// 
+// ----------------------------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "IHitable.h"
+#include "LeafPrimitives.h"
+#include "Ray.h"
+#include "Util.h"
+#include "vcl/vectorclass.h"
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+namespace Core
+{
+    class BVHNode;
+
+    // SIMD register type used to test all children of a wide node at once
+    template <int Width> struct WideBVHLanes;
+    template <> struct WideBVHLanes<4> { typedef Vec4f Type; };
+    template <> struct WideBVHLanes<8> { typedef Vec8f Type; };
+
+    // ----------------------------------------------------------------------------------------------------------------------------
+
+    // Multi-branching BVH, collapsed from a binary BVHNode tree. Child bounds are stored SoA so one slab test
+    // covers every child of a node. Unused child slots get inverted bounds and never pass the test.
+    template <int Width>
+    class WideBVH
+    {
+    public:
+
+        typedef typename WideBVHLanes<Width>::Type Lanes;
+
+        struct alignas(32) Node
+        {
+            float    BoundsMin[3][Width];
+            float    BoundsMax[3][Width];
+            int32_t  ChildOffset[Width];    // Node index for interior children, primitive offset for leaves
+            int32_t  ChildCount[Width];     // Primitives in a leaf child, 0 for interior children, -1 if unused
+        };
+
+        // Compact form of Node. Child bounds are 8-bit steps of Scale from the node's own minimum corner, rounded
+        // outwards so they always contain the exact bounds. Unused children decode to inverted bounds.
+        struct alignas(16) QuantizedNode
+        {
+            float    Origin[3];
+            float    Scale[3];
+            uint8_t  QuantizedMin[3][Width];
+            uint8_t  QuantizedMax[3][Width];
+            int32_t  ChildOffset[Width];
+            uint8_t  ChildCount[Width];     // Primitives in a leaf child, 0 for interior children
+        };
+
+        // Change in child bounds from the start to the end of the time range, parallel to Nodes for moving trees
+        struct alignas(32) MotionNode
+        {
+            float    DeltaMin[3][Width];
+            float    DeltaMax[3][Width];
+        };
+
+        static const int MaxTraversalDepth = 64;
+        static const int MaxPacketSize     = 64;
+        static const int StreamWidth       = 8;         // Rays HitStream keeps in flight
+        static const int StreamMinMemory   = 1 << 20;   // Smaller trees stay in cache, and HitStream goes ray by ray
+
+    public:
+
+        WideBVH();
+        ~WideBVH();
+
+        // Quantized trees store QuantizedNodes only. Moving trees can't be quantized and keep full nodes.
+        bool               Build(BVHNode* root, bool quantize = false);
+
+        // Rewrites every child's bounds from the primitives under it, keeping the layout. Quantized nodes are encoded
+        // again around their new bounds, and moving trees keep their motion deltas.
+        void               Refit(float time0, float time1);
+
+        // Bounds of the whole tree at either end of the time range, and its surface area heuristic cost relative to
+        // the root's area. Each node costs a traversal and each leaf child its intersections, weighted by area.
+        void               GetBounds(BVHNode::BuildBounds& bounds0, BVHNode::BuildBounds& bounds1) const;
+        float              GetSAHCost() const;
+
+        bool               Hit(const Ray& ray, float tMin, float tMax, HitRecord& rec) const;
+        bool               Occluded(const Ray& ray, float tMin, float tMax) const;
+        void               HitPacket(const Ray* rays, int numRays, float tMin, float* tMax, HitRecord* recs, bool* hits) const;
+
+        // Closest hits for unrelated rays. A few rays are in flight at once and take turns stepping through the tree,
+        // each prefetching what it reads next before handing over, so their cache misses overlap. Only pays off once
+        // the tree is too big for the cache.
+        void               HitStream(const Ray* rays, int numRays, float tMin, float* tMax, HitRecord* recs, bool* hits) const;
+
+        inline const Node*          GetNodes() const           { return Nodes.data(); }
+        inline const QuantizedNode* GetQuantizedNodes() const  { return QuantizedNodes.data(); }
+        inline int                  GetNumNodes() const        { return int(Quantized ? QuantizedNodes.size() : Nodes.size()); }
+        inline int                  GetNumPrimitives() const   { return int(Primitives.size()); }
+        inline bool                 HasMotion() const          { return !Motion.empty(); }
+        inline bool                 IsQuantized() const        { return Quantized; }
+        inline size_t               GetMemoryUsage() const
+        {
+            return (Nodes.size() * sizeof(Node)) + (QuantizedNodes.size() * sizeof(QuantizedNode)) +
+                (Motion.size() * sizeof(MotionNode)) + (Primitives.size() * (sizeof(IHitable*) + sizeof(uint8_t)));
+        }
+
+    private:
+
+        struct StackEntry
+        {
+            int32_t Offset;
+            int32_t Count;
+            float   TNear;
+        };
+
+        struct PacketStackEntry
+        {
+            int32_t Offset;
+            int32_t Count;
+            int32_t Parent;                 // Node holding this child's bounds, so leaves can test each ray
+            int32_t Lane;
+            float   TNear;
+        };
+
+        // Where one ray of a stream is in its traversal. Leaves take three steps: prefetch the primitives, prefetch
+        // what they point to, then intersect.
+        struct StreamState
+        {
+            Lanes             RayOrigin[3];
+            Lanes             RayInvDir[3];
+            Lanes             MotionScale;
+            int               NearSide[3];
+            int               RayIndex;
+            int               LeafStage;
+            int               StackSize;
+            BVHNode::Mailbox  Mailbox;
+            StackEntry        Stack[MaxTraversalDepth * Width];
+        };
+
+        template <typename NodeType, typename PrimType>
+        bool               hitNodes(const std::vector<NodeType>& nodes, const Ray& ray, float tMin, float tMax, HitRecord& rec) const;
+        template <typename NodeType, typename PrimType>
+        bool               occludedNodes(const std::vector<NodeType>& nodes, const Ray& ray, float tMin, float tMax) const;
+        template <typename NodeType, typename PrimType>
+        void               hitStreamNodes(const std::vector<NodeType>& nodes, const Ray* rays, int numRays, float tMin, float* tMax,
+                                          HitRecord* recs, bool* hits) const;
+        template <typename NodeType, typename PrimType>
+        inline bool        stepStream(const std::vector<NodeType>& nodes, StreamState& state, const Ray& ray, float tMin, float& tMax,
+                                      HitRecord& rec, bool& hit) const;
+        inline void        beginStream(StreamState& state, const Ray& ray, int rayIndex, float tMin) const;
+        template <typename NodeType>
+        inline void        prefetchNext(const std::vector<NodeType>& nodes, const StreamState& state) const;
+        template <typename NodeType>
+        static inline void pushChildren(const NodeType& node, const Lanes& tNear, uint32_t hitMask, StackEntry* stack, int& stackSize);
+
+        inline uint32_t    intersectChildren(const Node& node, int nodeIndex, const int nearSide[3], const Lanes rayOrigin[3], const Lanes rayInvDir[3],
+                                             const Lanes& motionScale, float tMin, float tMax, Lanes& tNear) const;
+        inline uint32_t    intersectChildren(const QuantizedNode& node, int nodeIndex, const int nearSide[3], const Lanes rayOrigin[3], const Lanes rayInvDir[3],
+                                             const Lanes& motionScale, float tMin, float tMax, Lanes& tNear) const;
+        int                maxDepth(BVHNode* node, int depth);
+        int                collapseNode(BVHNode* node);
+        bool               quantizeNodes();
+        static void        quantizeNode(const Node& node, QuantizedNode& qnode);
+        bool               childBounds(int nodeIndex, int child, BVHNode::BuildBounds& bounds0, BVHNode::BuildBounds& bounds1) const;
+
+        static inline Lanes loadQuantized(const uint8_t* values);
+        static inline void  decodeBounds(const QuantizedNode& node, int axis, Lanes& boundsMin, Lanes& boundsMax);
+
+    private:
+
+        std::vector<Node>          Nodes;
+        std::vector<QuantizedNode> QuantizedNodes;
+        std::vector<MotionNode>    Motion;
+        std::vector<IHitable*>     Primitives;
+        std::vector<uint8_t>       PrimitiveTypes;      // PrimitiveType of each, sorted within a leaf
+        PrimitiveType              UniformType;         // Shared by every primitive, PrimitiveGeneric if mixed
+        bool                       Moving;
+        bool                       Quantized;
+        bool                       Duplicates;
+        float                      MotionTime0;
+        float                      MotionInvDuration;
+    };
+
+    typedef WideBVH<4> BVH4;
+    typedef WideBVH<8> BVH8;
+}
@@ -0,0 +1,1153 @@
+// ----------------------------------------------------------------------------------------------------------------------------
+// 
+// Copyright 2019 Khoi Nguyen
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+// 
+//    The above copyright notice and this permission notice shall be included in all copies or substantial
+//    portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+// 
+// ----------------------------------------------------------------------------------------------------------------------------
+
+#include "WideBVH.h"
+#include "BVHNode.h"
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+using namespace Core;
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+template <int Width>
+WideBVH<Width>::WideBVH()
+    : Moving(false)
+    , Quantized(false)
+    , Duplicates(false)
+    , MotionTime0(0)
+    , MotionInvDuration(0)
+{
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+template <int Width>
+WideBVH<Width>::~WideBVH()
+{
+    // Primitives are still owned by the BVHNode tree
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+template <int Width>
+bool WideBVH<Width>::Build(BVHNode* root, bool quantize)
+{
+    Nodes.clear();
+    QuantizedNodes.clear();
+    Motion.clear();
+    Primitives.clear();
+    PrimitiveTypes.clear();
+    UniformType = PrimitiveGeneric;
+    Quantized   = false;
+
+    // Static trees skip the motion test entirely
+    Moving            = root->HasMotion() && (root->GetTime1() > root->GetTime0());
+    MotionTime0       = Moving ? root->GetTime0() : 0.f;
+    MotionInvDuration = Moving ? (1.f / (root->GetTime1() - root->GetTime0())) : 0.f;
+
+    // Spatial splits put primitives in more than one leaf, single ray traversal mailboxes them
+    Duplicates = root->HasDuplicates();
+
+    // Collapsing never makes the tree deeper, so the binary depth bounds the traversal stack
+    if (maxDepth(root, 1) > MaxTraversalDepth)
+    {
+        DEBUG_PRINTF("WideBVH: tree depth exceeds the traversal stack\n");
+        return false;
+    }
+
+    collapseNode(root);
+    if (Primitives.empty())
+    {
+        Nodes.clear();
+        Motion.clear();
+        return false;
+    }
+
+    // Single ray traversal gets specialized for trees made of one type
+    UniformType = LeafPrimitives::GetUniformType(PrimitiveTypes.data(), int(PrimitiveTypes.size()));
+
+    // Quantizing needs fixed bounds, moving trees keep the full nodes
+    if (quantize)
+    {
+        if (Moving)
+        {
+            DEBUG_PRINTF("WideBVH: moving trees can't be quantized\n");
+        }
+        else if (quantizeNodes())
+        {
+            std::vector<Node>().swap(Nodes);
+        }
+    }
+
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+template <int Width>
+void WideBVH<Width>::Refit(float time0, float time1)
+{
+    // Children are collapsed after their parent, so walking backwards has every interior child's bounds ready
+    const int                         numNodes = GetNumNodes();
+    std::vector<BVHNode::BuildBounds> nodeBounds0(numNodes), nodeBounds1(numNodes);
+    Node                              decoded;
+    for (int n = numNodes - 1; n >= 0; n--)
+    {
+        // Quantized nodes are refitted as a full node and encoded again. Their unused children decode inverted.
+        Node& node = Quantized ? decoded : Nodes[n];
+        if (Quantized)
+        {
+            const QuantizedNode& qnode = QuantizedNodes[n];
+            for (int i = 0; i < Width; i++)
+            {
+                const bool used = (qnode.QuantizedMin[0][i] <= qnode.QuantizedMax[0][i]);
+                node.ChildOffset[i] = qnode.ChildOffset[i];
+                node.ChildCount[i]  = used ? int32_t(qnode.ChildCount[i]) : -1;
+            }
+        }
+
+        nodeBounds0[n].Reset();
+        nodeBounds1[n].Reset();
+        for (int i = 0; i < Width; i++)
+        {
+            if (node.ChildCount[i] < 0)
+            {
+                continue;
+            }
+
+            BVHNode::BuildBounds childBounds0, childBounds1;
+            if (node.ChildCount[i] > 0)
+            {
+                BVHNode::BuildBounds childBounds;
+                BVHNode::GetPrimitiveBounds(&Primitives[node.ChildOffset[i]], node.ChildCount[i], time0, time1, childBounds, childBounds0, childBounds1);
+                if (!Moving)
+                {
+                    childBounds0 = childBounds;
+                    childBounds1 = childBounds;
+                }
+            }
+            else
+            {
+                childBounds0 = nodeBounds0[node.ChildOffset[i]];
+                childBounds1 = nodeBounds1[node.ChildOffset[i]];
+            }
+
+            for (int axis = 0; axis < 3; axis++)
+            {
+                node.BoundsMin[axis][i] = childBounds0.Min[axis];
+                node.BoundsMax[axis][i] = childBounds0.Max[axis];
+                if (Moving)
+                {
+                    Motion[n].DeltaMin[axis][i] = childBounds1.Min[axis] - childBounds0.Min[axis];
+                    Motion[n].DeltaMax[axis][i] = childBounds1.Max[axis] - childBounds0.Max[axis];
+                }
+            }
+
+            nodeBounds0[n].Grow(childBounds0);
+            nodeBounds1[n].Grow(childBounds1);
+        }
+
+        if (Quantized)
+        {
+            quantizeNode(node, QuantizedNodes[n]);
+        }
+    }
+
+    if (Moving)
+    {
+        MotionTime0       = time0;
+        MotionInvDuration = (time1 > time0) ? (1.f / (time1 - time0)) : 0.f;
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+template <int Width>
+bool WideBVH<Width>::childBounds(int nodeIndex, int child, BVHNode::BuildBounds& bounds0, BVHNode::BuildBounds& bounds1) const
+{
+    // False for unused children
+    if (Quantized)
+    {
+        const QuantizedNode& qnode = QuantizedNodes[nodeIndex];
+        if (qnode.QuantizedMin[0][child] > qnode.QuantizedMax[0][child])
+        {
+            return false;
+        }
+
+        // Rounded the same way as traversal decodes them
+        for (int axis = 0; axis < 3; axis++)
+        {
+            const Lanes origin = Lanes(qnode.Origin[axis]);
+            const Lanes scale  = Lanes(qnode.Scale[axis]);
+            bounds0.Min[axis]  = mul_add(Lanes(float(qnode.QuantizedMin[axis][child])), scale, origin)[0];
+            bounds0.Max[axis]  = mul_add(Lanes(float(qnode.QuantizedMax[axis][child])), scale, origin)[0];
+        }
+
+        bounds1 = bounds0;
+        return true;
+    }
+
+    const Node& node = Nodes[nodeIndex];
+    if (node.ChildCount[child] < 0)
+    {
+        return false;
+    }
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        bounds0.Min[axis] = node.BoundsMin[axis][child];
+        bounds0.Max[axis] = node.BoundsMax[axis][child];
+        bounds1.Min[axis] = bounds0.Min[axis] + (Moving ? Motion[nodeIndex].DeltaMin[axis][child] : 0.f);
+        bounds1.Max[axis] = bounds0.Max[axis] + (Moving ? Motion[nodeIndex].DeltaMax[axis][child] : 0.f);
+    }
+
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+template <int Width>
+void WideBVH<Width>::GetBounds(BVHNode::BuildBounds& bounds0, BVHNode::BuildBounds& bounds1) const
+{
+    bounds0.Reset();
+    bounds1.Reset();
+    for (int i = 0; i < Width && GetNumNodes() > 0; i++)
+    {
+        BVHNode::BuildBounds child0, child1;
+        if (childBounds(0, i, child0, child1))
+        {
+            bounds0.Grow(child0);
+            bounds1.Grow(child1);
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+template <int Width>
+float WideBVH<Width>::GetSAHCost() const
+{
+    // Children are costed over the whole time range, which for linear motion is the union of the two end boxes
+    BVHNode::BuildBounds rootBounds, rootBounds1;
+    GetBounds(rootBounds, rootBounds1);
+    rootBounds.Grow(rootBounds1);
+
+    const float rootArea = rootBounds.IsEmpty() ? 0.f : rootBounds.SurfaceArea();
+    if (rootArea <= 0.f)
+    {
+        return BVHNode::IntersectCost * float(GetNumPrimitives());
+    }
+
+    float cost = rootArea * BVHNode::TraversalCost;
+    for (int n = 0; n < GetNumNodes(); n++)
+    {
+        for (int i = 0; i < Width; i++)
+        {
+            BVHNode::BuildBounds bounds, bounds1;
+            if (!childBounds(n, i, bounds, bounds1))
+            {
+                continue;
+            }
+            bounds.Grow(bounds1);
+
+            const int count = Quantized ? int(QuantizedNodes[n].ChildCount[i]) : Nodes[n].ChildCount[i];
+            cost += bounds.SurfaceArea() * ((count > 0) ? (BVHNode::IntersectCost * float(count)) : BVHNode::TraversalCost);
+        }
+    }
+
+    return cost / rootArea;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+template <int Width>
+bool WideBVH<Width>::quantizeNodes()
+{
+    // Leaf sizes have to fit the 8-bit counts
+    for (const Node& node : Nodes)
+    {
+        for (int i = 0; i < Width; i++)
+        {
+            if (node.ChildCount[i] > 255)
+            {
+                DEBUG_PRINTF("WideBVH: leaf of %d primitives is too big to quantize\n", node.ChildCount[i]);
+                return false;
+            }
+        }
+    }
+
+    QuantizedNodes.resize(Nodes.size());
+    for (size_t n = 0; n < Nodes.size(); n++)
+    {
+        quantizeNode(Nodes[n], QuantizedNodes[n]);
+    }
+
+    Quantized = true;
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+template <int Width>
+void WideBVH<Width>::quantizeNode(const Node& node, QuantizedNode& qnode)
+{
+    for (int axis = 0; axis < 3; axis++)
+    {
+        // Node bounds are the union of its used children
+        float nodeMin = FLT_MAX, nodeMax = -FLT_MAX;
+        for (int i = 0; i < Width; i++)
+        {
+            if (node.ChildCount[i] >= 0)
+            {
+                nodeMin = GetMin(nodeMin, node.BoundsMin[axis][i]);
+                nodeMax = GetMax(nodeMax, node.BoundsMax[axis][i]);
+            }
+        }
+
+        // Grow the step until the top one reaches the node's maximum. Flat axes get any positive step, so unused
+        // children (255 to 0) still decode inverted.
+        float origin = nodeMin;
+        float scale  = (nodeMax > nodeMin) ? ((nodeMax - nodeMin) / 255.f) : 1.f;
+        auto  decode = [&origin, &scale](int q) -> float
+        {
+            return mul_add(Lanes(float(q)), Lanes(scale), Lanes(origin))[0];
+        };
+        while (decode(255) < nodeMax)
+        {
+            scale = nextafterf(scale, FLT_MAX);
+        }
+
+        qnode.Origin[axis] = origin;
+        qnode.Scale[axis]  = scale;
+
+        for (int i = 0; i < Width; i++)
+        {
+            if (node.ChildCount[i] < 0)
+            {
+                qnode.QuantizedMin[axis][i] = 255;
+                qnode.QuantizedMax[axis][i] = 0;
+                continue;
+            }
+
+            // Round down and up, then step outwards until the decoded planes, with the same rounding as
+            // traversal, contain the exact ones
+            const float childMin = node.BoundsMin[axis][i];
+            const float childMax = node.BoundsMax[axis][i];
+            int         qMin     = Clamp(int(floorf((childMin - origin) / scale)), 0, 255);
+            int         qMax     = Clamp(int(ceilf((childMax - origin) / scale)), qMin, 255);
+            while (qMin > 0 && decode(qMin) > childMin)
+            {
+                qMin--;
+            }
+            while (qMax < 255 && decode(qMax) < childMax)
+            {
+                qMax++;
+            }
+
+            qnode.QuantizedMin[axis][i] = uint8_t(qMin);
+            qnode.QuantizedMax[axis][i] = uint8_t(qMax);
+        }
+    }
+
+    for (int i = 0; i < Width; i++)
+    {
+        qnode.ChildOffset[i] = node.ChildOffset[i];
+        qnode.ChildCount[i]  = uint8_t(GetMax(node.ChildCount[i], 0));
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+template <>
+inline Vec4f WideBVH<4>::loadQuantized(const uint8_t* values)
+{
+    int32_t packed;
+    memcpy(&packed, values, sizeof(packed));
+
+    const Vec16uc bytes = Vec16uc(_mm_cvtsi32_si128(packed));
+    return to_float(Vec4i(extend_low(extend_low(bytes))));
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+template <>
+inline Vec8f WideBVH<8>::loadQuantized(const uint8_t* values)
+{
+    const Vec16uc bytes = Vec16uc(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(values)));
+    const Vec8us  words = extend_low(bytes);
+    return Vec8f(to_float(Vec4i(extend_low(words))), to_float(Vec4i(extend_high(words))));
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+template <int Width>
+inline void WideBVH<Width>::decodeBounds(const QuantizedNode& node, int axis, Lanes& boundsMin, Lanes& boundsMax)
+{
+    const Lanes origin = Lanes(node.Origin[axis]);
+    const Lanes scale  = Lanes(node.Scale[axis]);
+
+    boundsMin = mul_add(loadQuantized(node.QuantizedMin[axis]), scale, origin);
+    boundsMax = mul_add(loadQuantized(node.QuantizedMax[axis]), scale, origin);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+template <int Width>
+int WideBVH<Width>::maxDepth(BVHNode* node, int depth)
+{
+    if (node->IsLeaf())
+    {
+        return depth;
+    }
+
+    return GetMax(maxDepth(node->GetLeft(), depth + 1), maxDepth(node->GetRight(), depth + 1));
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+template <int Width>
+int WideBVH<Width>::collapseNode(BVHNode* node)
+{
+    // Start from the binary children and keep opening the largest interior one until the node is full
+    BVHNode* children[Width];
+    int      numChildren = 0;
+    if (node->IsLeaf())
+    {
+        children[numChildren++] = node;
+    }
+    else
+    {
+        children[numChildren++] = node->GetLeft();
+        children[numChildren++] = node->GetRight();
+    }
+
+    while (numChildren < Width)
+    {
+        int   bestChild = -1;
+        float bestArea  = -1.f;
+        for (int i = 0; i < numChildren; i++)
+        {
+            if (!children[i]->IsLeaf())
+            {
+                const AABB& box = children[i]->GetBox();
+                const Vec4  d    = box.Max() - box.Min();
+                const float area = (d.X() * d.Y()) + (d.Y() * d.Z()) + (d.Z() * d.X());
+                if (area > bestArea)
+                {
+                    bestArea  = area;
+                    bestChild = i;
+                }
+            }
+        }
+
+        if (bestChild < 0)
+        {
+            break;
+        }
+
+        BVHNode* opened = children[bestChild];
+        children[bestChild]      = opened->GetLeft();
+        children[numChildren++]  = opened->GetRight();
+    }
+
+    // Nodes may be reallocated while recursing, so go through the index
+    const int nodeIndex = int(Nodes.size());
+    Nodes.push_back(Node());
+    if (Moving)
+    {
+        Motion.push_back(MotionNode());
+    }
+
+    for (int i = 0; i < Width; i++)
+    {
+        if (i >= numChildren)
+        {
+            for (int axis = 0; axis < 3; axis++)
+            {
+                Nodes[nodeIndex].BoundsMin[axis][i] = FLT_MAX;
+                Nodes[nodeIndex].BoundsMax[axis][i] = -FLT_MAX;
+            }
+            Nodes[nodeIndex].ChildOffset[i] = 0;
+            Nodes[nodeIndex].ChildCount[i]  = -1;
+            if (Moving)
+            {
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    Motion[nodeIndex].DeltaMin[axis][i] = 0.f;
+                    Motion[nodeIndex].DeltaMax[axis][i] = 0.f;
+                }
+            }
+            continue;
+        }
+
+        if (Moving)
+        {
+            // Bounds at the start of the time range, plus how far they move by the end
+            const AABB& box0 = children[i]->GetBoxAtTime0();
+            const AABB& box1 = children[i]->GetBoxAtTime1();
+            for (int axis = 0; axis < 3; axis++)
+            {
+                Nodes[nodeIndex].BoundsMin[axis][i]  = box0.Min()[axis];
+                Nodes[nodeIndex].BoundsMax[axis][i]  = box0.Max()[axis];
+                Motion[nodeIndex].DeltaMin[axis][i]  = box1.Min()[axis] - box0.Min()[axis];
+                Motion[nodeIndex].DeltaMax[axis][i]  = box1.Max()[axis] - box0.Max()[axis];
+            }
+        }
+        else
+        {
+            const AABB& box = children[i]->GetBox();
+            for (int axis = 0; axis < 3; axis++)
+            {
+                Nodes[nodeIndex].BoundsMin[axis][i] = box.Min()[axis];
+                Nodes[nodeIndex].BoundsMax[axis][i] = box.Max()[axis];
+            }
+        }
+
+        if (children[i]->IsLeaf())
+        {
+            Nodes[nodeIndex].ChildOffset[i] = int32_t(Primitives.size());
+            Nodes[nodeIndex].ChildCount[i]  = children[i]->GetNumPrimitives();
+            for (int p = 0; p < children[i]->GetNumPrimitives(); p++)
+            {
+                Primitives.push_back(children[i]->GetPrimitive(p));
+            }
+
+            const int offset = Nodes[nodeIndex].ChildOffset[i];
+            PrimitiveTypes.resize(Primitives.size());
+            LeafPrimitives::SortByType(&Primitives[offset], &PrimitiveTypes[offset], children[i]->GetNumPrimitives());
+        }
+        else
+        {
+            const int childIndex = collapseNode(children[i]);
+            Nodes[nodeIndex].ChildOffset[i] = childIndex;
+            Nodes[nodeIndex].ChildCount[i]  = 0;
+        }
+    }
+
+    return nodeIndex;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+template <int Width>
+inline uint32_t WideBVH<Width>::intersectChildren(const Node& node, int nodeIndex, const int nearSide[3], const Lanes rayOrigin[3], const Lanes rayInvDir[3],
+                                                  const Lanes& motionScale, float tMin, float tMax, Lanes& tNear) const
+{
+    Lanes tFar = Lanes(tMax);
+    tNear = Lanes(tMin);
+    for (int axis = 0; axis < 3; axis++)
+    {
+        const float* nearPlane = nearSide[axis] ? node.BoundsMax[axis] : node.BoundsMin[axis];
+        const float* farPlane  = nearSide[axis] ? node.BoundsMin[axis] : node.BoundsMax[axis];
+        Lanes        nearP     = Lanes().load_a(nearPlane);
+        Lanes        farP      = Lanes().load_a(farPlane);
+
+        // Moving trees lerp the planes to the ray's time first
+        if (Moving)
+        {
+            const MotionNode& motion = Motion[nodeIndex];
+            nearP = mul_add(Lanes().load_a(nearSide[axis] ? motion.DeltaMax[axis] : motion.DeltaMin[axis]), motionScale, nearP);
+            farP  = mul_add(Lanes().load_a(nearSide[axis] ? motion.DeltaMin[axis] : motion.DeltaMax[axis]), motionScale, farP);
+        }
+
+        tNear = max(tNear, (nearP - rayOrigin[axis]) * rayInvDir[axis]);
+        tFar  = min(tFar, (farP - rayOrigin[axis]) * rayInvDir[axis]);
+    }
+
+    return to_bits(tNear <= tFar);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+template <int Width>
+inline uint32_t WideBVH<Width>::intersectChildren(const QuantizedNode& node, int /*nodeIndex*/, const int nearSide[3], const Lanes rayOrigin[3], const Lanes rayInvDir[3],
+                                                  const Lanes& /*motionScale*/, float tMin, float tMax, Lanes& tNear) const
+{
+    // Same slab test, on the decoded planes. Moving trees are never quantized, so there are no motion deltas to apply.
+    Lanes tFar = Lanes(tMax);
+    tNear = Lanes(tMin);
+    for (int axis = 0; axis < 3; axis++)
+    {
+        Lanes boundsMin, boundsMax;
+        decodeBounds(node, axis, boundsMin, boundsMax);
+
+        const Lanes nearP = nearSide[axis] ? boundsMax : boundsMin;
+        const Lanes farP  = nearSide[axis] ? boundsMin : boundsMax;
+
+        tNear = max(tNear, (nearP - rayOrigin[axis]) * rayInvDir[axis]);
+        tFar  = min(tFar, (farP - rayOrigin[axis]) * rayInvDir[axis]);
+    }
+
+    return to_bits(tNear <= tFar);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+template <int Width>
+bool WideBVH<Width>::Hit(const Ray& ray, float tMin, float tMax, HitRecord& rec) const
+{
+    return LeafPrimitives::Dispatch(UniformType, [&](auto* primType)
+    {
+        typedef typename std::remove_pointer<decltype(primType)>::type PrimType;
+        return Quantized ?
+            this->template hitNodes<QuantizedNode, PrimType>(QuantizedNodes, ray, tMin, tMax, rec) :
+            this->template hitNodes<Node, PrimType>(Nodes, ray, tMin, tMax, rec);
+    });
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+template <int Width>
+template <typename NodeType, typename PrimType>
+bool WideBVH<Width>::hitNodes(const std::vector<NodeType>& nodes, const Ray& ray, float tMin, float tMax, HitRecord& rec) const
+{
+    const float* invDirArray  = ray.InverseDirectionArray();
+    const Vec4   origin       = ray.Origin();
+    const Lanes  motionScale  = Lanes((ray.Time() - MotionTime0) * MotionInvDuration);
+    bool         hitAnything  = false;
+    float        closestSoFar = tMax;
+
+    // Pick near and far planes per axis once, instead of a min/max per slab
+    int nearSide[3];
+    Lanes rayOrigin[3], rayInvDir[3];
+    for (int axis = 0; axis < 3; axis++)
+    {
+        nearSide[axis]  = (invDirArray[axis] < 0.f) ? 1 : 0;
+        rayOrigin[axis] = Lanes(origin[axis]);
+        rayInvDir[axis] = Lanes(invDirArray[axis]);
+    }
+
+    StackEntry stack[MaxTraversalDepth * Width];
+    int        stackSize = 0;
+    stack[stackSize++] = { 0, 0, tMin };
+
+    BVHNode::Mailbox mailbox;
+    while (stackSize > 0)
+    {
+        const StackEntry entry = stack[--stackSize];
+        if (entry.TNear > closestSoFar)
+        {
+            continue;
+        }
+
+        if (entry.Count > 0)
+        {
+            // Only leaves call into the hitables
+            if (LeafPrimitives::HitLeaf<PrimType>(&Primitives[entry.Offset], &PrimitiveTypes[entry.Offset], entry.Count, ray, tMin,
+                                                  closestSoFar, rec, Duplicates ? &mailbox : nullptr))
+            {
+                hitAnything = true;
+            }
+            continue;
+        }
+
+        // Slab test every child at once
+        const NodeType& node    = nodes[entry.Offset];
+        Lanes           tNear;
+        uint32_t        hitMask = intersectChildren(node, entry.Offset, nearSide, rayOrigin, rayInvDir, motionScale, tMin, closestSoFar, tNear);
+        if (hitMask == 0)
+        {
+            continue;
+        }
+
+        pushChildren(node, tNear, hitMask, stack, stackSize);
+    }
+
+    return hitAnything;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+template <int Width>
+template <typename NodeType>
+inline void WideBVH<Width>::pushChildren(const NodeType& node, const Lanes& tNear, uint32_t hitMask, StackEntry* stack, int& stackSize)
+{
+    // Push the hit children far to near, so the nearest one is popped first
+    float childNear[Width];
+    tNear.store(childNear);
+
+    int   order[Width];
+    int   numHits = 0;
+    while (hitMask != 0)
+    {
+        const int child = bit_scan_forward(hitMask);
+        hitMask &= hitMask - 1;
+
+        int slot = numHits++;
+        while (slot > 0 && childNear[order[slot - 1]] < childNear[child])
+        {
+            order[slot] = order[slot - 1];
+            slot--;
+        }
+        order[slot] = child;
+    }
+
+    for (int i = 0; i < numHits; i++)
+    {
+        const int child = order[i];
+        stack[stackSize++] = { node.ChildOffset[child], node.ChildCount[child], childNear[child] };
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+template <int Width>
+bool WideBVH<Width>::Occluded(const Ray& ray, float tMin, float tMax) const
+{
+    return LeafPrimitives::Dispatch(UniformType, [&](auto* primType)
+    {
+        typedef typename std::remove_pointer<decltype(primType)>::type PrimType;
+        return Quantized ?
+            this->template occludedNodes<QuantizedNode, PrimType>(QuantizedNodes, ray, tMin, tMax) :
+            this->template occludedNodes<Node, PrimType>(Nodes, ray, tMin, tMax);
+    });
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+template <int Width>
+template <typename NodeType, typename PrimType>
+bool WideBVH<Width>::occludedNodes(const std::vector<NodeType>& nodes, const Ray& ray, float tMin, float tMax) const
+{
+    const float* invDirArray = ray.InverseDirectionArray();
+    const Vec4   origin      = ray.Origin();
+    const Lanes  motionScale = Lanes((ray.Time() - MotionTime0) * MotionInvDuration);
+
+    int nearSide[3];
+    Lanes rayOrigin[3], rayInvDir[3];
+    for (int axis = 0; axis < 3; axis++)
+    {
+        nearSide[axis]  = (invDirArray[axis] < 0.f) ? 1 : 0;
+        rayOrigin[axis] = Lanes(origin[axis]);
+        rayInvDir[axis] = Lanes(invDirArray[axis]);
+    }
+
+    // tMax never shrinks, so the stack only needs the child to visit
+    StackEntry stack[MaxTraversalDepth * Width];
+    int        stackSize = 0;
+    stack[stackSize++] = { 0, 0, tMin };
+
+    BVHNode::Mailbox mailbox;
+    while (stackSize > 0)
+    {
+        const StackEntry entry = stack[--stackSize];
+        if (entry.Count > 0)
+        {
+            if (LeafPrimitives::OccludedLeaf<PrimType>(&Primitives[entry.Offset], &PrimitiveTypes[entry.Offset], entry.Count, ray, tMin,
+                                                       tMax, Duplicates ? &mailbox : nullptr))
+            {
+                return true;
+            }
+            continue;
+        }
+
+        // Any hit will do, so hit children are pushed unsorted
+        const NodeType& node    = nodes[entry.Offset];
+        Lanes           tNear;
+        uint32_t        hitMask = intersectChildren(node, entry.Offset, nearSide, rayOrigin, rayInvDir, motionScale, tMin, tMax, tNear);
+        while (hitMask != 0)
+        {
+            const int child = bit_scan_forward(hitMask);
+            hitMask &= hitMask - 1;
+
+            stack[stackSize++] = { node.ChildOffset[child], node.ChildCount[child], 0.f };
+        }
+    }
+
+    return false;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+template <int Width>
+void WideBVH<Width>::HitPacket(const Ray* rays, int numRays, float tMin, float* tMax, HitRecord* recs, bool* hits) const
+{
+    // Bigger batches go through in chunks
+    if (numRays > MaxPacketSize)
+    {
+        for (int first = 0; first < numRays; first += MaxPacketSize)
+        {
+            HitPacket(rays + first, GetMin(int(MaxPacketSize), numRays - first), tMin, tMax + first, recs + first, hits + first);
+        }
+        return;
+    }
+
+    // Gather the packet's origin and inverse direction ranges. Interval arithmetic needs every ray heading the same way
+    // on each axis, and moving bounds depend on each ray's time, so anything else is traced one ray at a time. So are
+    // quantized trees, which trade packet culling for size.
+    float rayOrigin[3][MaxPacketSize], rayInvDir[3][MaxPacketSize];
+    float originMin[3], originMax[3], invDirMin[3], invDirMax[3];
+    int   nearSide[3];
+    bool  coherent = !Moving && !Quantized && (numRays > 1);
+    for (int axis = 0; axis < 3; axis++)
+    {
+        nearSide[axis]  = (rays[0].InverseDirectionArray()[axis] < 0.f) ? 1 : 0;
+        originMin[axis] = invDirMin[axis] = FLT_MAX;
+        originMax[axis] = invDirMax[axis] = -FLT_MAX;
+    }
+
+    for (int i = 0; i < numRays && coherent; i++)
+    {
+        const Vec4   origin = rays[i].Origin();
+        const float* invDir = rays[i].InverseDirectionArray();
+        for (int axis = 0; axis < 3; axis++)
+        {
+            coherent &= std::isfinite(invDir[axis]) && (((invDir[axis] < 0.f) ? 1 : 0) == nearSide[axis]);
+
+            rayOrigin[axis][i] = origin[axis];
+            rayInvDir[axis][i] = invDir[axis];
+            originMin[axis]    = GetMin(originMin[axis], origin[axis]);
+            originMax[axis]    = GetMax(originMax[axis], origin[axis]);
+            invDirMin[axis]    = GetMin(invDirMin[axis], invDir[axis]);
+            invDirMax[axis]    = GetMax(invDirMax[axis], invDir[axis]);
+        }
+    }
+
+    HitRecord tempRec;
+    if (!coherent)
+    {
+        for (int i = 0; i < numRays; i++)
+        {
+            if (Hit(rays[i], tMin, tMax[i], tempRec))
+            {
+                recs[i] = tempRec;
+                tMax[i] = tempRec.T;
+                hits[i] = true;
+            }
+        }
+        return;
+    }
+
+    float maxT = tMax[0];
+    for (int i = 1; i < numRays; i++)
+    {
+        maxT = GetMax(maxT, tMax[i]);
+    }
+
+    PacketStackEntry stack[MaxTraversalDepth * Width];
+    int              stackSize = 0;
+    stack[stackSize++] = { 0, 0, -1, 0, tMin };
+
+    while (stackSize > 0)
+    {
+        const PacketStackEntry entry = stack[--stackSize];
+        if (entry.TNear > maxT)
+        {
+            continue;
+        }
+
+        if (entry.Count > 0)
+        {
+            // Only rays that hit the leaf's own box call into the hitables
+            const Node&      parent = Nodes[entry.Parent];
+            IHitable* const* prims  = &Primitives[entry.Offset];
+            const uint8_t*   types  = &PrimitiveTypes[entry.Offset];
+            for (int i = 0; i < numRays; i++)
+            {
+                float t0 = tMin;
+                float t1 = tMax[i];
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    const float nearPlane = nearSide[axis] ? parent.BoundsMax[axis][entry.Lane] : parent.BoundsMin[axis][entry.Lane];
+                    const float farPlane  = nearSide[axis] ? parent.BoundsMin[axis][entry.Lane] : parent.BoundsMax[axis][entry.Lane];
+
+                    t0 = GetMax(t0, (nearPlane - rayOrigin[axis][i]) * rayInvDir[axis][i]);
+                    t1 = GetMin(t1, (farPlane - rayOrigin[axis][i]) * rayInvDir[axis][i]);
+                }
+
+                if (t0 > t1)
+                {
+                    continue;
+                }
+
+                if (LeafPrimitives::Hit(prims, types, entry.Count, rays[i], tMin, tMax[i], recs[i], nullptr))
+                {
+                    hits[i] = true;
+                }
+            }
+
+            // Hits pull in how far the packet still has to look
+            maxT = tMax[0];
+            for (int i = 1; i < numRays; i++)
+            {
+                maxT = GetMax(maxT, tMax[i]);
+            }
+            continue;
+        }
+
+        // Cull every child against the packet at once. Per axis, the smallest entry and largest exit distance any ray
+        // in the packet can have come from the corners of its origin and inverse direction ranges.
+        const Node& node  = Nodes[entry.Offset];
+        Lanes       tNear = Lanes(tMin);
+        Lanes       tFar  = Lanes(maxT);
+        for (int axis = 0; axis < 3; axis++)
+        {
+            const Lanes nearPlane = Lanes().load_a(nearSide[axis] ? node.BoundsMax[axis] : node.BoundsMin[axis]);
+            const Lanes farPlane  = Lanes().load_a(nearSide[axis] ? node.BoundsMin[axis] : node.BoundsMax[axis]);
+            const Lanes invLo     = Lanes(invDirMin[axis]);
+            const Lanes invHi     = Lanes(invDirMax[axis]);
+
+            const Lanes nearLo = nearPlane - Lanes(originMax[axis]);
+            const Lanes nearHi = nearPlane - Lanes(originMin[axis]);
+            tNear = max(tNear, min(min(nearLo * invLo, nearLo * invHi), min(nearHi * invLo, nearHi * invHi)));
+
+            const Lanes farLo = farPlane - Lanes(originMax[axis]);
+            const Lanes farHi = farPlane - Lanes(originMin[axis]);
+            tFar  = min(tFar, max(max(farLo * invLo, farLo * invHi), max(farHi * invLo, farHi * invHi)));
+        }
+
+        uint32_t hitMask = to_bits(tNear <= tFar);
+        if (hitMask == 0)
+        {
+            continue;
+        }
+
+        // Push the hit children far to near, like single rays
+        float childNear[Width];
+        tNear.store(childNear);
+
+        int   order[Width];
+        int   numHits = 0;
+        while (hitMask != 0)
+        {
+            const int child = bit_scan_forward(hitMask);
+            hitMask &= hitMask - 1;
+
+            int slot = numHits++;
+            while (slot > 0 && childNear[order[slot - 1]] < childNear[child])
+            {
+                order[slot] = order[slot - 1];
+                slot--;
+            }
+            order[slot] = child;
+        }
+
+        for (int i = 0; i < numHits; i++)
+        {
+            const int child = order[i];
+            stack[stackSize++] = { node.ChildOffset[child], node.ChildCount[child], entry.Offset, child, childNear[child] };
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+template <int Width>
+void WideBVH<Width>::HitStream(const Ray* rays, int numRays, float tMin, float* tMax, HitRecord* recs, bool* hits) const
+{
+    // Without misses to hide, switching between rays only costs
+    if (GetMemoryUsage() < size_t(StreamMinMemory))
+    {
+        HitRecord tempRec;
+        for (int i = 0; i < numRays; i++)
+        {
+            if (Hit(rays[i], tMin, tMax[i], tempRec))
+            {
+                recs[i] = tempRec;
+                tMax[i] = tempRec.T;
+                hits[i] = true;
+            }
+        }
+        return;
+    }
+
+    LeafPrimitives::Dispatch(UniformType, [&](auto* primType)
+    {
+        typedef typename std::remove_pointer<decltype(primType)>::type PrimType;
+        if (Quantized)
+        {
+            this->template hitStreamNodes<QuantizedNode, PrimType>(QuantizedNodes, rays, numRays, tMin, tMax, recs, hits);
+        }
+        else
+        {
+            this->template hitStreamNodes<Node, PrimType>(Nodes, rays, numRays, tMin, tMax, recs, hits);
+        }
+        return true;
+    });
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+template <int Width>
+template <typename NodeType, typename PrimType>
+void WideBVH<Width>::hitStreamNodes(const std::vector<NodeType>& nodes, const Ray* rays, int numRays, float tMin, float* tMax,
+                                    HitRecord* recs, bool* hits) const
+{
+    StreamState  states[StreamWidth];
+    StreamState* inFlight[StreamWidth];
+    int          numInFlight = 0;
+    int          nextRay     = 0;
+    while (numInFlight < StreamWidth && nextRay < numRays)
+    {
+        inFlight[numInFlight] = &states[numInFlight];
+        beginStream(*inFlight[numInFlight++], rays[nextRay], nextRay, tMin);
+        nextRay++;
+    }
+
+    // Round robin, one step per ray. A finished ray hands its state to the next one waiting, or once there are
+    // none left, its slot goes to the last ray in flight.
+    int slot = 0;
+    while (numInFlight > 0)
+    {
+        StreamState& state = *inFlight[slot];
+        const int    ray   = state.RayIndex;
+        if (stepStream<NodeType, PrimType>(nodes, state, rays[ray], tMin, tMax[ray], recs[ray], hits[ray]))
+        {
+            slot++;
+        }
+        else if (nextRay < numRays)
+        {
+            beginStream(state, rays[nextRay], nextRay, tMin);
+            nextRay++;
+            slot++;
+        }
+        else
+        {
+            inFlight[slot] = inFlight[--numInFlight];
+        }
+
+        if (slot >= numInFlight)
+        {
+            slot = 0;
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+template <int Width>
+inline void WideBVH<Width>::beginStream(StreamState& state, const Ray& ray, int rayIndex, float tMin) const
+{
+    const float* invDirArray = ray.InverseDirectionArray();
+    const Vec4   origin      = ray.Origin();
+    for (int axis = 0; axis < 3; axis++)
+    {
+        state.NearSide[axis]  = (invDirArray[axis] < 0.f) ? 1 : 0;
+        state.RayOrigin[axis] = Lanes(origin[axis]);
+        state.RayInvDir[axis] = Lanes(invDirArray[axis]);
+    }
+
+    state.MotionScale = Lanes((ray.Time() - MotionTime0) * MotionInvDuration);
+    state.RayIndex    = rayIndex;
+    state.LeafStage   = 0;
+    state.StackSize   = 1;
+    state.Stack[0]    = { 0, 0, tMin };
+    state.Mailbox     = BVHNode::Mailbox();
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+template <int Width>
+template <typename NodeType, typename PrimType>
+inline bool WideBVH<Width>::stepStream(const std::vector<NodeType>& nodes, StreamState& state, const Ray& ray, float tMin, float& tMax,
+                                       HitRecord& rec, bool& hit) const
+{
+    // Entries behind the closest hit cost nothing to drop, so they don't use up a step
+    while (state.StackSize > 0 && state.Stack[state.StackSize - 1].TNear > tMax)
+    {
+        state.StackSize--;
+        state.LeafStage = 0;
+    }
+
+    if (state.StackSize == 0)
+    {
+        return false;
+    }
+
+    const StackEntry entry = state.Stack[state.StackSize - 1];
+    if (entry.Count > 0)
+    {
+        // The primitive pointers were prefetched when the leaf came up, so reading them now is cheap
+        IHitable* const* prims = &Primitives[entry.Offset];
+        const uint8_t*   types = &PrimitiveTypes[entry.Offset];
+        if (state.LeafStage == 0)
+        {
+            // Mixed leaves only get the first line of each primitive
+            for (int i = 0; i < entry.Count; i++)
+            {
+                PrefetchLines(prims[i], sizeof(PrimType));
+            }
+            state.LeafStage = 1;
+            return true;
+        }
+
+        if (state.LeafStage == 1 && LeafPrimitives::PrefetchPayload(prims, types, entry.Count))
+        {
+            state.LeafStage = 2;
+            return true;
+        }
+
+        state.StackSize--;
+        state.LeafStage = 0;
+        if (LeafPrimitives::HitLeaf<PrimType>(prims, types, entry.Count, ray, tMin, tMax, rec, Duplicates ? &state.Mailbox : nullptr))
+        {
+            hit = true;
+        }
+    }
+    else
+    {
+        state.StackSize--;
+
+        const NodeType& node    = nodes[entry.Offset];
+        Lanes           tNear;
+        uint32_t        hitMask = intersectChildren(node, entry.Offset, state.NearSide, state.RayOrigin, state.RayInvDir, state.MotionScale,
+                                                    tMin, tMax, tNear);
+        pushChildren(node, tNear, hitMask, state.Stack, state.StackSize);
+    }
+
+    prefetchNext(nodes, state);
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+template <int Width>
+template <typename NodeType>
+inline void WideBVH<Width>::prefetchNext(const std::vector<NodeType>& nodes, const StreamState& state) const
+{
+    // Whatever is on top of the stack is what this ray reads on its next turn
+    if (state.StackSize == 0)
+    {
+        return;
+    }
+
+    const StackEntry& next = state.Stack[state.StackSize - 1];
+    if (next.Count > 0)
+    {
+        PrefetchLines(&Primitives[next.Offset], next.Count * sizeof(IHitable*));
+        PrefetchLines(&PrimitiveTypes[next.Offset], next.Count);
+        return;
+    }
+
+    PrefetchLines(&nodes[next.Offset], sizeof(NodeType));
+    if (Moving)
+    {
+        PrefetchLines(&Motion[next.Offset], sizeof(MotionNode));
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+namespace Core
+{
+    template class WideBVH<4>;
+    template class WideBVH<8>;
+}
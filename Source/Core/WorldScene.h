@@ -21,6 +21,7 @@
 
 #include "IHitable.h"
 #include "HitableList.h"
+#include "BVHNode.h"
 #include "Camera.h"
 #include <vector>
 
@@ -45,6 +46,12 @@ namespace Core
                 delete LightShapes;
                 LightShapes = nullptr;
             }
+
+            if (Source != nullptr)
+            {
+                delete Source;
+                Source = nullptr;
+            }
         }
 
         static inline WorldScene* Create(const Camera& camera, std::vector <IHitable*> hitables, std::vector<IHitable*> lightShapes)
@@ -57,7 +64,7 @@ namespace Core
             {
                 worldList[i] = hitables[i];
             }
-            newScene->World = new HitableList(worldList, worldListSize);
+            newScene->World = createWorld(camera, worldList, worldListSize);
 
             const int  lightShapesSize = (int)lightShapes.size();
             IHitable** lightShapesList = new IHitable * [lightShapesSize];
@@ -74,10 +81,11 @@ namespace Core
             return newScene;
         }
 
-        static inline WorldScene* Create(const Camera& camera, IHitable** hitables, int numHitables, IHitable** lightShapes = nullptr, int numLightShapes = 0)
+        static inline WorldScene* Create(const Camera& camera, IHitable** hitables, int numHitables, IHitable** lightShapes = nullptr, int numLightShapes = 0,
+                                         int bvhThreshold = AutoBVHThreshold)
         {
             WorldScene* newScene = new WorldScene();
-            newScene->World = new HitableList(hitables, numHitables);
+            newScene->World = createWorld(camera, hitables, numHitables, bvhThreshold);
 
             if (lightShapes != nullptr && numLightShapes > 0)
             {
@@ -109,15 +117,60 @@ namespace Core
         inline HitableList* GetLightShapes()    { return LightShapes; }
         inline Camera&      GetCamera()         { return TheCamera; }
 
+    public:
+
+        // Worlds with more hitables than this get a BVH built over them
+        static const int AutoBVHThreshold = 4;
+
     private:
 
-        WorldScene() : World(nullptr), LightShapes(nullptr) {}
+        WorldScene() : World(nullptr), LightShapes(nullptr), Source(nullptr) {}
+
+        // Takes ownership of the hitables array. Past the threshold the hitables go into a top level BVH, as long as
+        // every one of them has bounds over the camera's shutter time.
+        static inline HitableList* createWorld(const Camera& camera, IHitable** hitables, int numHitables, int bvhThreshold = AutoBVHThreshold)
+        {
+            if (numHitables <= bvhThreshold)
+            {
+                return new HitableList(hitables, numHitables);
+            }
+
+            float time0, time1;
+            camera.GetShutterTime(time0, time1);
+
+            AABB box;
+            for (int i = 0; i < numHitables; i++)
+            {
+                if (!hitables[i]->BoundingBox(time0, time1, box))
+                {
+                    return new HitableList(hitables, numHitables);
+                }
+            }
+
+            // Plain SAH, spatial splits would put some hitables in more than one leaf for scene walks to find twice
+            BVHNode* bvh = new BVHNode(hitables, numHitables, time0, time1, 1, BVHNode::BuildSAH);
+            delete[] hitables;
+
+            // Scene walks find the hitables in the root once the tree's released
+            if (BVHNode::GetReleaseTrees())
+            {
+                bvh->ReleaseTree();
+            }
+
+            IHitable** topLevel = new IHitable * [1];
+            topLevel[0] = bvh;
+
+            return new HitableList(topLevel, 1);
+        }
 
     private:
 
         HitableList* World;
         HitableList* LightShapes;
         Camera       TheCamera;
+        WorldScene*  Source;        // Scene this one was flattened from, it owns the materials
+
+        friend class SceneFlattener;
     };
 
 }
\ No newline at end of file
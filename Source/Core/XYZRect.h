@@ -43,6 +43,7 @@ namespace Core
 
         virtual bool        Hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const;
         virtual bool        BoundingBox(float t0, float t1, AABB& box) const;
+        virtual bool        Occluded(const Ray& r, float tMin, float tMax) const;
         virtual float       PdfValue(const Vec4& origin, const Vec4& v) const;
         virtual Vec4        Random(const Vec4& origin) const;
 
@@ -51,6 +52,10 @@ namespace Core
         AxisPlane           GetAxisPlane() const { return AxisMode; }
         virtual Material*   GetMaterial() override { return Mat; }
 
+    private:
+
+        bool      intersect(const Ray& r, float tMin, float tMax, float& t, float& a, float& b, Vec3f& normal) const;
+
     private:
 
         AxisPlane AxisMode;
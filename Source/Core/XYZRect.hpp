@@ -47,9 +47,9 @@ XYZRect::~XYZRect()
 
 // ----------------------------------------------------------------------------------------------------------------------------
 
-bool XYZRect::Hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const
+bool XYZRect::intersect(const Ray& r, float tMin, float tMax, float& t, float& a, float& b, Vec3f& normal) const
 {
-    Vec3f normal, planeP;
+    Vec3f planeP;
     float aParams[2], bParams[2];
     switch (AxisMode)
     {
@@ -93,9 +93,9 @@ bool XYZRect::Hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const
         return false;
     }
 
-    const float t = dot_product(planeP - r.OriginFast(), normal) / denom;
-    const float a = aParams[0] + t * aParams[1];
-    const float b = bParams[0] + t * bParams[1];
+    t = dot_product(planeP - r.OriginFast(), normal) / denom;
+    a = aParams[0] + t * aParams[1];
+    b = bParams[0] + t * bParams[1];
 
     SANITY_CHECK_FLOAT(t);
     SANITY_CHECK_FLOAT(a);
@@ -111,6 +111,20 @@ bool XYZRect::Hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const
         return false;
     }
 
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+bool XYZRect::Hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const
+{
+    Vec3f normal;
+    float t, a, b;
+    if (!intersect(r, tMin, tMax, t, a, b, normal))
+    {
+        return false;
+    }
+
     Vec4 slowNormal;
     normal.store(&slowNormal[0]);
 
@@ -126,6 +140,15 @@ bool XYZRect::Hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const
 
 // ----------------------------------------------------------------------------------------------------------------------------
 
+bool XYZRect::Occluded(const Ray& r, float tMin, float tMax) const
+{
+    Vec3f normal;
+    float t, a, b;
+    return intersect(r, tMin, tMax, t, a, b, normal);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
 bool XYZRect::BoundingBox(float t0, float t1, AABB& box) const
 {
     switch (AxisMode)
@@ -150,12 +173,14 @@ bool XYZRect::BoundingBox(float t0, float t1, AABB& box) const
 
 float XYZRect::PdfValue(const Vec4& origin, const Vec4& v) const
 {
-    HitRecord rec;
-    if (this->Hit(Ray(origin, v), 0.001f, FLT_MAX, rec))
+    // Only the distance and normal are needed, not a full hit record
+    Vec3f normal;
+    float t, a, b;
+    if (intersect(Ray(origin, v), 0.001f, FLT_MAX, t, a, b, normal))
     {
         float area            = (A1 - A0) * (B1 - B0);
-        float distanceSquared = rec.T * rec.T * v.SquaredLength();
-        float cosine          = fabs(Dot(v, rec.Normal) / v.Length());
+        float distanceSquared = t * t * v.SquaredLength();
+        float cosine          = fabs(dot_product(Vec3f(v[0], v[1], v[2]), normal) / v.Length());
         float ret             = distanceSquared / (cosine * area);
 
         SANITY_CHECK_FLOAT(ret);
@@ -171,8 +196,11 @@ float XYZRect::PdfValue(const Vec4& origin, const Vec4& v) const
 
 Vec4 XYZRect::Random(const Vec4& origin) const
 {
-    const float a = A0 + RandomFloat() * (A1 - A0);
-    const float b = B0 + RandomFloat() * (B1 - B0);
+    float u, v;
+    Sample2D(u, v);
+
+    const float a = A0 + u * (A1 - A0);
+    const float b = B0 + v * (B1 - B0);
     const float c = K;
 
     Vec4 randomPoint;
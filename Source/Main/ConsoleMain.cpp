@@ -17,9 +17,12 @@
 // 
 // ----------------------------------------------------------------------------------------------------------------------------
 
+#include "Core/BVHAnalyzer.h"
+#include "Core/BVHNode.h"
 #include "Core/Camera.h"
 #include "Core/Raytracer.h"
 #include "Core/SampleScenes.h"
+#include "Core/SceneFlattener.h"
 #include <cstring>
 
 using namespace Core;
@@ -41,6 +44,19 @@ static float  sAspect           = float(sOutputWidth) / float(sOutputHeight);
 static int    sNumSamplesPerRay = 500;
 static int    sMaxScatterDepth  = 50;
 static int    sNumThreads       = 4;
+static int    sTileSize         = 32;
+static int    sTileSamples      = 1;
+static int    sRandomSeed       = 0;
+static int    sSamplerType      = 1;
+static int    sBVHWidth         = 8;
+static int    sBVHBuildMethod   = 0;
+static int    sBVHQuantize      = 0;
+static int    sBVHStatsRays     = 0;
+static int    sPacketTracing    = 1;
+static int    sIntegrator       = 0;
+static int    sRayReordering    = 0;
+static int    sInterleave       = 0;
+static int    sFlattenScene     = 0;
 
 static SceneConfig sSceneConfigs[] =
 {
@@ -85,6 +101,22 @@ static void parseCommandline(int argc, const char* argv[])
         {
             sOutputHeight = atoi(argv[++i]);
         }
+        else if (strstr(argv[i], "tilesamples") != nullptr && (i + 1) < argc)
+        {
+            sTileSamples = atoi(argv[++i]);
+        }
+        else if (strstr(argv[i], "tilesize") != nullptr && (i + 1) < argc)
+        {
+            sTileSize = atoi(argv[++i]);
+        }
+        else if (strstr(argv[i], "seed") != nullptr && (i + 1) < argc)
+        {
+            sRandomSeed = atoi(argv[++i]);
+        }
+        else if (strstr(argv[i], "sampler") != nullptr && (i + 1) < argc)
+        {
+            sSamplerType = atoi(argv[++i]);
+        }
         else if (strstr(argv[i], "samples") != nullptr && (i + 1) < argc)
         {
             sNumSamplesPerRay = atoi(argv[++i]);
@@ -97,6 +129,42 @@ static void parseCommandline(int argc, const char* argv[])
         {
             sNumThreads = atoi(argv[++i]);
         }
+        else if (strstr(argv[i], "bvhbuild") != nullptr && (i + 1) < argc)
+        {
+            sBVHBuildMethod = atoi(argv[++i]);
+        }
+        else if (strstr(argv[i], "bvhstats") != nullptr && (i + 1) < argc)
+        {
+            sBVHStatsRays = atoi(argv[++i]);
+        }
+        else if (strstr(argv[i], "bvhquantize") != nullptr && (i + 1) < argc)
+        {
+            sBVHQuantize = atoi(argv[++i]);
+        }
+        else if (strstr(argv[i], "bvh") != nullptr && (i + 1) < argc)
+        {
+            sBVHWidth = atoi(argv[++i]);
+        }
+        else if (strstr(argv[i], "packets") != nullptr && (i + 1) < argc)
+        {
+            sPacketTracing = atoi(argv[++i]);
+        }
+        else if (strstr(argv[i], "integrator") != nullptr && (i + 1) < argc)
+        {
+            sIntegrator = atoi(argv[++i]);
+        }
+        else if (strstr(argv[i], "reorder") != nullptr && (i + 1) < argc)
+        {
+            sRayReordering = atoi(argv[++i]);
+        }
+        else if (strstr(argv[i], "interleave") != nullptr && (i + 1) < argc)
+        {
+            sInterleave = atoi(argv[++i]);
+        }
+        else if (strstr(argv[i], "flatten") != nullptr && (i + 1) < argc)
+        {
+            sFlattenScene = atoi(argv[++i]);
+        }
         else if (strstr(argv[i], "noscene") != nullptr && (i + 1) < argc)
         {
             const int sceneNum = atoi(argv[++i]);
@@ -109,11 +177,11 @@ static void parseCommandline(int argc, const char* argv[])
 
     if (argc <= 1)
     {
-        printf("Commandline usage:\n\twidth [num]  height [num]  samples [num]  depth [num]  threads [num]  noscene [sceneNum]\n");
+        printf("Commandline usage:\n\twidth [num]  height [num]  samples [num]  depth [num]  threads [num]  tilesize [num]  tilesamples [num]  seed [num]  sampler [0=random,1=sobol]  bvh [2|4|8]  bvhbuild [0=sah,1=morton,2=sbvh]  bvhquantize [0|1]  bvhstats [numRays]  packets [0|1]  integrator [0=recursive,1=wavefront]  reorder [0|1]  interleave [0|1]  flatten [0|1]  noscene [sceneNum]\n");
     }
 
-    printf("Current tracing parameters:\n\tresolution:%dx%d numSamples:%d scatterDepth:%d numThreads:%d\n",
-        sOutputWidth, sOutputHeight, sNumSamplesPerRay, sMaxScatterDepth, sNumThreads);
+    printf("Current tracing parameters:\n\tresolution:%dx%d numSamples:%d scatterDepth:%d numThreads:%d tileSize:%d tileSamples:%d seed:%d sampler:%d bvh:%d bvhBuild:%d bvhQuantize:%d packets:%d integrator:%d reorder:%d interleave:%d flatten:%d\n",
+        sOutputWidth, sOutputHeight, sNumSamplesPerRay, sMaxScatterDepth, sNumThreads, sTileSize, sTileSamples, sRandomSeed, sSamplerType, sBVHWidth, sBVHBuildMethod, sBVHQuantize, sPacketTracing, sIntegrator, sRayReordering, sInterleave, sFlattenScene);
 }
 
 // ----------------------------------------------------------------------------------------------------------------------------
@@ -123,14 +191,77 @@ int main(int argc, const char* argv[])
     // Create ray tracer
     parseCommandline(argc, argv);
     Raytracer tracer(sOutputWidth, sOutputHeight, sNumSamplesPerRay, sMaxScatterDepth, sNumThreads, true);
+    tracer.SetTileOptions(sTileSize, sTileSamples);
+    tracer.SetRandomSeed((uint32_t)sRandomSeed);
+    tracer.SetSamplerType((sSamplerType == 1) ? Raytracer::SamplerSobol : Raytracer::SamplerRandom);
+    tracer.SetPacketTracing(sPacketTracing != 0);
+    tracer.SetIntegratorType((sIntegrator == 1) ? Raytracer::IntegratorWavefront : Raytracer::IntegratorRecursive);
+    tracer.SetRayReordering(sRayReordering != 0);
+    tracer.SetInterleavedTracing(sInterleave != 0);
+    if (sBVHWidth == 2)
+    {
+        BVHNode::SetDefaultLayout(BVHNode::LayoutBinary);
+    }
+    else if (sBVHWidth == 4)
+    {
+        BVHNode::SetDefaultLayout((sBVHQuantize != 0) ? BVHNode::LayoutQuantized4 : BVHNode::LayoutWide4);
+    }
+    else
+    {
+        BVHNode::SetDefaultLayout((sBVHQuantize != 0) ? BVHNode::LayoutQuantized8 : BVHNode::LayoutWide8);
+    }
+    BVHNode::SetDefaultBuildMethod((sBVHBuildMethod == 1) ? BVHNode::BuildMorton : ((sBVHBuildMethod == 2) ? BVHNode::BuildSpatialSAH : BVHNode::BuildSAH));
+
+    // The analyzer walks the binary trees, which are otherwise dropped once they're compiled
+    BVHNode::SetReleaseTrees(sBVHStatsRays <= 0);
 
     for (int i = 0; i < sNumSceneConfigs; i++)
     {
         if (sSceneConfigs[i].Enabled)
         {
+            BVHNode::ResetBuildStats();
             WorldScene* worldScene = GetSampleScene(sSceneConfigs[i].SceneType);
+
+            // Bake transforms and flips into world space primitives
+            SceneFlattener::Stats flattenStats = {};
+            if (sFlattenScene != 0)
+            {
+                worldScene = SceneFlattener::Flatten(worldScene, &flattenStats);
+            }
+
+            const BVHNode::BuildStats buildStats = BVHNode::GetBuildStats();
+            printf("\nBuilt %d BVHs: %lld nodes over %lld primitives in %.2fms\n",
+                buildStats.NumBuilds, (long long)buildStats.NumNodes, (long long)buildStats.NumPrimitives, buildStats.BuildTimeMs);
+            if (buildStats.NumDuplicates > 0)
+            {
+                printf("Spatial splits added %lld primitive references\n", (long long)buildStats.NumDuplicates);
+            }
+            if (sFlattenScene != 0)
+            {
+                printf("Flattened into %d triangles and %d other primitives, removing %d wrappers (%d hitables left unbaked)\n",
+                    flattenStats.NumTriangles, flattenStats.NumPrimitives, flattenStats.NumWrappersRemoved, flattenStats.NumUnbaked);
+            }
+
             worldScene->GetCamera().SetFocusDistanceToLookAt();
             worldScene->GetCamera().SetAspect(float(sOutputWidth) / float(sOutputHeight));
+
+            // Report on the BVHs and dump them instead of rendering
+            if (sBVHStatsRays > 0)
+            {
+                std::vector<BVHAnalyzer::Report> reports;
+                BVHAnalyzer::Analyze(worldScene, sBVHStatsRays, reports);
+                for (const BVHAnalyzer::Report& report : reports)
+                {
+                    printf("%s", BVHAnalyzer::Format(report).c_str());
+                }
+
+                const std::string dumpPath = std::string(RT_OUTPUT_IMAGE_DIR) + sSceneConfigs[i].OutputName + std::string(".bvh.txt");
+                if (BVHAnalyzer::Dump(worldScene, dumpPath.c_str()))
+                {
+                    printf("Wrote %s\n", dumpPath.c_str());
+                }
+                continue;
+            }
             raytraceAndPrintProgress(tracer, worldScene);
             WriteImageAndLog(&tracer, sSceneConfigs[i].OutputName);
         }
@@ -422,10 +422,16 @@ void RealtimeScene::GenerateRenderListFromWorld(Core::IHitable* currentHead, std
     else if (tid == typeid(Core::BVHNode))
     {
         Core::BVHNode* bvhNode = (Core::BVHNode*)currentHead;
-
-        GenerateRenderListFromWorld(bvhNode->GetLeft(), matrixStack, flipNormalStack);
-        if (bvhNode->GetLeft() != bvhNode->GetRight())
+        if (bvhNode->IsLeaf())
+        {
+            for (int i = 0; i < bvhNode->GetNumPrimitives(); i++)
+            {
+                GenerateRenderListFromWorld(bvhNode->GetPrimitive(i), matrixStack, flipNormalStack);
+            }
+        }
+        else
         {
+            GenerateRenderListFromWorld(bvhNode->GetLeft(), matrixStack, flipNormalStack);
             GenerateRenderListFromWorld(bvhNode->GetRight(), matrixStack, flipNormalStack);
         }
     }
@@ -448,6 +454,22 @@ void RealtimeScene::GenerateRenderListFromWorld(Core::IHitable* currentHead, std
         GenerateRenderListFromWorld(rotateYHitable->GetHitObject(), matrixStack, flipNormalStack);
         matrixStack.pop_back();
     }
+    else if (tid == typeid(Core::HitableInstance))
+    {
+        Core::HitableInstance*        instance = (Core::HitableInstance*)currentHead;
+        const Core::AffineTransform&  xform    = instance->GetObjectToWorld();
+
+        // Row vector convention, so the 3x4 goes in transposed
+        XMMATRIX objectToWorld = XMMatrixSet(
+            xform.Get(0, 0), xform.Get(1, 0), xform.Get(2, 0), 0.f,
+            xform.Get(0, 1), xform.Get(1, 1), xform.Get(2, 1), 0.f,
+            xform.Get(0, 2), xform.Get(1, 2), xform.Get(2, 2), 0.f,
+            xform.Get(0, 3), xform.Get(1, 3), xform.Get(2, 3), 1.f);
+
+        matrixStack.push_back(objectToWorld);
+        GenerateRenderListFromWorld(instance->GetHitObject(), matrixStack, flipNormalStack);
+        matrixStack.pop_back();
+    }
     else if (tid == typeid(Core::FlipNormals))
     {
         Core::FlipNormals* flipNormals = (Core::FlipNormals*)currentHead;
@@ -41,6 +41,7 @@ Renderer::Renderer(uint32_t width, uint32_t height)
     : RenderInterface("Raytracer", width, height)
     , TheAppState(AppState_Loading)
     , TheRaytracer(nullptr)
+    , CpuThreadPool(nullptr)
     , TheWorldScene(nullptr)
     , TheRenderScene(nullptr)
     , TheLoadingThread(nullptr)
@@ -93,6 +94,12 @@ Renderer::~Renderer()
         delete TheRaytracer;
     }
 
+    if (CpuThreadPool != nullptr)
+    {
+        delete CpuThreadPool;
+        CpuThreadPool = nullptr;
+    }
+
     if (TheWorldScene != nullptr)
     {
         delete TheWorldScene;
@@ -303,8 +310,14 @@ void Renderer::OnResizeCpuRaytracer(bool startRaytrace)
         TheRaytracer = nullptr;
     }
 
+    // Worker threads are shared across ray tracer instances, so resizes don't respawn them
+    if (CpuThreadPool == nullptr)
+    {
+        CpuThreadPool = new ThreadPool(TheUserInputData.CpuNumThreads);
+    }
+
     // Create the ray tracer
-    TheRaytracer = new Raytracer(backbufferWidth, backbufferHeight, TheUserInputData.CpuNumSamplesPerRay, TheUserInputData.CpuMaxScatterDepth, TheUserInputData.CpuNumThreads, true);
+    TheRaytracer = new Raytracer(backbufferWidth, backbufferHeight, TheUserInputData.CpuNumSamplesPerRay, TheUserInputData.CpuMaxScatterDepth, TheUserInputData.CpuNumThreads, true, CpuThreadPool);
 
     if (isTracing || startRaytrace)
     {
@@ -245,6 +245,7 @@ namespace RealtimeEngine
 
         AppState                        TheAppState;
         Core::Raytracer*                TheRaytracer;
+        Core::ThreadPool*               CpuThreadPool;
         Core::WorldScene*               TheWorldScene;
         RealtimeEngine::RealtimeScene*  TheRenderScene;
         UserInputData                   TheUserInputData;